@@ -0,0 +1,817 @@
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include "windows.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "math.h"
+#include "vector"
+#include "deque"
+#include "map"
+#include "string"
+#include "algorithm"
+
+#include "../NetChannel/Inc/Channel.h"
+#include "../NetChannel/Inc/Scheduler.h"
+
+/*
+	Headless load generator for IRC_Server. Simulated users speak the same
+	protocol as IRC_Client, command 0 with the username once connected and
+	command 1 with chat lines, all of them from this one process.
+
+		IRC_LoadGen <host> [options]
+
+		-port n			Server port, 920
+		-users n		Users kept online, 100
+		-join f			Joins per second, 50
+		-rate f			Chat messages per user per second, 0.2
+		-size min max	Chat message length, 32 to 256 and at most 511
+		-dist d			fixed (always min), uniform, or exp: min plus an
+						exponential tail averaging a quarter of the range
+		-churn f		Fraction of the online users leaving each second,
+						each rejoins under a new name, 0
+		-time n			Seconds to run, ramp-up included, 60
+		-perip n		Users per source address, 3
+		-tickrate n		Tickrate of the users' channels, channel default
+
+	Every chat line starts with "#<time sent>", receivers take it back out of
+	the relayed "<user>: " line, so latencies are from SendNetMessage to the
+	receiving user's handler. A user is online once the server's "<name>
+	connected." announcement reaches it, and a relay is expected for every
+	user that was online when a message was sent. Leaving users linger for
+	LOADGEN_LINGER before they disconnect, relays already on their way still
+	count; expected relays that never arrive are reported as dropped.
+
+	Once a second a CSV row is printed:
+
+		seconds, online, joins, leaves, sent, delivered, p50_us, p99_us, p999_us
+
+	then the totals, with the server's side of it: relays dropped, users the
+	server disconnected by reason, connections lost and refused, and joins
+	that timed out.
+
+	Against a loopback host the users bind source addresses across
+	127.0.0.0/8, -perip of them each, so the server's per address limit
+	isn't hit; -perip 0 leaves it to the system. Every user is a channel with
+	its network thread, thousands of users are thousands of threads. Connect
+	and Disconnect wait for their message to go out, a pool of workers runs
+	them so the join rate isn't bound by it.
+*/
+
+#define IRC_DEFAULT_PORT			920
+#define IRC_MAX_MESSAGE				511		/* The server reads chat lines into 512 bytes */
+
+#define LOADGEN_WORKERS				32
+#define LOADGEN_FRAME				10		/* Milliseconds between driver frames */
+#define LOADGEN_LINGER				1000000ULL	/* Microseconds a leaving user stays connected */
+#define LOADGEN_JOIN_TIMEOUT		10000000ULL
+#define LOADGEN_DRAIN				3000000ULL	/* After the last message, for the relays still on their way */
+
+/* "#<16 hex digits> " */
+#define LOADGEN_HEADER_SIZE			18
+
+#define LOADGEN_HISTOGRAM_STEP		100		/* Microseconds per bucket */
+#define LOADGEN_HISTOGRAM_BUCKETS	600000	/* A minute, the last bucket holds the rest */
+
+enum loadgen_state_t
+{
+	LOADGEN_IDLE,			/* Waiting to join */
+	LOADGEN_JOINING,		/* Connecting, or connected and not yet announced */
+	LOADGEN_ONLINE,
+	LOADGEN_LEAVING			/* Lingering, then disconnected */
+};
+
+enum loadgen_dist_t
+{
+	LOADGEN_DIST_FIXED,
+	LOADGEN_DIST_UNIFORM,
+	LOADGEN_DIST_EXP
+};
+
+struct loadgen_user_t
+{
+	INetChannel*			m_pNetChannel;
+	loadgen_state_t			m_nState;
+	bool					m_bBusy;			/* Queued for or held by a worker */
+	int						m_nOnlineSlot;		/* Index in g_Online while online */
+	long					m_nGeneration;		/* Joins so far, names stay unique across churn */
+	unsigned long long		m_nJoinTime;
+	unsigned long long		m_nOnlineTime;
+	unsigned long long		m_nLeaveTime;
+	char					m_szName[ 64 ];
+};
+
+struct loadgen_histogram_t
+{
+	loadgen_histogram_t() : m_Buckets( LOADGEN_HISTOGRAM_BUCKETS, 0 ), m_nCount( 0 ) {}
+
+	void Add( unsigned long long nMicroseconds )
+	{
+		++m_Buckets[ ( size_t ) min( nMicroseconds / LOADGEN_HISTOGRAM_STEP, ( unsigned long long ) LOADGEN_HISTOGRAM_BUCKETS - 1 ) ];
+		++m_nCount;
+	}
+
+	unsigned long long Percentile( double flQuantile ) const
+	{
+		if ( !m_nCount )
+			return 0;
+
+		unsigned long long nTarget = ( unsigned long long ) ( flQuantile * m_nCount );
+		unsigned long long nSeen = 0;
+
+		for ( size_t i = 0; i < m_Buckets.size(); ++i )
+		{
+			nSeen += m_Buckets[ i ];
+
+			if ( nSeen > nTarget )
+				return i * LOADGEN_HISTOGRAM_STEP;
+		}
+
+		return ( m_Buckets.size() - 1 ) * LOADGEN_HISTOGRAM_STEP;
+	}
+
+	void Clear()
+	{
+		std::fill( m_Buckets.begin(), m_Buckets.end(), 0 );
+		m_nCount = 0;
+	}
+
+	std::vector< unsigned long >	m_Buckets;
+	unsigned long long				m_nCount;
+};
+
+/* Options */
+char			g_szHost[ 128 ];
+int				g_nPort = IRC_DEFAULT_PORT;
+int				g_nUsers = 100;
+double			g_flJoinRate = 50.0;
+double			g_flMessageRate = 0.2;
+int				g_nMinSize = 32;
+int				g_nMaxSize = 256;
+loadgen_dist_t	g_nDist = LOADGEN_DIST_UNIFORM;
+double			g_flChurn = 0.0;
+int				g_nSeconds = 60;
+int				g_nUsersPerIP = 3;
+int				g_nTickRate = 0;
+
+sockaddr_in		g_HostAddress;
+bool			g_bLoopback;
+volatile bool	g_bActive;
+
+/* Everything below is under g_hUserLock */
+CRITICAL_SECTION					g_hUserLock;
+std::vector< loadgen_user_t >		g_Users;
+std::map< INetChannel*, int >		g_Channels;
+std::vector< int >					g_Online;
+std::deque< int >					g_WorkQueue;
+
+loadgen_histogram_t					g_IntervalLatency;
+loadgen_histogram_t					g_TotalLatency;
+std::vector< unsigned long long >	g_JoinSamples;
+std::map< std::string, long >		g_HostDisconnects;	/* By reason */
+
+long long	g_nSent;
+long long	g_nExpected;
+long long	g_nDelivered;
+long		g_nJoins;
+long		g_nLeaves;
+long		g_nLost;
+long		g_nRefused;
+long		g_nJoinTimeouts;
+
+unsigned long LOADGEN_Random( unsigned long n )
+{
+	return ( ( ( unsigned long ) rand() << 15 ) ^ ( unsigned long ) rand() ) % n;
+}
+
+double LOADGEN_RandomFloat()
+{
+	return rand() / ( RAND_MAX + 1.0 );
+}
+
+int LOADGEN_MessageSize()
+{
+	switch ( g_nDist )
+	{
+	case LOADGEN_DIST_UNIFORM:
+		return g_nMinSize + LOADGEN_Random( g_nMaxSize - g_nMinSize + 1 );
+	case LOADGEN_DIST_EXP:
+	{
+		double flMean = ( g_nMaxSize - g_nMinSize ) / 4.0;
+		return min( g_nMinSize + ( int ) ( -flMean * log( 1.0 - LOADGEN_RandomFloat() ) ), g_nMaxSize );
+	}
+	default:
+		return g_nMinSize;
+	}
+}
+
+void LOADGEN_SetOnline( int nUser, bool bOnline )
+{
+	loadgen_user_t& user = g_Users[ nUser ];
+
+	if ( bOnline )
+	{
+		user.m_nOnlineSlot = g_Online.size();
+		g_Online.push_back( nUser );
+		return;
+	}
+
+	int nLast = g_Online.back();
+	g_Online[ user.m_nOnlineSlot ] = nLast;
+	g_Users[ nLast ].m_nOnlineSlot = user.m_nOnlineSlot;
+	g_Online.pop_back();
+
+	user.m_nOnlineSlot = -1;
+}
+
+void LOADGEN_Queue( int nUser )
+{
+	g_Users[ nUser ].m_bBusy = true;
+	g_WorkQueue.push_back( nUser );
+}
+
+void LOADGEN_MessageHandler( INetChannel* pNetChannel, INetMessage* pNetMessage )
+{
+	if ( pNetMessage->GetType() != net_HandlerMsg )
+		return;
+
+	unsigned long long nNow = NET_GetTime();
+
+	bf_read& stream = ( ( CNETHandlerMessage* ) pNetMessage )->GetRead();
+
+	if ( stream.ReadByte() != 0 )
+		return;
+
+	char szFullLine[ 1024 ];
+	stream.ReadString( szFullLine, sizeof( szFullLine ) );
+
+	CRITICAL_SECTION_AUTOLOCK( g_hUserLock );
+
+	std::map< INetChannel*, int >::iterator it = g_Channels.find( pNetChannel );
+
+	if ( it == g_Channels.end() )
+		return;
+
+	loadgen_user_t& user = g_Users[ it->second ];
+
+	/* Chat line, counted if the message was sent while this user was online */
+	const char* pszTime = strstr( szFullLine, ">: #" );
+
+	if ( pszTime )
+	{
+		unsigned long long nSendTime = strtoull( pszTime + 4, NULL, 16 );
+
+		if ( user.m_nState == LOADGEN_ONLINE || user.m_nState == LOADGEN_LEAVING )
+		{
+			if ( user.m_nOnlineTime <= nSendTime && ( user.m_nState == LOADGEN_ONLINE || nSendTime < user.m_nLeaveTime ) )
+			{
+				g_IntervalLatency.Add( nNow - nSendTime );
+				g_TotalLatency.Add( nNow - nSendTime );
+				++g_nDelivered;
+			}
+		}
+
+		return;
+	}
+
+	/* The server's announcement of this user */
+	if ( user.m_nState == LOADGEN_JOINING )
+	{
+		char szLine[ 128 ];
+		snprintf( szLine, sizeof( szLine ), "%s connected.\n", user.m_szName );
+
+		if ( !strcmp( szFullLine, szLine ) )
+		{
+			/* Taken under the lock, the driver stamps messages under it too */
+			user.m_nState = LOADGEN_ONLINE;
+			user.m_nOnlineTime = NET_GetTime();
+			LOADGEN_SetOnline( it->second, true );
+
+			g_JoinSamples.push_back( user.m_nOnlineTime - user.m_nJoinTime );
+			++g_nJoins;
+		}
+	}
+}
+
+/* Runs on a worker, the user isn't touched by the driver meanwhile */
+void LOADGEN_Join( int nUser )
+{
+	char szName[ 64 ];
+	unsigned long nSource = 0;
+	{
+		CRITICAL_SECTION_AUTOLOCK( g_hUserLock );
+
+		loadgen_user_t& user = g_Users[ nUser ];
+		snprintf( user.m_szName, sizeof( user.m_szName ), "loadgen_%d_%ld", nUser, user.m_nGeneration++ );
+		strcpy( szName, user.m_szName );
+
+		if ( g_bLoopback && g_nUsersPerIP > 0 )
+			nSource = 0x7F000001 + nUser / g_nUsersPerIP;
+	}
+
+	SOCKET hSocket = socket( AF_INET, SOCK_STREAM, IPPROTO_TCP );
+
+	bool bConnected = ( hSocket != INVALID_SOCKET );
+
+	if ( bConnected && nSource )
+	{
+		sockaddr_in source;
+		memset( &source, 0, sizeof( source ) );
+		source.sin_family = AF_INET;
+		source.sin_addr.s_addr = htonl( nSource );
+
+		bConnected = ( bind( hSocket, ( sockaddr* ) &source, sizeof( source ) ) != SOCKET_ERROR );
+	}
+
+	if ( bConnected )
+		bConnected = ( connect( hSocket, ( sockaddr* ) &g_HostAddress, sizeof( g_HostAddress ) ) != SOCKET_ERROR );
+
+	INetChannel* pNetChannel = NULL;
+
+	if ( bConnected )
+	{
+		pNetChannel = NET_CreateChannel();
+		pNetChannel->SetMessageHandler( &LOADGEN_MessageHandler );
+
+		if ( g_nTickRate )
+			pNetChannel->SetTickRate( g_nTickRate );
+
+		{
+			CRITICAL_SECTION_AUTOLOCK( g_hUserLock );
+			g_Channels[ pNetChannel ] = nUser;
+		}
+
+		/* The socket is the channel's from here on */
+		bConnected = pNetChannel->Connect( hSocket );
+	}
+	else if ( hSocket != INVALID_SOCKET )
+	{
+		closesocket( hSocket );
+	}
+
+	if ( !bConnected )
+	{
+		if ( pNetChannel )
+		{
+			{
+				CRITICAL_SECTION_AUTOLOCK( g_hUserLock );
+				g_Channels.erase( pNetChannel );
+			}
+
+			NET_DestroyChannel( pNetChannel );
+		}
+
+		CRITICAL_SECTION_AUTOLOCK( g_hUserLock );
+
+		g_Users[ nUser ].m_nState = LOADGEN_IDLE;
+		g_Users[ nUser ].m_bBusy = false;
+		++g_nRefused;
+
+		return;
+	}
+
+	{
+		CRITICAL_SECTION_AUTOLOCK( g_hUserLock );
+		g_Users[ nUser ].m_pNetChannel = pNetChannel;
+	}
+
+	CNETHandlerMessage* pClientHello = new CNETHandlerMessage( pNetChannel );
+	bf_write& stream = pClientHello->GetWrite();
+
+	stream.WriteByte( 0 );
+	stream.WriteString( szName );
+
+	pNetChannel->SendNetMessage( pClientHello );
+
+	CRITICAL_SECTION_AUTOLOCK( g_hUserLock );
+	g_Users[ nUser ].m_bBusy = false;
+}
+
+/* Disconnects and destroys the user's channel, from a worker */
+void LOADGEN_Leave( int nUser )
+{
+	INetChannel* pNetChannel;
+	{
+		CRITICAL_SECTION_AUTOLOCK( g_hUserLock );
+		pNetChannel = g_Users[ nUser ].m_pNetChannel;
+	}
+
+	if ( pNetChannel )
+	{
+		if ( pNetChannel->IsConnected() )
+			pNetChannel->Disconnect( "Leaving" );
+
+		{
+			CRITICAL_SECTION_AUTOLOCK( g_hUserLock );
+			g_Channels.erase( pNetChannel );
+		}
+
+		NET_DestroyChannel( pNetChannel );
+	}
+
+	CRITICAL_SECTION_AUTOLOCK( g_hUserLock );
+
+	g_Users[ nUser ].m_pNetChannel = NULL;
+	g_Users[ nUser ].m_nState = LOADGEN_IDLE;
+	g_Users[ nUser ].m_bBusy = false;
+}
+
+DWORD WINAPI LOADGEN_WorkerThread( LPVOID lp )
+{
+	while ( g_bActive )
+	{
+		int nUser = -1;
+		loadgen_state_t nState = LOADGEN_IDLE;
+		{
+			CRITICAL_SECTION_AUTOLOCK( g_hUserLock );
+
+			if ( !g_WorkQueue.empty() )
+			{
+				nUser = g_WorkQueue.front();
+				nState = g_Users[ nUser ].m_nState;
+				g_WorkQueue.pop_front();
+			}
+		}
+
+		if ( nUser == -1 )
+		{
+			Sleep( 1 );
+			continue;
+		}
+
+		if ( nState == LOADGEN_JOINING )
+			LOADGEN_Join( nUser );
+		else
+			LOADGEN_Leave( nUser );
+	}
+
+	return 0;
+}
+
+/* Users the server disconnected or that lost their connection, and joins that never got announced */
+void LOADGEN_CheckUsers( unsigned long long nNow )
+{
+	int c = g_Users.size();
+	for ( int i = 0; i < c; ++i )
+	{
+		loadgen_user_t& user = g_Users[ i ];
+
+		if ( user.m_bBusy || !user.m_pNetChannel )
+			continue;
+
+		if ( user.m_nState != LOADGEN_JOINING && user.m_nState != LOADGEN_ONLINE )
+			continue;
+
+		if ( user.m_pNetChannel->IsConnected() )
+		{
+			if ( user.m_nState == LOADGEN_JOINING && nNow - user.m_nJoinTime > LOADGEN_JOIN_TIMEOUT )
+			{
+				++g_nJoinTimeouts;
+				user.m_nState = LOADGEN_LEAVING;
+				LOADGEN_Queue( i );
+			}
+
+			continue;
+		}
+
+		if ( user.m_pNetChannel->GetFlags() & NET_DISCONNECT_BY_HOST )
+			++g_HostDisconnects[ user.m_pNetChannel->GetDisconnectReason() ];
+		else
+			++g_nLost;
+
+		if ( user.m_nState == LOADGEN_ONLINE )
+			LOADGEN_SetOnline( i, false );
+
+		user.m_nState = LOADGEN_LEAVING;
+		user.m_nLeaveTime = nNow;
+		LOADGEN_Queue( i );
+	}
+}
+
+void LOADGEN_SendMessage( int nUser, unsigned long long nNow )
+{
+	static char szMessage[ IRC_MAX_MESSAGE + 1 ];
+
+	int nSize = LOADGEN_MessageSize();
+	int nHeader = snprintf( szMessage, sizeof( szMessage ), "#%016llx ", nNow );
+
+	memset( szMessage + nHeader, 'x', nSize - nHeader );
+	szMessage[ nSize ] = '\0';
+
+	INetChannel* pNetChannel = g_Users[ nUser ].m_pNetChannel;
+
+	CNETHandlerMessage* pNetMessage = new CNETHandlerMessage( pNetChannel );
+	bf_write& stream = pNetMessage->GetWrite();
+
+	stream.WriteByte( 1 );
+	stream.WriteString( szMessage );
+
+	pNetChannel->SendNetMessage( pNetMessage );
+
+	++g_nSent;
+	g_nExpected += g_Online.size() - 1;
+}
+
+void LOADGEN_Run()
+{
+	unsigned long long nStart = NET_GetTime();
+	unsigned long long nLastFrame = nStart;
+	unsigned long long nLastReport = nStart;
+	unsigned long long nEnd = nStart + ( unsigned long long ) g_nSeconds * 1000000;
+
+	double flJoinsDue = 0.0;
+	double flLeavesDue = 0.0;
+	double flSendsDue = 0.0;
+	int nNextJoin = 0;
+
+	long long nLastSent = 0;
+	long long nLastDelivered = 0;
+	long nLastJoins = 0;
+	long nLastLeaves = 0;
+
+	printf( "seconds,online,joins,leaves,sent,delivered,p50_us,p99_us,p999_us\n" );
+
+	for ( ;; Sleep( LOADGEN_FRAME ) )
+	{
+		CRITICAL_SECTION_AUTOLOCK( g_hUserLock );
+
+		unsigned long long nNow = NET_GetTime();
+		double flFrame = ( nNow - nLastFrame ) / 1000000.0;
+		nLastFrame = nNow;
+
+		bool bSending = ( nNow < nEnd );
+
+		if ( !bSending && nNow >= nEnd + LOADGEN_DRAIN )
+			break;
+
+		LOADGEN_CheckUsers( nNow );
+
+		int c = g_Users.size();
+
+		/* Joins, paced across the users waiting for one */
+		flJoinsDue += g_flJoinRate * flFrame;
+
+		for ( int i = 0; i < c && flJoinsDue >= 1.0 && bSending; ++i )
+		{
+			int nUser = nNextJoin;
+			loadgen_user_t& user = g_Users[ nUser ];
+
+			nNextJoin = ( nNextJoin + 1 ) % c;
+
+			if ( user.m_nState != LOADGEN_IDLE || user.m_bBusy )
+				continue;
+
+			user.m_nState = LOADGEN_JOINING;
+			user.m_nJoinTime = nNow;
+			LOADGEN_Queue( nUser );
+
+			flJoinsDue -= 1.0;
+		}
+
+		/* No burst once users are idle again after running out of them */
+		flJoinsDue = min( flJoinsDue, 1.0 );
+
+		/* Churn, leaving users rejoin through the joins above */
+		flLeavesDue += g_flChurn * g_Online.size() * flFrame;
+
+		while ( flLeavesDue >= 1.0 && !g_Online.empty() && bSending )
+		{
+			int nUser = g_Online[ LOADGEN_Random( g_Online.size() ) ];
+			loadgen_user_t& user = g_Users[ nUser ];
+
+			LOADGEN_SetOnline( nUser, false );
+			user.m_nState = LOADGEN_LEAVING;
+			user.m_nLeaveTime = nNow;
+
+			++g_nLeaves;
+			flLeavesDue -= 1.0;
+		}
+
+		for ( int i = 0; i < c; ++i )
+		{
+			loadgen_user_t& user = g_Users[ i ];
+
+			if ( user.m_nState == LOADGEN_LEAVING && !user.m_bBusy && nNow - user.m_nLeaveTime >= LOADGEN_LINGER )
+				LOADGEN_Queue( i );
+		}
+
+		/* Open loop, at the rate of the users online */
+		flSendsDue += g_flMessageRate * g_Online.size() * flFrame;
+
+		while ( flSendsDue >= 1.0 && !g_Online.empty() && bSending )
+		{
+			LOADGEN_SendMessage( g_Online[ LOADGEN_Random( g_Online.size() ) ], nNow );
+			flSendsDue -= 1.0;
+		}
+
+		if ( nNow - nLastReport >= 1000000 )
+		{
+			printf( "%.1f,%u,%ld,%ld,%lld,%lld,%llu,%llu,%llu\n", ( nNow - nStart ) / 1000000.0, ( unsigned int ) g_Online.size(),
+				g_nJoins - nLastJoins, g_nLeaves - nLastLeaves, g_nSent - nLastSent, g_nDelivered - nLastDelivered,
+				g_IntervalLatency.Percentile( 0.5 ), g_IntervalLatency.Percentile( 0.99 ), g_IntervalLatency.Percentile( 0.999 ) );
+			fflush( stdout );
+
+			g_IntervalLatency.Clear();
+
+			nLastJoins = g_nJoins;
+			nLastLeaves = g_nLeaves;
+			nLastSent = g_nSent;
+			nLastDelivered = g_nDelivered;
+			nLastReport = nNow;
+		}
+	}
+}
+
+void LOADGEN_Report()
+{
+	CRITICAL_SECTION_AUTOLOCK( g_hUserLock );
+
+	long long nDropped = max( g_nExpected - g_nDelivered, 0LL );
+
+	printf( "\nusers online %u of %d, joins %ld, leaves %ld\n", ( unsigned int ) g_Online.size(), g_nUsers, g_nJoins, g_nLeaves );
+	printf( "messages sent %lld, relays expected %lld, delivered %lld, dropped %lld (%.3f%%)\n", g_nSent, g_nExpected, g_nDelivered, nDropped,
+		g_nExpected ? 100.0 * nDropped / g_nExpected : 0.0 );
+	printf( "latency p50 %llu us, p99 %llu us, p999 %llu us\n", g_TotalLatency.Percentile( 0.5 ), g_TotalLatency.Percentile( 0.99 ), g_TotalLatency.Percentile( 0.999 ) );
+
+	if ( !g_JoinSamples.empty() )
+	{
+		std::sort( g_JoinSamples.begin(), g_JoinSamples.end() );
+		printf( "join p50 %llu us, p99 %llu us\n", g_JoinSamples[ g_JoinSamples.size() / 2 ], g_JoinSamples[ min( ( size_t ) ( 0.99 * g_JoinSamples.size() ), g_JoinSamples.size() - 1 ) ] );
+	}
+
+	long nHostDisconnects = 0;
+	for ( std::map< std::string, long >::iterator it = g_HostDisconnects.begin(); it != g_HostDisconnects.end(); ++it )
+		nHostDisconnects += it->second;
+
+	printf( "disconnected by server %ld\n", nHostDisconnects );
+
+	for ( std::map< std::string, long >::iterator it = g_HostDisconnects.begin(); it != g_HostDisconnects.end(); ++it )
+		printf( "\t%ld\t%s\n", it->second, it->first.c_str() );
+
+	printf( "connections lost %ld, refused %ld, joins timed out %ld\n", g_nLost, g_nRefused, g_nJoinTimeouts );
+	fflush( stdout );
+}
+
+/* Leaves with everyone, joins still running are left once done. False if the workers didn't get through it in time */
+bool LOADGEN_Shutdown()
+{
+	for ( int i = 0; i < 600; ++i, Sleep( 100 ) )
+	{
+		CRITICAL_SECTION_AUTOLOCK( g_hUserLock );
+
+		bool bDone = true;
+
+		int c = g_Users.size();
+		for ( int j = 0; j < c; ++j )
+		{
+			loadgen_user_t& user = g_Users[ j ];
+
+			if ( user.m_bBusy )
+			{
+				bDone = false;
+				continue;
+			}
+
+			if ( user.m_nState == LOADGEN_IDLE )
+				continue;
+
+			if ( user.m_nState == LOADGEN_ONLINE )
+				LOADGEN_SetOnline( j, false );
+
+			user.m_nState = LOADGEN_LEAVING;
+			LOADGEN_Queue( j );
+			bDone = false;
+		}
+
+		if ( bDone )
+			return true;
+	}
+
+	return false;
+}
+
+bool LOADGEN_ParseOptions( int argc, char* argv[] )
+{
+	if ( argc < 2 )
+		return false;
+
+	strncpy( g_szHost, argv[ 1 ], sizeof( g_szHost ) - 1 );
+
+	for ( int i = 2; i < argc; ++i )
+	{
+		const char* pszOption = argv[ i ];
+		bool bHasValue = ( i + 1 < argc );
+
+		if ( !strcmp( pszOption, "-port" ) && bHasValue )
+			g_nPort = atoi( argv[ ++i ] );
+		else if ( !strcmp( pszOption, "-users" ) && bHasValue )
+			g_nUsers = atoi( argv[ ++i ] );
+		else if ( !strcmp( pszOption, "-join" ) && bHasValue )
+			g_flJoinRate = atof( argv[ ++i ] );
+		else if ( !strcmp( pszOption, "-rate" ) && bHasValue )
+			g_flMessageRate = atof( argv[ ++i ] );
+		else if ( !strcmp( pszOption, "-size" ) && i + 2 < argc )
+		{
+			g_nMinSize = atoi( argv[ ++i ] );
+			g_nMaxSize = atoi( argv[ ++i ] );
+		}
+		else if ( !strcmp( pszOption, "-dist" ) && bHasValue )
+		{
+			const char* pszDist = argv[ ++i ];
+
+			if ( !strcmp( pszDist, "fixed" ) )
+				g_nDist = LOADGEN_DIST_FIXED;
+			else if ( !strcmp( pszDist, "uniform" ) )
+				g_nDist = LOADGEN_DIST_UNIFORM;
+			else if ( !strcmp( pszDist, "exp" ) )
+				g_nDist = LOADGEN_DIST_EXP;
+			else
+				return false;
+		}
+		else if ( !strcmp( pszOption, "-churn" ) && bHasValue )
+			g_flChurn = atof( argv[ ++i ] );
+		else if ( !strcmp( pszOption, "-time" ) && bHasValue )
+			g_nSeconds = atoi( argv[ ++i ] );
+		else if ( !strcmp( pszOption, "-perip" ) && bHasValue )
+			g_nUsersPerIP = atoi( argv[ ++i ] );
+		else if ( !strcmp( pszOption, "-tickrate" ) && bHasValue )
+			g_nTickRate = atoi( argv[ ++i ] );
+		else
+			return false;
+	}
+
+	g_nMinSize = max( min( g_nMinSize, IRC_MAX_MESSAGE ), LOADGEN_HEADER_SIZE );
+	g_nMaxSize = max( min( g_nMaxSize, IRC_MAX_MESSAGE ), g_nMinSize );
+
+	return g_nUsers > 0 && g_flJoinRate > 0.0 && g_nSeconds > 0;
+}
+
+int main( int argc, char* argv[] )
+{
+	if ( !LOADGEN_ParseOptions( argc, argv ) )
+	{
+		printf( "Usage: IRC_LoadGen <host> [-port n] [-users n] [-join f] [-rate f] [-size min max] [-dist fixed|uniform|exp] [-churn f] [-time n] [-perip n] [-tickrate n]\n" );
+		return 1;
+	}
+
+	if ( !NET_StartUp() )
+		return 1;
+
+	addrinfo hints;
+	addrinfo* pAddress = NULL;
+	ZeroMemory( &hints, sizeof( hints ) );
+	hints.ai_family			= AF_INET;
+	hints.ai_socktype		= SOCK_STREAM;
+	hints.ai_protocol		= IPPROTO_TCP;
+
+	char szPort[ 32 ];
+	sprintf( szPort, "%i", g_nPort );
+
+	if ( getaddrinfo( g_szHost, szPort, &hints, &pAddress ) || !pAddress )
+	{
+		printf( "Unable to resolve '%s'\n", g_szHost );
+		NET_Shutdown();
+		return 1;
+	}
+
+	memcpy( &g_HostAddress, pAddress->ai_addr, sizeof( g_HostAddress ) );
+	freeaddrinfo( pAddress );
+
+	g_bLoopback = ( ( ntohl( g_HostAddress.sin_addr.s_addr ) >> 24 ) == 127 );
+
+	srand( ( unsigned int ) NET_GetTime() );
+	InitializeCriticalSection( &g_hUserLock );
+
+	loadgen_user_t user;
+	memset( &user, 0, sizeof( user ) );
+	user.m_nOnlineSlot = -1;
+
+	g_Users.assign( g_nUsers, user );
+	g_Online.reserve( g_nUsers );
+
+	g_bActive = true;
+
+	HANDLE hWorkers[ LOADGEN_WORKERS ];
+	for ( int i = 0; i < LOADGEN_WORKERS; ++i )
+		hWorkers[ i ] = CreateThread( NULL, NULL, &LOADGEN_WorkerThread, NULL, NULL, NULL );
+
+	LOADGEN_Run();
+	LOADGEN_Report();
+
+	if ( !LOADGEN_Shutdown() )
+		printf( "Some users didn't disconnect in time\n" );
+
+	g_bActive = false;
+
+	for ( int i = 0; i < LOADGEN_WORKERS; ++i )
+	{
+		if ( WaitForSingleObject( hWorkers[ i ], 5000 ) == WAIT_TIMEOUT )
+			TerminateThread( hWorkers[ i ], 0 );
+	}
+
+	DeleteCriticalSection( &g_hUserLock );
+	NET_Shutdown();
+
+	return 0;
+}
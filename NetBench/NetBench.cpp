@@ -0,0 +1,746 @@
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include "windows.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "vector"
+#include "algorithm"
+#include "new"
+
+#include "../NetChannel/Inc/Channel.h"
+#include "../NetChannel/Inc/Scheduler.h"
+#include "../NetChannel/Inc/Metrics.h"
+
+/*
+	Loopback benchmarks, a server and its clients in one process. Results
+	are printed as CSV, one row per scenario and parameter:
+
+		scenario, param, count, seconds, ops_per_sec, mb_per_sec, p50_us, p99_us, p999_us, status
+
+	status is ok, timeout when replies stopped coming and the row covers
+	only part of the run, failed when connecting failed part way, or
+	allocated for an allocs run that allocated. Anything else goes to
+	stderr, stdout is the CSV alone.
+
+	echo		Handler messages at a fixed rate, param is the payload size,
+				latencies are round trips through the server
+	throughput	Handler messages sent at once and echoed back
+	transfer	SendNetData to the server, param is the transfer size,
+				latencies are from the call until the server has all of it
+	fanout		One client's message relayed to param clients, latencies are
+				from the send until each client has it
+	connect		Connect until the first echo is back
+	disconnect	Disconnect and NET_DestroyChannel
+	allocs		Echo round trips one at a time after a warm up, param is the
+				payload size. Steady state traffic must not allocate on either
+				end, any global operator new while they run fails the run
+	framing		Echo round trips one at a time with NET_FEATURE_COMPACT_FRAMING
+				and without, param is the payload size. mb_per_sec is what the
+				client put on the wire, the bytes per message of each pair go
+				to stderr
+
+	Global operator new is replaced below to count allocations, the paths
+	the library reports through NET_GetAllocationStats are printed to
+	stderr for a run that allocated. The exit code is 1 if one did.
+
+	Messages wait for the next tick on both ends, so latencies are in steps
+	of the tick interval, and a channel reads up to NET_PAYLOAD_SIZE bytes a
+	tick, which bounds throughput. Both sides run at the tickrate given on
+	the command line, NET_TICKRATE_MAX by default.
+*/
+
+#define BENCH_HOST					"127.0.0.1"
+#define BENCH_DEFAULT_PORT			27960
+#define BENCH_TIMEOUT				30000000ULL	/* Microseconds to wait for replies */
+
+#define BENCH_ECHO_MESSAGES			1000
+#define BENCH_ECHO_RATE				1000		/* Messages per second, at most... */
+#define BENCH_ECHO_BYTES_PER_SEC	( 256 * 1024 )	/* ...and no more payload than this */
+#define BENCH_THROUGHPUT_MESSAGES	10000		/* At most, larger payloads send fewer */
+#define BENCH_THROUGHPUT_BYTES		( 4 * 1024 * 1024 )
+#define BENCH_TRANSFER_BYTES		( 4 * 1024 * 1024 )	/* Per size, in as many transfers as fit */
+#define BENCH_FANOUT_ROUNDS			200
+#define BENCH_CONNECTIONS			100
+#define BENCH_ALLOC_WARMUP			100		/* Round trips before counting, fills queues and free lists */
+#define BENCH_ALLOC_ROUND_TRIPS		500
+#define BENCH_FRAMING_ROUND_TRIPS	500
+
+enum bench_command_t
+{
+	BENCH_ECHO,			/* Sent back to the sender */
+	BENCH_BROADCAST		/* Sent to every client */
+};
+
+/* Command byte and NET_GetTime when sent, then padding up to the payload size */
+#define BENCH_HEADER_SIZE			9
+
+/* The last is the most a handler message carries */
+static const long g_PayloadSizes[] = { 16, 64, 256, 1024, NET_PAYLOAD_SIZE - PACKET_MANIFEST_SIZE };
+static const long g_TransferSizes[] = { 64 * 1024, 256 * 1024, 1024 * 1024 };
+static const int g_FanoutClients[] = { 1, 8, 32, 64 };
+
+int g_nTickRate = NET_TICKRATE_MAX;
+int g_nPort = BENCH_DEFAULT_PORT;
+
+volatile LONG					g_nAllocations = 0;
+
+void* operator new( size_t nSize )
+{
+	InterlockedIncrement( &g_nAllocations );
+
+	void* p = malloc( nSize ? nSize : 1 );
+
+	if ( !p )
+		throw std::bad_alloc();
+
+	return p;
+}
+
+void* operator new[]( size_t nSize )					{ return operator new( nSize ); }
+void operator delete( void* p ) noexcept				{ free( p ); }
+void operator delete[]( void* p ) noexcept				{ free( p ); }
+void operator delete( void* p, size_t ) noexcept		{ free( p ); }
+void operator delete[]( void* p, size_t ) noexcept		{ free( p ); }
+
+/* Server side */
+CRITICAL_SECTION				g_hServerLock;
+std::vector< INetChannel* >		g_ServerChannels;
+volatile LONG					g_nTransfersReceived = 0;
+
+/* Client side, one scenario at a time */
+CRITICAL_SECTION				g_hSampleLock;
+std::vector< unsigned long long >	g_Samples;	/* Microseconds */
+volatile LONG					g_nReceived = 0;
+
+void BENCH_ServerHandler( INetChannel* pNetChannel, INetMessage* pNetMessage )
+{
+	if ( pNetMessage->GetType() == net_Transfer )
+	{
+		InterlockedIncrement( &g_nTransfersReceived );
+		return;
+	}
+
+	if ( pNetMessage->GetType() != net_HandlerMsg )
+		return;
+
+	CNETHandlerMessage* pMessage = ( CNETHandlerMessage* ) pNetMessage;
+	const char* pData = pMessage->IsView() ? pMessage->m_pView : pMessage->m_Data;
+
+	if ( pMessage->m_nLength < BENCH_HEADER_SIZE )
+		return;
+
+	CRITICAL_SECTION_AUTOLOCK( g_hServerLock );
+
+	int c = ( pData[ 0 ] == BENCH_BROADCAST ) ? g_ServerChannels.size() : 1;
+	for ( int i = 0; i < c; ++i )
+	{
+		INetChannel* pReceiver = ( pData[ 0 ] == BENCH_BROADCAST ) ? g_ServerChannels[ i ] : pNetChannel;
+
+		CNETHandlerMessage* pReply = new CNETHandlerMessage( pReceiver );
+		pReply->GetWrite().WriteBytes( pData, pMessage->m_nLength );
+
+		pReceiver->SendNetMessage( pReply );
+	}
+}
+
+bool BENCH_ServerNotify( INetChannel* pNetChannel, int nState )
+{
+	CRITICAL_SECTION_AUTOLOCK( g_hServerLock );
+
+	if ( nState == SV_CLIENTCONNECT )
+	{
+		pNetChannel->SetMessageHandler( &BENCH_ServerHandler );
+		g_ServerChannels.push_back( pNetChannel );
+		return true;
+	}
+
+	int c = g_ServerChannels.size();
+	for ( int i = c - 1; i >= 0; --i )
+	{
+		if ( g_ServerChannels[ i ] == pNetChannel )
+			g_ServerChannels.erase( g_ServerChannels.begin() + i );
+	}
+
+	return true;
+}
+
+DWORD WINAPI BENCH_ServerThread( LPVOID lp )
+{
+	char szPort[ 32 ];
+	sprintf( szPort, "%i", g_nPort );
+
+	if ( !NET_ProcessListenSocket( szPort, g_nTickRate, NULL, &BENCH_ServerNotify ) )
+		fprintf( stderr, "Unable to listen on port %s\n", szPort );
+
+	return 0;
+}
+
+void BENCH_ClientHandler( INetChannel* pNetChannel, INetMessage* pNetMessage )
+{
+	if ( pNetMessage->GetType() != net_HandlerMsg )
+		return;
+
+	unsigned long long nNow = NET_GetTime();
+
+	bf_read& stream = ( ( CNETHandlerMessage* ) pNetMessage )->GetRead();
+	stream.ReadByte();
+
+	unsigned long long nSendTime = stream.ReadDWord();
+	nSendTime |= ( unsigned long long ) stream.ReadDWord() << 32;
+
+	{
+		CRITICAL_SECTION_AUTOLOCK( g_hSampleLock );
+		g_Samples.push_back( nNow - nSendTime );
+	}
+
+	InterlockedIncrement( &g_nReceived );
+}
+
+void BENCH_Send( INetChannel* pNetChannel, bench_command_t nCommand, long nBytes )
+{
+	static char padding[ NET_PAYLOAD_SIZE ];
+
+	unsigned long long nTime = NET_GetTime();
+
+	CNETHandlerMessage* pMessage = new CNETHandlerMessage( pNetChannel );
+	bf_write& stream = pMessage->GetWrite();
+
+	stream.WriteByte( ( unsigned char ) nCommand );
+	stream.WriteDWord( ( unsigned long ) nTime );
+	stream.WriteDWord( ( unsigned long ) ( nTime >> 32 ) );
+	stream.WriteBytes( padding, max( nBytes - BENCH_HEADER_SIZE, 0L ) );
+
+	pNetChannel->SendNetMessage( pMessage );
+}
+
+/* Polls until *pCount reaches nTarget, false on timeout */
+bool BENCH_Wait( volatile LONG* pCount, LONG nTarget )
+{
+	unsigned long long nStart = NET_GetTime();
+
+	while ( *pCount < nTarget )
+	{
+		if ( NET_GetTime() - nStart > BENCH_TIMEOUT )
+			return false;
+
+		Sleep( 1 );
+	}
+
+	return true;
+}
+
+void BENCH_Reset()
+{
+	CRITICAL_SECTION_AUTOLOCK( g_hSampleLock );
+
+	g_Samples.clear();
+	g_nReceived = 0;
+}
+
+/* Connected once the first echo is back, the handshake is done by then. */
+/* The tickrate stays where it was set */
+INetChannel* BENCH_Connect( unsigned long nFeatures = NET_FEATURES_DEFAULT & ~NET_FEATURE_ADAPTIVE_TICKRATE )
+{
+	INetChannel* pNetChannel = NET_CreateChannel();
+
+	pNetChannel->SetFeatures( nFeatures );
+	pNetChannel->SetTickRate( g_nTickRate );
+	pNetChannel->SetMessageHandler( &BENCH_ClientHandler );
+
+	if ( !pNetChannel->Connect( BENCH_HOST, g_nPort ) )
+	{
+		NET_DestroyChannel( pNetChannel );
+		return NULL;
+	}
+
+	LONG nReceived = g_nReceived;
+	BENCH_Send( pNetChannel, BENCH_ECHO, BENCH_HEADER_SIZE );
+
+	if ( !BENCH_Wait( &g_nReceived, nReceived + 1 ) )
+	{
+		NET_DestroyChannel( pNetChannel );
+		return NULL;
+	}
+
+	return pNetChannel;
+}
+
+void BENCH_Disconnect( INetChannel* pNetChannel )
+{
+	pNetChannel->Disconnect( "Benchmark done" );
+	NET_DestroyChannel( pNetChannel );
+}
+
+/* pszStatus is "ok", or why the numbers don't cover the whole run */
+void BENCH_Report( const char* pszScenario, long nParam, std::vector< unsigned long long >& samples, double flSeconds, double flBytes, const char* pszStatus )
+{
+	unsigned long long nPercentiles[ 3 ] = { 0, 0, 0 };
+	static const double flQuantiles[ 3 ] = { 0.5, 0.99, 0.999 };
+
+	if ( !samples.empty() )
+	{
+		std::sort( samples.begin(), samples.end() );
+
+		for ( int i = 0; i < 3; ++i )
+			nPercentiles[ i ] = samples[ min( ( size_t ) ( flQuantiles[ i ] * samples.size() ), samples.size() - 1 ) ];
+	}
+
+	double flOpsPerSec = ( flSeconds > 0.0 ) ? samples.size() / flSeconds : 0.0;
+	double flMBPerSec = ( flSeconds > 0.0 ) ? flBytes / flSeconds / ( 1024.0 * 1024.0 ) : 0.0;
+
+	printf( "%s,%ld,%u,%.3f,%.1f,%.2f,%llu,%llu,%llu,%s\n", pszScenario, nParam, ( unsigned int ) samples.size(), flSeconds, flOpsPerSec, flMBPerSec, nPercentiles[ 0 ], nPercentiles[ 1 ], nPercentiles[ 2 ], pszStatus );
+	fflush( stdout );
+}
+
+void BENCH_ReportReceived( const char* pszScenario, long nParam, double flSeconds, double flBytes, const char* pszStatus )
+{
+	std::vector< unsigned long long > samples;
+	{
+		CRITICAL_SECTION_AUTOLOCK( g_hSampleLock );
+		samples.swap( g_Samples );
+	}
+
+	BENCH_Report( pszScenario, nParam, samples, flSeconds, flBytes, pszStatus );
+}
+
+void BENCH_Echo()
+{
+	for ( int i = 0; i < sizeof( g_PayloadSizes ) / sizeof( g_PayloadSizes[ 0 ] ); ++i )
+	{
+		long nBytes = g_PayloadSizes[ i ];
+		long nRate = min( BENCH_ECHO_RATE, BENCH_ECHO_BYTES_PER_SEC / nBytes );
+
+		INetChannel* pNetChannel = BENCH_Connect();
+
+		if ( !pNetChannel )
+		{
+			fprintf( stderr, "echo,%ld: unable to connect\n", nBytes );
+			continue;
+		}
+
+		BENCH_Reset();
+
+		/* Open loop, a slow reply doesn't hold back the messages after it */
+		unsigned long long nStart = NET_GetTime();
+		long nSent = 0;
+
+		while ( nSent < BENCH_ECHO_MESSAGES )
+		{
+			long nDue = ( long ) min( ( NET_GetTime() - nStart ) * nRate / 1000000 + 1, ( unsigned long long ) BENCH_ECHO_MESSAGES );
+
+			for ( ; nSent < nDue; ++nSent )
+				BENCH_Send( pNetChannel, BENCH_ECHO, nBytes );
+
+			Sleep( 1 );
+		}
+
+		bool bTimedOut = !BENCH_Wait( &g_nReceived, BENCH_ECHO_MESSAGES );
+
+		if ( bTimedOut )
+			fprintf( stderr, "echo,%ld: timed out\n", nBytes );
+
+		double flSeconds = ( NET_GetTime() - nStart ) / 1000000.0;
+		BENCH_ReportReceived( "echo", nBytes, flSeconds, ( double ) g_nReceived * nBytes, bTimedOut ? "timeout" : "ok" );
+
+		BENCH_Disconnect( pNetChannel );
+	}
+}
+
+void BENCH_Throughput()
+{
+	for ( int i = 0; i < sizeof( g_PayloadSizes ) / sizeof( g_PayloadSizes[ 0 ] ); ++i )
+	{
+		long nBytes = g_PayloadSizes[ i ];
+		long nMessages = min( BENCH_THROUGHPUT_MESSAGES, BENCH_THROUGHPUT_BYTES / nBytes );
+
+		INetChannel* pNetChannel = BENCH_Connect();
+
+		if ( !pNetChannel )
+		{
+			fprintf( stderr, "throughput,%ld: unable to connect\n", nBytes );
+			continue;
+		}
+
+		BENCH_Reset();
+
+		unsigned long long nStart = NET_GetTime();
+
+		for ( long j = 0; j < nMessages; ++j )
+			BENCH_Send( pNetChannel, BENCH_ECHO, nBytes );
+
+		bool bTimedOut = !BENCH_Wait( &g_nReceived, nMessages );
+
+		if ( bTimedOut )
+			fprintf( stderr, "throughput,%ld: timed out\n", nBytes );
+
+		double flSeconds = ( NET_GetTime() - nStart ) / 1000000.0;
+		BENCH_ReportReceived( "throughput", nBytes, flSeconds, ( double ) g_nReceived * nBytes, bTimedOut ? "timeout" : "ok" );
+
+		BENCH_Disconnect( pNetChannel );
+	}
+}
+
+void BENCH_Transfer()
+{
+	for ( int i = 0; i < sizeof( g_TransferSizes ) / sizeof( g_TransferSizes[ 0 ] ); ++i )
+	{
+		long nBytes = g_TransferSizes[ i ];
+
+		INetChannel* pNetChannel = BENCH_Connect();
+
+		if ( !pNetChannel )
+		{
+			fprintf( stderr, "transfer,%ld: unable to connect\n", nBytes );
+			continue;
+		}
+
+		char* pData = new char[ nBytes ];
+		for ( long j = 0; j < nBytes; ++j )
+			pData[ j ] = ( char ) rand();
+
+		std::vector< unsigned long long > samples;
+		bool bTimedOut = false;
+		unsigned long long nStart = NET_GetTime();
+
+		/* One at a time, each is timed on its own */
+		for ( long j = 0; j < BENCH_TRANSFER_BYTES / nBytes; ++j )
+		{
+			LONG nReceived = g_nTransfersReceived;
+			unsigned long long nSendTime = NET_GetTime();
+
+			pNetChannel->SendNetData( pData, nBytes, NULL );
+
+			if ( !BENCH_Wait( &g_nTransfersReceived, nReceived + 1 ) )
+			{
+				fprintf( stderr, "transfer,%ld: timed out\n", nBytes );
+				bTimedOut = true;
+				break;
+			}
+
+			samples.push_back( NET_GetTime() - nSendTime );
+		}
+
+		double flSeconds = ( NET_GetTime() - nStart ) / 1000000.0;
+		BENCH_Report( "transfer", nBytes, samples, flSeconds, ( double ) samples.size() * nBytes, bTimedOut ? "timeout" : "ok" );
+
+		delete[] pData;
+		BENCH_Disconnect( pNetChannel );
+	}
+}
+
+void BENCH_Fanout()
+{
+	for ( int i = 0; i < sizeof( g_FanoutClients ) / sizeof( g_FanoutClients[ 0 ] ); ++i )
+	{
+		int nClients = g_FanoutClients[ i ];
+		std::vector< INetChannel* > clients;
+
+		for ( int j = 0; j < nClients; ++j )
+		{
+			INetChannel* pNetChannel = BENCH_Connect();
+
+			if ( !pNetChannel )
+			{
+				fprintf( stderr, "fanout,%d: unable to connect client %d\n", nClients, j );
+				break;
+			}
+
+			clients.push_back( pNetChannel );
+		}
+
+		if ( ( int ) clients.size() == nClients )
+		{
+			BENCH_Reset();
+
+			bool bTimedOut = false;
+			unsigned long long nStart = NET_GetTime();
+
+			/* A round is done when every client has the message */
+			for ( int j = 0; j < BENCH_FANOUT_ROUNDS; ++j )
+			{
+				BENCH_Send( clients[ 0 ], BENCH_BROADCAST, 64 );
+
+				if ( !BENCH_Wait( &g_nReceived, ( j + 1 ) * nClients ) )
+				{
+					fprintf( stderr, "fanout,%d: timed out\n", nClients );
+					bTimedOut = true;
+					break;
+				}
+			}
+
+			double flSeconds = ( NET_GetTime() - nStart ) / 1000000.0;
+			BENCH_ReportReceived( "fanout", nClients, flSeconds, ( double ) g_nReceived * 64, bTimedOut ? "timeout" : "ok" );
+		}
+
+		int c = clients.size();
+		for ( int j = 0; j < c; ++j )
+			BENCH_Disconnect( clients[ j ] );
+	}
+}
+
+void BENCH_Connections()
+{
+	std::vector< unsigned long long > connects;
+	std::vector< unsigned long long > disconnects;
+	double flConnectTime = 0.0, flDisconnectTime = 0.0;
+	const char* pszStatus = "ok";
+
+	for ( int i = 0; i < BENCH_CONNECTIONS; ++i )
+	{
+		unsigned long long nStart = NET_GetTime();
+
+		INetChannel* pNetChannel = BENCH_Connect();
+
+		if ( !pNetChannel )
+		{
+			fprintf( stderr, "connect: failed after %d connections\n", i );
+			pszStatus = "failed";
+			break;
+		}
+
+		unsigned long long nConnected = NET_GetTime();
+
+		BENCH_Disconnect( pNetChannel );
+
+		unsigned long long nEnd = NET_GetTime();
+
+		connects.push_back( nConnected - nStart );
+		disconnects.push_back( nEnd - nConnected );
+
+		flConnectTime += ( nConnected - nStart ) / 1000000.0;
+		flDisconnectTime += ( nEnd - nConnected ) / 1000000.0;
+	}
+
+	BENCH_Report( "connect", BENCH_CONNECTIONS, connects, flConnectTime, 0.0, pszStatus );
+	BENCH_Report( "disconnect", BENCH_CONNECTIONS, disconnects, flDisconnectTime, 0.0, pszStatus );
+}
+
+static const char* g_szAllocPaths[ NET_ALLOC_PATH_COUNT ] =
+{
+	"channel",
+	"send",
+	"recv",
+	"message",
+	"pool",
+	"transfer",
+	"global"
+};
+
+/* False if a steady state round trip allocated */
+bool BENCH_Allocations()
+{
+	bool bOK = true;
+
+	for ( int i = 0; i < sizeof( g_PayloadSizes ) / sizeof( g_PayloadSizes[ 0 ] ); ++i )
+	{
+		long nBytes = g_PayloadSizes[ i ];
+
+		INetChannel* pNetChannel = BENCH_Connect();
+
+		if ( !pNetChannel )
+		{
+			fprintf( stderr, "allocs,%ld: unable to connect\n", nBytes );
+			bOK = false;
+			continue;
+		}
+
+		BENCH_Reset();
+
+		/* The samples of both passes fit without growing */
+		{
+			CRITICAL_SECTION_AUTOLOCK( g_hSampleLock );
+			g_Samples.reserve( BENCH_ALLOC_WARMUP + BENCH_ALLOC_ROUND_TRIPS );
+		}
+
+		bool bTimedOut = false;
+		LONG nAllocations = 0;
+		net_alloc_stats_t before, after;
+		unsigned long long nStart = 0;
+
+		for ( int j = 0; j < BENCH_ALLOC_WARMUP + BENCH_ALLOC_ROUND_TRIPS && !bTimedOut; ++j )
+		{
+			if ( j == BENCH_ALLOC_WARMUP )
+			{
+				{
+					CRITICAL_SECTION_AUTOLOCK( g_hSampleLock );
+					g_Samples.clear();
+				}
+
+				NET_GetAllocationStats( &before );
+				nAllocations = g_nAllocations;
+				nStart = NET_GetTime();
+			}
+
+			BENCH_Send( pNetChannel, BENCH_ECHO, nBytes );
+			bTimedOut = !BENCH_Wait( &g_nReceived, j + 1 );
+		}
+
+		nAllocations = g_nAllocations - nAllocations;
+		NET_GetAllocationStats( &after );
+
+		double flSeconds = ( NET_GetTime() - nStart ) / 1000000.0;
+		const char* pszStatus = "ok";
+
+		if ( bTimedOut )
+		{
+			fprintf( stderr, "allocs,%ld: timed out\n", nBytes );
+			pszStatus = "timeout";
+			bOK = false;
+		}
+		else if ( nAllocations > 0 )
+		{
+			fprintf( stderr, "allocs,%ld: %ld allocations in %d round trips", nBytes, nAllocations, BENCH_ALLOC_ROUND_TRIPS );
+
+			for ( int j = 0; j < NET_ALLOC_PATH_COUNT; ++j )
+			{
+				if ( after.m_nAllocations[ j ] != before.m_nAllocations[ j ] )
+					fprintf( stderr, ", %s %llu", g_szAllocPaths[ j ], after.m_nAllocations[ j ] - before.m_nAllocations[ j ] );
+			}
+
+			fprintf( stderr, "\n" );
+			pszStatus = "allocated";
+			bOK = false;
+		}
+
+		BENCH_ReportReceived( "allocs", nBytes, flSeconds, ( double ) BENCH_ALLOC_ROUND_TRIPS * nBytes, pszStatus );
+
+		BENCH_Disconnect( pNetChannel );
+	}
+
+	return bOK;
+}
+
+/* What the client sends per message with compact framing and without */
+void BENCH_Framing()
+{
+	static const char* szNames[ 2 ] = { "framing_compact", "framing_fixed" };
+
+	for ( int i = 0; i < sizeof( g_PayloadSizes ) / sizeof( g_PayloadSizes[ 0 ] ); ++i )
+	{
+		long nBytes = g_PayloadSizes[ i ];
+		double flBytesPerMessage[ 2 ] = { 0.0, 0.0 };
+
+		for ( int j = 0; j < 2; ++j )
+		{
+			unsigned long nFeatures = NET_FEATURES_DEFAULT & ~NET_FEATURE_ADAPTIVE_TICKRATE;
+
+			if ( j )
+				nFeatures &= ~NET_FEATURE_COMPACT_FRAMING;
+
+			INetChannel* pNetChannel = BENCH_Connect( nFeatures );
+
+			if ( !pNetChannel )
+			{
+				fprintf( stderr, "%s,%ld: unable to connect\n", szNames[ j ], nBytes );
+				continue;
+			}
+
+			BENCH_Reset();
+
+			net_metrics_t before, after;
+			pNetChannel->GetMetrics( &before );
+
+			/* One at a time, so each message goes out in a frame of its own */
+			bool bTimedOut = false;
+			unsigned long long nStart = NET_GetTime();
+
+			for ( int k = 0; k < BENCH_FRAMING_ROUND_TRIPS && !bTimedOut; ++k )
+			{
+				BENCH_Send( pNetChannel, BENCH_ECHO, nBytes );
+				bTimedOut = !BENCH_Wait( &g_nReceived, k + 1 );
+			}
+
+			double flSeconds = ( NET_GetTime() - nStart ) / 1000000.0;
+			pNetChannel->GetMetrics( &after );
+
+			/* Pings sent meanwhile are in there too */
+			double flBytesOut = ( double ) ( after.m_nCounters[ NET_COUNTER_BYTES_OUT ] - before.m_nCounters[ NET_COUNTER_BYTES_OUT ] );
+
+			if ( bTimedOut )
+				fprintf( stderr, "%s,%ld: timed out\n", szNames[ j ], nBytes );
+			else
+				flBytesPerMessage[ j ] = flBytesOut / BENCH_FRAMING_ROUND_TRIPS;
+
+			BENCH_ReportReceived( szNames[ j ], nBytes, flSeconds, flBytesOut, bTimedOut ? "timeout" : "ok" );
+
+			BENCH_Disconnect( pNetChannel );
+		}
+
+		if ( flBytesPerMessage[ 0 ] > 0.0 && flBytesPerMessage[ 1 ] > 0.0 )
+			fprintf( stderr, "framing,%ld: %.1f bytes out per message compact, %.1f fixed, %.1f saved\n", nBytes, flBytesPerMessage[ 0 ], flBytesPerMessage[ 1 ], flBytesPerMessage[ 1 ] - flBytesPerMessage[ 0 ] );
+	}
+}
+
+/* NetBench [tickrate] [port] [scenario] */
+int main( int argc, char** argv )
+{
+	if ( argc > 1 )
+		g_nTickRate = max( min( atoi( argv[ 1 ] ), NET_TICKRATE_MAX ), NET_TICKRATE_MIN );
+
+	if ( argc > 2 )
+		g_nPort = atoi( argv[ 2 ] );
+
+	/* Every scenario unless one is named */
+	const char* pszScenario = ( argc > 3 ) ? argv[ 3 ] : NULL;
+
+	if ( !NET_StartUp() )
+		return 1;
+
+	InitializeCriticalSection( &g_hServerLock );
+	InitializeCriticalSection( &g_hSampleLock );
+
+	/* Blocks in accept for the life of the process */
+	DWORD dwServerThreadId;
+	HANDLE hServerThread = CreateThread( NULL, NULL, &BENCH_ServerThread, NULL, NULL, &dwServerThreadId );
+
+	if ( !hServerThread )
+		return 1;
+
+	/* Wait for the server to come up */
+	INetChannel* pNetChannel = NULL;
+
+	for ( int i = 0; i < 50 && !pNetChannel; ++i )
+	{
+		Sleep( 100 );
+		pNetChannel = BENCH_Connect();
+	}
+
+	if ( !pNetChannel )
+	{
+		fprintf( stderr, "Unable to connect to the benchmark server\n" );
+		return 1;
+	}
+
+	BENCH_Disconnect( pNetChannel );
+
+	printf( "scenario,param,count,seconds,ops_per_sec,mb_per_sec,p50_us,p99_us,p999_us,status\n" );
+
+	/* Each run gets a channel of its own, a backlog left by one doesn't slow the next */
+	if ( !pszScenario || !strcmp( pszScenario, "echo" ) )
+		BENCH_Echo();
+
+	if ( !pszScenario || !strcmp( pszScenario, "throughput" ) )
+		BENCH_Throughput();
+
+	if ( !pszScenario || !strcmp( pszScenario, "transfer" ) )
+		BENCH_Transfer();
+
+	if ( !pszScenario || !strcmp( pszScenario, "fanout" ) )
+		BENCH_Fanout();
+
+	if ( !pszScenario || !strcmp( pszScenario, "connect" ) )
+		BENCH_Connections();
+
+	if ( !pszScenario || !strcmp( pszScenario, "framing" ) )
+		BENCH_Framing();
+
+	bool bAllocationsOK = true;
+
+	if ( !pszScenario || !strcmp( pszScenario, "allocs" ) )
+		bAllocationsOK = BENCH_Allocations();
+
+	/* The server thread goes down with the process */
+	return bAllocationsOK ? 0 : 1;
+}
@@ -0,0 +1,225 @@
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include "windows.h"
+#include "atomic"
+
+#include "Inc/Alloc.h"
+
+#define MESSAGE_POOL_MIN_SHIFT		6		/* 64 bytes */
+#define MESSAGE_POOL_STEPS			4		/* Classes per doubling, at most a quarter of a block unused */
+#define MESSAGE_POOL_CLASSES		29		/* Up to 8 kilobytes, larger messages go to the allocator */
+#define MESSAGE_POOL_CLASS_BYTES	524288	/* Free blocks kept per class, the rest go back to the allocator */
+#define MESSAGE_POOL_SPIN_COUNT		4000
+
+class CNetHeapAllocator : public INetAllocator
+{
+public:
+	void* Alloc( size_t nBytes, int nSizeClass, net_alloc_path_t nPath, INetChannel* pNetChannel )
+	{
+		return new char[ nBytes ];
+	}
+
+	void Free( void* pBlock, size_t nBytes, int nSizeClass, net_alloc_path_t nPath, INetChannel* pNetChannel )
+	{
+		delete[] ( char* ) pBlock;
+	}
+};
+
+/* 64, 80, 96, 112, 128, 160 .. 8192 bytes. Handler messages, a little over 4 kilobytes, */
+/* take 5 kilobyte blocks rather than 8. -1 past the last class */
+static int NET_GetMessageClass( size_t nBytes )
+{
+	if ( nBytes <= ( ( size_t ) 1 << MESSAGE_POOL_MIN_SHIFT ) )
+		return 0;
+
+	/* nBytes is in ( 1 << nShift, 2 << nShift ] */
+	int nShift = MESSAGE_POOL_MIN_SHIFT;
+	while ( ( ( size_t ) 2 << nShift ) < nBytes )
+		++nShift;
+
+	size_t nStep = ( size_t ) 1 << ( nShift - 2 );
+	int nClass = ( nShift - MESSAGE_POOL_MIN_SHIFT ) * MESSAGE_POOL_STEPS + ( int ) ( ( nBytes - ( ( size_t ) 1 << nShift ) + nStep - 1 ) / nStep );
+
+	return ( nClass < MESSAGE_POOL_CLASSES ) ? nClass : -1;
+}
+
+static size_t NET_GetMessageClassBytes( int nClass )
+{
+	if ( !nClass )
+		return ( size_t ) 1 << MESSAGE_POOL_MIN_SHIFT;
+
+	int nShift = MESSAGE_POOL_MIN_SHIFT + ( nClass - 1 ) / MESSAGE_POOL_STEPS;
+	return ( ( size_t ) 1 << nShift ) + ( ( nClass - 1 ) % MESSAGE_POOL_STEPS + 1 ) * ( ( size_t ) 1 << ( nShift - 2 ) );
+}
+
+struct net_free_message_t
+{
+	net_free_message_t*		m_pNext;
+};
+
+/* A lock per size class, handler messages and the small control ones don't contend */
+struct net_message_bucket_t
+{
+	CRITICAL_SECTION		m_hLock;
+	net_free_message_t*		m_pFree;
+	unsigned long			m_nFree;
+	unsigned long			m_nMaxFree;
+};
+
+struct net_alloc_registry_t
+{
+	net_alloc_registry_t()
+	{
+		for ( int i = 0; i < MESSAGE_POOL_CLASSES; ++i )
+		{
+			InitializeCriticalSectionAndSpinCount( &m_Buckets[ i ].m_hLock, MESSAGE_POOL_SPIN_COUNT );
+			m_Buckets[ i ].m_pFree = NULL;
+			m_Buckets[ i ].m_nFree = 0;
+			m_Buckets[ i ].m_nMaxFree = ( unsigned long ) ( MESSAGE_POOL_CLASS_BYTES / NET_GetMessageClassBytes( i ) );
+		}
+
+		for ( int i = 0; i < NET_ALLOC_PATH_COUNT; ++i )
+		{
+			m_nAllocations[ i ].store( 0, std::memory_order_relaxed );
+			m_nBytes[ i ].store( 0, std::memory_order_relaxed );
+		}
+
+		m_nPooledMessages.store( 0, std::memory_order_relaxed );
+		m_bInUse.store( false, std::memory_order_relaxed );
+
+		m_pAllocator = &m_HeapAllocator;
+	}
+
+	/* Never torn down, threads still running at exit may delete messages */
+	net_message_bucket_t					m_Buckets[ MESSAGE_POOL_CLASSES ];
+
+	std::atomic< unsigned long long >		m_nAllocations[ NET_ALLOC_PATH_COUNT ];
+	std::atomic< unsigned long long >		m_nBytes[ NET_ALLOC_PATH_COUNT ];
+	std::atomic< unsigned long long >		m_nPooledMessages;
+
+	CNetHeapAllocator						m_HeapAllocator;
+	INetAllocator*							m_pAllocator;
+	std::atomic< bool >						m_bInUse;		/* Something was allocated through m_pAllocator */
+};
+
+static net_alloc_registry_t& NET_GetAllocRegistry()
+{
+	static net_alloc_registry_t registry;
+	return registry;
+}
+
+bool NET_SetAllocator( INetAllocator* pAllocator )
+{
+	net_alloc_registry_t& registry = NET_GetAllocRegistry();
+
+	if ( !pAllocator || pAllocator == registry.m_pAllocator )
+		return true;
+
+	/* Blocks are freed to the allocator they came from */
+	if ( registry.m_bInUse.load( std::memory_order_acquire ) )
+		return false;
+
+	registry.m_pAllocator = pAllocator;
+	return true;
+}
+
+void* NET_Alloc( size_t nBytes, net_alloc_path_t nPath, INetChannel* pNetChannel )
+{
+	net_alloc_registry_t& registry = NET_GetAllocRegistry();
+
+	registry.m_nAllocations[ nPath ].fetch_add( 1, std::memory_order_relaxed );
+	registry.m_nBytes[ nPath ].fetch_add( nBytes, std::memory_order_relaxed );
+
+	if ( !registry.m_bInUse.load( std::memory_order_relaxed ) )
+		registry.m_bInUse.store( true, std::memory_order_release );
+
+	return registry.m_pAllocator->Alloc( nBytes, NET_GetSizeClass( nBytes ), nPath, pNetChannel );
+}
+
+void NET_Free( void* pBlock, size_t nBytes, net_alloc_path_t nPath, INetChannel* pNetChannel )
+{
+	if ( !pBlock )
+		return;
+
+	NET_GetAllocRegistry().m_pAllocator->Free( pBlock, nBytes, NET_GetSizeClass( nBytes ), nPath, pNetChannel );
+}
+
+void NET_GetAllocationStats( net_alloc_stats_t* pStats )
+{
+	net_alloc_registry_t& registry = NET_GetAllocRegistry();
+
+	for ( int i = 0; i < NET_ALLOC_PATH_COUNT; ++i )
+	{
+		pStats->m_nAllocations[ i ] = registry.m_nAllocations[ i ].load( std::memory_order_relaxed );
+		pStats->m_nBytes[ i ] = registry.m_nBytes[ i ].load( std::memory_order_relaxed );
+	}
+
+	pStats->m_nPooledMessages = registry.m_nPooledMessages.load( std::memory_order_relaxed );
+}
+
+void* NET_AllocMessage( size_t nBytes )
+{
+	net_alloc_registry_t& registry = NET_GetAllocRegistry();
+	int nSizeClass = NET_GetMessageClass( nBytes );
+
+	if ( nSizeClass < 0 )
+		return NET_Alloc( nBytes, NET_ALLOC_MESSAGE );
+
+	net_message_bucket_t& bucket = registry.m_Buckets[ nSizeClass ];
+
+	EnterCriticalSection( &bucket.m_hLock );
+
+	net_free_message_t* pBlock = bucket.m_pFree;
+	if ( pBlock )
+	{
+		bucket.m_pFree = pBlock->m_pNext;
+		--bucket.m_nFree;
+	}
+
+	LeaveCriticalSection( &bucket.m_hLock );
+
+	if ( pBlock )
+	{
+		registry.m_nPooledMessages.fetch_add( 1, std::memory_order_relaxed );
+		return pBlock;
+	}
+
+	/* Whole classes, so the block fits any message of the class when it's reused */
+	return NET_Alloc( NET_GetMessageClassBytes( nSizeClass ), NET_ALLOC_MESSAGE );
+}
+
+void NET_FreeMessage( void* pBlock, size_t nBytes )
+{
+	if ( !pBlock )
+		return;
+
+	int nSizeClass = NET_GetMessageClass( nBytes );
+
+	if ( nSizeClass < 0 )
+	{
+		NET_Free( pBlock, nBytes, NET_ALLOC_MESSAGE );
+		return;
+	}
+
+	net_message_bucket_t& bucket = NET_GetAllocRegistry().m_Buckets[ nSizeClass ];
+	net_free_message_t* pFree = ( net_free_message_t* ) pBlock;
+
+	EnterCriticalSection( &bucket.m_hLock );
+
+	/* A burst doesn't pin its peak for good */
+	bool bKeep = ( bucket.m_nFree < bucket.m_nMaxFree );
+
+	if ( bKeep )
+	{
+		pFree->m_pNext = bucket.m_pFree;
+		bucket.m_pFree = pFree;
+		++bucket.m_nFree;
+	}
+
+	LeaveCriticalSection( &bucket.m_hLock );
+
+	if ( !bKeep )
+		NET_Free( pBlock, NET_GetMessageClassBytes( nSizeClass ), NET_ALLOC_MESSAGE );
+}
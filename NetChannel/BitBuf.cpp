@@ -0,0 +1,134 @@
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include "windows.h"
+#include "Inc/BitBuf.h"
+#include "Inc/Alloc.h"
+
+CBitBufPool::CBitBufPool()
+{
+	memset( m_pFree, 0, sizeof( m_pFree ) );
+
+	m_hLock = NET_New< CRITICAL_SECTION >( NET_ALLOC_GLOBAL, NULL );
+	InitializeCriticalSection( ( LPCRITICAL_SECTION ) m_hLock );
+}
+
+CBitBufPool::~CBitBufPool()
+{
+	for ( int i = 0; i < POOL_BUCKETS; ++i )
+	{
+		while ( m_pFree[ i ] )
+		{
+			free_block_t* pBlock = m_pFree[ i ];
+			m_pFree[ i ] = pBlock->m_pNext;
+
+			NET_Free( pBlock, 1UL << ( i + POOL_MIN_SHIFT ), NET_ALLOC_POOL );
+		}
+	}
+
+	DeleteCriticalSection( ( LPCRITICAL_SECTION ) m_hLock );
+	NET_Delete( ( LPCRITICAL_SECTION ) m_hLock, NET_ALLOC_GLOBAL );
+}
+
+unsigned char* CBitBufPool::Alloc( unsigned long nBytes, unsigned long* pCapacity )
+{
+	int nBucket = 0;
+	while ( nBucket < POOL_BUCKETS && ( 1UL << ( nBucket + POOL_MIN_SHIFT ) ) < nBytes )
+		++nBucket;
+
+	/* Oversized blocks bypass the pool */
+	if ( nBucket == POOL_BUCKETS )
+	{
+		*pCapacity = nBytes;
+		return ( unsigned char* ) NET_Alloc( nBytes, NET_ALLOC_POOL );
+	}
+
+	*pCapacity = 1UL << ( nBucket + POOL_MIN_SHIFT );
+
+	{
+		EnterCriticalSection( ( LPCRITICAL_SECTION ) m_hLock );
+
+		free_block_t* pBlock = m_pFree[ nBucket ];
+		if ( pBlock )
+			m_pFree[ nBucket ] = pBlock->m_pNext;
+
+		LeaveCriticalSection( ( LPCRITICAL_SECTION ) m_hLock );
+
+		if ( pBlock )
+			return ( unsigned char* ) pBlock;
+	}
+
+	return ( unsigned char* ) NET_Alloc( *pCapacity, NET_ALLOC_POOL );
+}
+
+void CBitBufPool::Free( unsigned char* pData, unsigned long nCapacity )
+{
+	if ( !pData )
+		return;
+
+	int nBucket = 0;
+	while ( nBucket < POOL_BUCKETS && ( 1UL << ( nBucket + POOL_MIN_SHIFT ) ) != nCapacity )
+		++nBucket;
+
+	if ( nBucket == POOL_BUCKETS )
+	{
+		NET_Free( pData, nCapacity, NET_ALLOC_POOL );
+		return;
+	}
+
+	free_block_t* pBlock = ( free_block_t* ) pData;
+
+	EnterCriticalSection( ( LPCRITICAL_SECTION ) m_hLock );
+	pBlock->m_pNext = m_pFree[ nBucket ];
+	m_pFree[ nBucket ] = pBlock;
+	LeaveCriticalSection( ( LPCRITICAL_SECTION ) m_hLock );
+}
+
+CBitBufPool* BitBuf_GetDefaultPool()
+{
+	static CBitBufPool s_DefaultPool;
+	return &s_DefaultPool;
+}
+
+void bf_write::InitGrowable( int nBytes, CBitBufPool* pPool )
+{
+	Release();
+
+	unsigned long nCapacity = 0;
+
+	m_pPool			= pPool;
+	m_pData			= m_pPool->Alloc( nBytes > 0 ? nBytes : 1, &nCapacity );
+	m_nDataBytes	= nCapacity;
+	m_nCurBit		= 0;
+	m_bOverflow		= false;
+}
+
+void bf_write::Release()
+{
+	if ( m_pPool )
+		m_pPool->Free( m_pData, m_nDataBytes );
+
+	m_pPool = NULL;
+}
+
+bool bf_write::Grow( unsigned long nBits )
+{
+	if ( !m_pPool )
+	{
+		m_bOverflow = true;
+		return false;
+	}
+
+	unsigned long nRequired = BITS_TO_BYTES( m_nCurBit + nBits );
+	unsigned long nCapacity = 0;
+
+	unsigned char* pData = m_pPool->Alloc( max( nRequired, m_nDataBytes * 2 ), &nCapacity );
+	memcpy( pData, m_pData, BITS_TO_BYTES( m_nCurBit ) );
+
+	m_pPool->Free( m_pData, m_nDataBytes );
+
+	m_pData			= pData;
+	m_nDataBytes	= nCapacity;
+	return true;
+}
@@ -4,21 +4,74 @@
 
 #include "windows.h"
 #include "vector"
+#include "math.h"
+#include "float.h"
 
 #include "Inc\Channel.h"
+#include "Inc\Compression.h"
+#include "Inc\Crypto.h"
+#include "Inc\Checksum.h"
+#include "Inc\Scheduler.h"
+#include "Inc\Metrics.h"
+#include "Inc\Trace.h"
 
 #pragma comment( lib, "Ws2_32.lib" )
 
 class CBaseNetChannel;
 
+struct net_message_desc_t
+{
+	NetMessageFactoryFn	m_pfnFactory;
+	unsigned long		m_nFlags;
+};
+
 bool g_bIsNetInitialized = false;
+net_message_desc_t g_MessageRegistry[ NET_MESSAGE_TYPES_MAX ];
 std::vector< CBaseNetChannel* > g_ListenChannels;
 CRITICAL_SECTION g_hListenChannelLock;
 
+/* Shared by all listen channels, guarded by g_hListenChannelLock */
+CNetTokenBucket g_EgressLimit;
+int g_nEgressRound = 0;
+
 #ifdef NET_NOTIFY_THREADLOCK
 CRITICAL_SECTION g_hNotificationLock;
 #endif
 
+/* Message types as version 22 clients put them on the wire */
+static const long g_LegacyTypes[][ 2 ] =
+{
+	{ clc_Connect,		NET_LEGACY_clc_Connect },
+	{ svc_Connect,		NET_LEGACY_svc_Connect },
+	{ net_Ping,			NET_LEGACY_net_Ping },
+	{ net_Disconnect,	NET_LEGACY_net_Disconnect },
+	{ net_HandlerMsg,	NET_LEGACY_net_HandlerMsg },
+	{ net_Transfer,		NET_LEGACY_net_Transfer },
+};
+
+static long NET_TypeToLegacy( long nType )
+{
+	for ( int i = 0; i < sizeof( g_LegacyTypes ) / sizeof( g_LegacyTypes[ 0 ] ); ++i )
+	{
+		if ( g_LegacyTypes[ i ][ 0 ] == nType )
+			return g_LegacyTypes[ i ][ 1 ];
+	}
+
+	/* Nothing a legacy peer understands, it drops the connection as it always did */
+	return nType;
+}
+
+static int NET_TypeFromLegacy( long nWireType )
+{
+	for ( int i = 0; i < sizeof( g_LegacyTypes ) / sizeof( g_LegacyTypes[ 0 ] ); ++i )
+	{
+		if ( g_LegacyTypes[ i ][ 1 ] == nWireType )
+			return ( int ) g_LegacyTypes[ i ][ 0 ];
+	}
+
+	return -1;
+}
+
 #if (NTDDI_VERSION < NTDDI_VISTA)
 int inet_pton( int af, const char *src, void *dst )
 {
@@ -69,10 +122,24 @@ const char *inet_ntop( int af, const void *src, char *dst, socklen_t size )
 
 #define PACKET_STRICT_VALIDATION
 #define PACKET_HEADER_LENGTH		8
+#define PACKET_COMPACT_HEADER_MAX	10
+#define PACKET_CHECKSUM_SIZE		4
 #define PACKET_BACKUP_LENGTH		( NET_PAYLOAD_SIZE * 4 )
 #define PACKET_TRANSFER_MTU			1500
 
+/* Per channel frame buffers, allocated with the channel */
+#define PACKET_SEND_BUFFER_LENGTH	( NET_TRANSFORM_CAPACITY + PACKET_HEADER_LENGTH + PACKET_COMPACT_HEADER_MAX + PACKET_CHECKSUM_SIZE )
+#define PACKET_RECV_BUFFER_LENGTH	( NET_PAYLOAD_SIZE + PACKET_BACKUP_LENGTH )
+
 DWORD WINAPI NET_ProcessSocket( LPVOID lp );
+DWORD WINAPI NET_ProcessServerSockets( LPVOID lp );
+
+struct NetSocketInfo_t
+{
+	int					m_nTickRate;
+	ServerRunFrameFn	m_pRunFrame;
+	volatile bool		m_bRunning;
+};
 
 enum channel_state_t
 {
@@ -81,19 +148,43 @@ enum channel_state_t
 	NET_RECEIVING
 };
 
+struct net_frame_t
+{
+	int					m_nType;
+	char*				m_pData;
+	long				m_nLength;
+	unsigned long		m_nTraceId;
+};
+
+/* Messages in the bundle being built, traced as sent once it goes out */
+struct net_trace_pending_t
+{
+	unsigned long		m_nTraceId;
+	int					m_nType;
+};
+
+/* Output of length changing transforms, held until the frames are dispatched */
+struct net_scratch_t
+{
+	unsigned char*		m_pData;
+	unsigned long		m_nCapacity;
+};
+
 class CNetMessageQueue
 {
 public:
-	CNetMessageQueue( INetChannel* pNetChannel );
+	CNetMessageQueue( INetChannel* pNetChannel = NULL );
 	~CNetMessageQueue();
 	void							AddMessage( INetMessage* pNetMessage );
 	void							ProcessMessages();
 
 	void							ReleaseQueue();
+	void							ReleaseMessages( int nCount );
 
 	int								GetMessageCount()				const { return m_Queue.size(); }
 	INetMessage*					GetMessageByIndex( int nMsg )	const { return m_Queue[ nMsg ]; }
 	void							RemoveMessage( int nMsg )		{ m_Queue.erase( m_Queue.begin() + nMsg ); }
+	void							SetChannel( INetChannel* pNetChannel )	{ m_pChannel = pNetChannel; }
 
 	void							LockQueue()
 	{
@@ -131,7 +222,10 @@ public:
 
 	bool				ProcessSocket();
 	long				ProcessIncoming();
-	long				ProcessOutgoing();
+	long				ProcessOutgoing( long nBudget = -1 );
+	long				FlushOutgoing( long nBudget = -1 );
+	bool				HasOutgoing();
+	void				UpdateTickRate( int nWindowFrames, int nCeiling );
 
 	int					GetTickRate()						const { return m_nTickRate; }
 	bool				IsSending()							const { return IsConnected() && ( m_nState == channel_state_t::NET_SENDING ); }
@@ -142,15 +236,101 @@ public:
 	const char*			GetHostIPString()					const { return m_szHostIP; }
 	unsigned long		GetHostIP()							const { return m_nHostIP; }
 	unsigned long		GetFlags()							const { return m_nFlags; }
+	unsigned long		GetFeatures()						const { return m_nActiveFeatures; }
+	unsigned long		GetDictionary()						const { return m_nActiveDictionary; }
+
+	bool				GetCompressionStats( net_compression_stats_t* pStats ) const
+	{
+		if ( !m_pCompressor )
+			return false;
+
+		m_pCompressor->GetStats( pStats );
+		return true;
+	}
+
+	void				GetTickStats( net_tick_stats_t* pStats ) const { m_TickScheduler.GetStats( pStats ); }
+
+	bool				GetLatencyStats( net_latency_stats_t* pStats ) const
+	{
+		*pStats = m_Latency;
+		return ( m_Latency.m_nSamples > 0 );
+	}
+
+	double				GetRTT()							const { return m_Latency.m_flRTT; }
+
+	void				GetMetrics( net_metrics_t* pMetrics ) const
+	{
+		memset( pMetrics, 0, sizeof( net_metrics_t ) );
+		m_Metrics.Accumulate( pMetrics );
+	}
+
+	CNetTickScheduler*	GetTickScheduler()					{ return &m_TickScheduler; }
+	unsigned long		GetTraceChannel()					const { return m_Metrics.GetId(); }
 	long				GetOutgoingSequenceNr()				const { return m_nOutgoingSequenceNr; }
 	long				GetIncomingSequenceNr()				const { return m_nIncomingSequenceNr; }
 	long				GetTransferSequenceNr()				const { return m_nTransmissionSequenceNr; }
 	unsigned int		GetSocket()							const { return m_hSocket; }
+	bool				IsZeroCopyReceive()					const { return m_bZeroCopyReceive; }
 
 	void				SetOutgoingSequenceNr( long nSeq )	{ m_nOutgoingSequenceNr = nSeq; }
 	void				SetIncomingSequenceNr( long nSeq )	{ m_nIncomingSequenceNr = nSeq; }
 	void				SetTickRate( long nTickRate )		{ m_nTickRate = ( int ) nTickRate; }
+	void				SetZeroCopyReceive( bool bEnable )	{ m_bZeroCopyReceive = bEnable; }
+	void				SetFeatures( unsigned long nFeatures )
+	{
+		m_nFeatures = nFeatures & NET_FEATURES_SUPPORTED;
+
+		if ( !m_bHasEncryptionKey )
+			m_nFeatures &= ~NET_FEATURE_ENCRYPTION;
+	}
+
+	void				SetEncryptionKey( const unsigned char* pKey )
+	{
+		m_bHasEncryptionKey = ( pKey != NULL );
+
+		if ( pKey )
+		{
+			memcpy( m_EncryptionKey, pKey, sizeof( m_EncryptionKey ) );
+			m_nFeatures |= NET_FEATURE_ENCRYPTION | NET_FEATURE_CHUNKED_TRANSFER;
+		}
+		else
+		{
+			SecureZeroMemory( m_EncryptionKey, sizeof( m_EncryptionKey ) );
+			m_nFeatures &= ~NET_FEATURE_ENCRYPTION;
+		}
+	}
+
+	void				SetBundleSize( long nBytes )		{ m_nBundleSize = max( nBytes, 0 ); }
+
+	void				SetRateLimit( unsigned long nBytesPerSecond )
+	{
+		CRITICAL_SECTION_AUTOLOCK( m_hResourceLock );
+		m_RateLimit.SetRate( nBytesPerSecond );
+	}
+	void				SetDictionary( unsigned long nDictionaryId ) { m_nDictionary = nDictionaryId; }
+
+	void				SetMessageFilter( int nType, bool bAccept )
+	{
+		if ( nType < 0 || nType >= NET_MESSAGE_TYPES_MAX )
+			return;
+
+		if ( bAccept )
+			m_RecvFilter[ nType >> 5 ] |= ( 1UL << ( nType & 31 ) );
+		else if ( !( g_MessageRegistry[ nType ].m_nFlags & NET_MSG_REQUIRED ) )
+			m_RecvFilter[ nType >> 5 ] &= ~( 1UL << ( nType & 31 ) );
+	}
+
+	bool				IsMessageAccepted( int nType ) const
+	{
+		if ( nType < 0 || nType >= NET_MESSAGE_TYPES_MAX )
+			return false;
+
+		return ( m_RecvFilter[ nType >> 5 ] & ( 1UL << ( nType & 31 ) ) ) != 0;
+	}
+
 	void				SetFlags( unsigned long nFlags )	{ m_nFlags = nFlags; }
+	void				SetDeficit( long nDeficit )			{ m_nDeficit = nDeficit; }
+	long				GetDeficit()						const { return m_nDeficit; }
 	void				SetState( channel_state_t nState )	{ m_nState = nState;}
 
 	bool				IsActiveSocket() const
@@ -184,19 +364,76 @@ public:
 	}
 
 protected:
-	long				ProcessTransmissions();
+	long				ProcessSendQueue( long nBudget );
+	bool				BeginTransmission();
+	long				StreamTransmission( long nBudget );
+	void				EndTransmission();
+	void				EndIncomingTransmission();
+	int					GetQueuedMessageCount();
+	CNETPing*			CreatePing();
+	void				ProcessPing( const CNETPing* pNetPing );
+	void				ResetLatency();
 
 	void				DisconnectInternal( CNETDisconnect* pNetDisconnect );
-	void				ProcessHandlerMessage( CNETHandlerMessage* pNetMessage );
-	long				ProcessPacketHeader( void* pBuf, unsigned long nSize, int* pType );
+	void				ProcessHandlerMessage( INetMessage* pNetMessage );
+	long				ProcessPacketHeader( void* pBuf, unsigned long nSize, int* pType, long* pHeaderSize );
 	long				SendInternal( void* pBuf, unsigned long nSize );
 	long				RecvInternal( char** pBuf, unsigned long nSize );
+	bool				ProcessFrame( int nType, char* pMessage, long nLength );
+	long				TransformOutgoing( char* pData, long nLength, long nCapacity );
+	bool				TransformIncoming( int nType, char** ppMessage, long* pLength );
+	char*				AllocRecvScratch();
+	void				ReleaseRecvScratch();
+	bool				ApplyFeatures( unsigned long nFeatures, unsigned long nDictionary, unsigned long long nClientSalt, unsigned long long nServerSalt );
+	bool				FlushBundle( CNETBundle* pBundle );
+	void				TraceBundled( unsigned long nTraceId, int nType );
+	bool				DispatchFrames();
+
+	bool				IsPingDue() const
+	{
+		if ( ( m_nOutgoingFeatures & NET_FEATURE_PING_TIMESTAMPS ) && NET_GetTime() >= m_nNextPingTime )
+			return true;
+
+		/* Keepalive after two seconds' worth of idle ticks */
+		return static_cast< int >( 2.0f * ( float ) ( m_nTickRate ) ) < m_nLastPingCycle;
+	}
+
+	bool				IsValidMessageType( int nType ) const
+	{
+		if ( nType < 0 || nType >= NET_MESSAGE_TYPES_MAX )
+			return false;
+
+		const net_message_desc_t& desc = g_MessageRegistry[ nType ];
+
+		if ( !desc.m_pfnFactory )
+			return false;
+
+		return ( desc.m_nFlags & ( m_bIsServer ? NET_MSG_FROM_CLIENT : NET_MSG_FROM_SERVER ) ) != 0;
+	}
+
+	bool				HasMessageConsumer( int nType ) const
+	{
+		if ( !IsMessageAccepted( nType ) )
+			return false;
+
+		if ( ( g_MessageRegistry[ nType ].m_nFlags & NET_MSG_HANDLER ) && !m_MessageHandler )
+			return false;
+
+		return true;
+	}
 
 	bool				m_bIsServer;
 	int					m_nTickRate;
 	int					m_nTimeout;
 	int					m_nLastPingCycle;
+	long				m_nBundleSize;
 	bool				m_bIsActiveTransmission;
+	CNETDataTransmission*	m_pActiveTransfer;
+	long				m_nTransferOffset;
+	bool				m_bChunkedTransfer;
+	CNETDataTransmission*	m_pIncomingTransfer;
+	long				m_nIncomingTransferOffset;
+	bool				m_bZeroCopyReceive;
 	long				m_nTransmissionSequenceNr;
 	long				m_nOutgoingSequenceNr;
 	long				m_nIncomingSequenceNr;
@@ -207,15 +444,26 @@ protected:
 
 	DWORD				m_dwNetworkThreadId;
 	HANDLE				m_hNetworkThread;
+	CNetTickScheduler	m_TickScheduler;
 
 	CRITICAL_SECTION	m_hResourceLock;
 
-	CNetMessageQueue	m_RecvQueue;
-	CNetMessageQueue	m_SendQueue;
+	CNetMessageQueue	m_SendQueue[ NET_PRIORITY_COUNT ];
+
+	/* Egress limit and deficit round robin share, bytes */
+	CNetTokenBucket		m_RateLimit;
+	unsigned long long	m_nBytesSent;
+	long				m_nDeficit;
+
+	/* Received frames awaiting decoding */
+	std::vector< net_frame_t >	m_RecvFrames;
+	unsigned long		m_RecvFilter[ NET_MESSAGE_TYPES_MAX / 32 ];
 
 	unsigned long		m_nFlags;
 	unsigned long		m_nRecvBackupLength;
 	char*				m_pRecvBackup;
+	char*				m_pRecvBuffer;
+	char*				m_pSendBuffer;
 
 	char				m_szHostIP[ 32 ];
 	unsigned long		m_nHostIP;
@@ -226,10 +474,51 @@ protected:
 	int					m_nLastHostPort;
 	bool				m_bCanReconnect;
 
+	/* Handshake */
+	bool				m_bHasValidatedProtocol;
+	bool				m_bLegacyTypes;			/* Version 22 client, types translated on the fixed framing */
+	bool				m_bIsAwaitingConnect;
+	unsigned long		m_nFeatures;
+	unsigned long		m_nActiveFeatures;
+	unsigned long		m_nDictionary;
+	unsigned long		m_nActiveDictionary;
+
+	/* Negotiated features take effect per direction at different points of the handshake */
+	unsigned long		m_nIncomingFeatures;
+	unsigned long		m_nOutgoingFeatures;
+
+	/* Adaptive tickrate, evaluated by the server frame over windows of frames */
+	int					m_nAdaptiveFrames;
+	int					m_nAdaptiveMessages;
+	int					m_nAdaptivePeakQueue;
+	int					m_nAdaptiveIdleWindows;
+	long				m_nRecvMessages;
+
+	/* Latency, from timestamped pings */
+	net_latency_stats_t	m_Latency;
+	unsigned long long	m_nNextPingTime;
+	unsigned long long	m_nPingEchoTime;		/* Peer's send time to echo, 0 once echoed */
+	unsigned long long	m_nPingEchoReceived;
+	double				m_flClockFilterRTT;
+	int					m_nClockFilterAge;
+
+	CNetMetrics			m_Metrics;
+
+	/* Message ids for tracing, per direction */
+	volatile LONG		m_nTraceOutgoing;
+	unsigned long		m_nTraceIncoming;
+	std::vector< net_trace_pending_t >	m_TraceBundle;
+
+	CNetCompressor*		m_pCompressor;
+	CNetCipher*			m_pCipher;
+	bool				m_bHasEncryptionKey;
+	unsigned char		m_EncryptionKey[ NET_ENCRYPTION_KEY_SIZE ];
+	unsigned long long	m_nSalt;
+	std::vector< net_scratch_t >	m_RecvScratch;
+
 	/* Server Reserved */
 	ServerConnectionNotifyFn			m_pfnNotify;
 	char								m_szDisconnectReason[ 128 ];
-	bool								m_bHasValidatedProtocol;
 
 	/* Handlers */
 	OnHandlerMessageReceivedFn			m_MessageHandler;
@@ -262,17 +551,31 @@ CNetMessageQueue::~CNetMessageQueue()
 	DeleteCriticalSection( &m_hQueueLock );
 }
 
-CBaseNetChannel::CBaseNetChannel() : m_RecvQueue( this ), m_SendQueue( this )
+CBaseNetChannel::CBaseNetChannel() : m_Metrics( &m_szHostIP[ 0 ] )
 {
+	for ( int i = 0; i < NET_PRIORITY_COUNT; ++i )
+		m_SendQueue[ i ].SetChannel( this );
+
 	m_bIsServer = false;
 	m_bCanReconnect = false;
 	m_bHasValidatedProtocol = false;
+	m_bLegacyTypes = false;
+	m_bIsAwaitingConnect = false;
 	m_bIsActiveTransmission = false;
+	m_pActiveTransfer = NULL;
+	m_nTransferOffset = 0;
+	m_bChunkedTransfer = false;
+	m_pIncomingTransfer = NULL;
+	m_nIncomingTransferOffset = 0;
+	m_nBytesSent = 0;
+	m_nDeficit = 0;
+	m_bZeroCopyReceive = false;
 	m_nOutgoingSequenceNr = 0;
 	m_nIncomingSequenceNr = 0;
 	m_nTransmissionSequenceNr = 0;
 	m_dwNetworkThreadId = 0;
 	m_nLastPingCycle = 0;
+	m_nBundleSize = NET_BUNDLE_SIZE_DEFAULT;
 	m_hSocket = INVALID_SOCKET;
 	m_pfnNotify = NULL;
 	m_MessageHandler = NULL;
@@ -284,13 +587,37 @@ CBaseNetChannel::CBaseNetChannel() : m_RecvQueue( this ), m_SendQueue( this )
 	m_nTimeout = 20000;
 	m_nState = NET_IDLE;
 
-	m_pRecvBackup = new char[ PACKET_BACKUP_LENGTH ];
+	m_pRecvBackup = ( char* ) NET_Alloc( PACKET_BACKUP_LENGTH, NET_ALLOC_RECV, this );
+	m_pRecvBuffer = ( char* ) NET_Alloc( PACKET_RECV_BUFFER_LENGTH, NET_ALLOC_RECV, this );
+	m_pSendBuffer = ( char* ) NET_Alloc( PACKET_SEND_BUFFER_LENGTH, NET_ALLOC_SEND, this );
 	m_nRecvBackupLength = 0;
 
+	memset( m_RecvFilter, 0xFF, sizeof( m_RecvFilter ) );
+	m_RecvFrames.reserve( 64 );
+
 	m_nHostIP = 0;
 	m_szHostIP[ 0 ] = 0;
 	m_nFlags = 0;
-
+	m_nFeatures = NET_FEATURES_DEFAULT;
+	m_nActiveFeatures = 0;
+	m_nDictionary = 0;
+	m_nActiveDictionary = 0;
+	m_nIncomingFeatures = 0;
+	m_nOutgoingFeatures = 0;
+	m_nAdaptiveFrames = 0;
+	m_nAdaptiveMessages = 0;
+	m_nAdaptivePeakQueue = 0;
+	m_nAdaptiveIdleWindows = 0;
+	m_nRecvMessages = 0;
+	m_nTraceOutgoing = 0;
+	m_nTraceIncoming = 0;
+	m_pCompressor = NULL;
+	m_pCipher = NULL;
+	m_bHasEncryptionKey = false;
+	m_nSalt = 0;
+
+	memset( m_EncryptionKey, 0, sizeof( m_EncryptionKey ) );
+	ResetLatency();
 
 	strncpy( m_szDisconnectReason, "Connection lost", sizeof( m_szDisconnectReason ) );
 
@@ -299,12 +626,21 @@ CBaseNetChannel::CBaseNetChannel() : m_RecvQueue( this ), m_SendQueue( this )
 
 CBaseNetChannel::~CBaseNetChannel()
 {
-	if( m_pRecvBackup )
-		delete[] m_pRecvBackup;
+	NET_Free( m_pRecvBackup, PACKET_BACKUP_LENGTH, NET_ALLOC_RECV, this );
+	NET_Free( m_pRecvBuffer, PACKET_RECV_BUFFER_LENGTH, NET_ALLOC_RECV, this );
+	NET_Free( m_pSendBuffer, PACKET_SEND_BUFFER_LENGTH, NET_ALLOC_SEND, this );
 
 	m_pRecvBackup = NULL;
 	DeleteCriticalSection( &m_hResourceLock );
 
+	NET_Delete( m_pCompressor, NET_ALLOC_CHANNEL, this );
+	NET_Delete( m_pCipher, NET_ALLOC_CHANNEL, this );
+
+	SecureZeroMemory( m_EncryptionKey, sizeof( m_EncryptionKey ) );
+	ReleaseRecvScratch();
+	EndTransmission();
+	EndIncomingTransmission();
+
 	if ( m_pSockAddr )
 	{
 		freeaddrinfo( m_pSockAddr );
@@ -368,7 +704,12 @@ bool CBaseNetChannel::Connect( const char* pszHost, int nPort )
 
 	m_hNetworkThread = CreateThread( NULL, NULL, &NET_ProcessSocket, this, NULL, &m_dwNetworkThreadId );
 
+	m_nSalt = NET_GenerateSalt();
+
 	CCLCConnect* pClientConnect = new CCLCConnect( this );
+	pClientConnect->SetFeatures( m_nFeatures );
+	pClientConnect->SetDictionary( m_nDictionary );
+	pClientConnect->SetSalt( m_nSalt );
 	Transmit( pClientConnect );
 
 	return true;
@@ -408,7 +749,12 @@ bool CBaseNetChannel::Connect( SOCKET hSocket )
 
 	m_hNetworkThread = CreateThread( NULL, NULL, &NET_ProcessSocket, this, NULL, &m_dwNetworkThreadId );
 
+	m_nSalt = NET_GenerateSalt();
+
 	CCLCConnect* pClientConnect = new CCLCConnect( this );
+	pClientConnect->SetFeatures( m_nFeatures );
+	pClientConnect->SetDictionary( m_nDictionary );
+	pClientConnect->SetSalt( m_nSalt );
 	Transmit( pClientConnect );
 
 	return true;
@@ -455,9 +801,7 @@ bool CBaseNetChannel::InitFromSocket( SOCKET hSocket, DWORD dwNetworkThreadId, S
 	//m_dwNetworkThreadId = dwNetworkThreadId;
 	m_hNetworkThread = CreateThread( NULL, NULL, &NET_ProcessSocket, this, NULL, &m_dwNetworkThreadId );
 
-	CSVCConnect* pSVCConnect = new CSVCConnect( this );
-	SendNetMessage( pSVCConnect );
-
+	/* CSVCConnect is sent in reply to the client's CCLCConnect */
 	return true;
 }
 
@@ -490,6 +834,15 @@ void CBaseNetChannel::CloseConnection()
 		closesocket( m_hSocket );
 		m_hSocket = INVALID_SOCKET;
 
+		if ( m_nFlags & NET_DISCONNECT_BY_HOST )
+			m_Metrics.Add( NET_COUNTER_DISCONNECTS_BY_HOST );
+		else if ( m_nFlags & NET_DISCONNECT_BY_PROTOCOL )
+			m_Metrics.Add( NET_COUNTER_DISCONNECTS_BY_PROTOCOL );
+		else if ( m_nFlags & NET_DISCONNECT_LOCAL )
+			m_Metrics.Add( NET_COUNTER_DISCONNECTS_LOCAL );
+		else
+			m_Metrics.Add( NET_COUNTER_DISCONNECTS_LOST );
+
 		hNetworkThread = m_hNetworkThread;
 		dwNetworkThreadId = m_dwNetworkThreadId;
 	}
@@ -508,279 +861,643 @@ void CBaseNetChannel::CloseConnection()
 		CRITICAL_SECTION_AUTOLOCK( m_hResourceLock );
 		// moved from here (18.8.2018)
 
-		m_SendQueue.ReleaseQueue();
-		m_RecvQueue.ReleaseQueue();
+		for ( int i = 0; i < NET_PRIORITY_COUNT; ++i )
+			m_SendQueue[ i ].ReleaseQueue();
+
+		m_RecvFrames.clear();
+		EndTransmission();
+		EndIncomingTransmission();
 
 		m_nIncomingSequenceNr = 0;
 		m_nOutgoingSequenceNr = 0;
 		m_bHasValidatedProtocol = false;
+		m_bLegacyTypes = false;
+		m_bIsAwaitingConnect = false;
+		m_nActiveFeatures = 0;
+		m_nActiveDictionary = 0;
+		m_nIncomingFeatures = 0;
+		m_nOutgoingFeatures = 0;
+
+		ResetLatency();
 	}
 }
 
 long CBaseNetChannel::ProcessIncoming()
 {
+	unsigned long long nTraceStart = NET_IsTracing() ? NET_GetTime() : 0;
+
 	char* pRecv = NULL;
-	if ( RecvInternal( &pRecv, NET_PAYLOAD_SIZE ) == -1 )
-	{
-		if( pRecv )
-			delete[] pRecv;
+	long nResult = RecvInternal( &pRecv, NET_PAYLOAD_SIZE );
 
+	/* Polls that found nothing to receive aren't traced */
+	if ( nTraceStart && pRecv )
+		NET_TraceEvent( NET_TRACE_RECV, GetTraceChannel(), 0, -1, nTraceStart, NET_GetTime() - nTraceStart );
+
+	if ( nResult == -1 )
+	{
+		ReleaseRecvScratch();
 		return -1;
 	}
 
-	if( pRecv )
-		delete[] pRecv;
-
+	/* Frames reference the receive buffer until they are decoded */
+	bool bDispatchOK = true;
 	{
 		CRITICAL_SECTION_AUTOLOCK( m_hResourceLock );
-		m_RecvQueue.ProcessMessages();
-		m_RecvQueue.ReleaseQueue();
+
+		unsigned long long nDispatchStart = NET_GetTime();
+		bDispatchOK = DispatchFrames();
+		m_Metrics.Record( NET_HISTOGRAM_DISPATCH_TIME, NET_GetTime() - nDispatchStart );
+
+		ReleaseRecvScratch();
 	}
 
-	return m_nIncomingSequenceNr;
+	return ( bDispatchOK ? m_nIncomingSequenceNr : -1 );
 }
 
-long CBaseNetChannel::ProcessOutgoing()
+long CBaseNetChannel::ProcessOutgoing( long nBudget )
 {
 	CRITICAL_SECTION_AUTOLOCK( m_hResourceLock );
 
-	/* Process File Transmissions */
-	switch ( ProcessTransmissions() )
-	{
-	case 0:
-		break;
-	case 1:
-		return -1;
-	default:
+	/* Hold everything until the server has answered the handshake, */
+	/* the framing of later messages depends on its reply */
+	if ( m_bIsAwaitingConnect )
 		return m_nOutgoingSequenceNr;
+
+	/* The channel's own limit applies on top of what the caller grants */
+	m_RateLimit.Refill();
+
+	if ( m_RateLimit.IsLimited() )
+		nBudget = ( nBudget < 0 ) ? m_RateLimit.GetTokens() : min( nBudget, m_RateLimit.GetTokens() );
+
+	unsigned long long nBytesSent = m_nBytesSent;
+	long nSequenceNr = ProcessSendQueue( nBudget );
+
+	m_RateLimit.Consume( ( long ) ( m_nBytesSent - nBytesSent ) );
+	return nSequenceNr;
+}
+
+long CBaseNetChannel::ProcessSendQueue( long nBudget )
+{
+	unsigned long long nBytesStart = m_nBytesSent;
+	bool bTrace = NET_IsTracing();
+
+	/* Raw transfer data streams right after its header, nothing else can go out in between */
+	if ( m_pActiveTransfer && !m_bChunkedTransfer )
+	{
+		switch ( StreamTransmission( nBudget ) )
+		{
+		case 0:
+			break;
+		case 1:
+			return m_nOutgoingSequenceNr;
+		default:
+			return -1;
+		}
 	}
 
-	m_SendQueue.LockQueue();
+	int nMsgCount[ NET_PRIORITY_COUNT ];
+	int nSent[ NET_PRIORITY_COUNT ];
+	int nQueued = 0;
 
-	if ( static_cast< int >( 2.0f * ( float ) ( m_nTickRate ) ) < m_nLastPingCycle )
+	for ( int i = 0; i < NET_PRIORITY_COUNT; ++i )
 	{
-		CNETPing* pNETPing = new CNETPing( this );
-		m_SendQueue.AddMessage( pNETPing );
+		m_SendQueue[ i ].LockQueue();
+
+		if ( i == NET_PRIORITY_CONTROL && IsPingDue() )
+			m_SendQueue[ i ].AddMessage( CreatePing() );
+
+		nMsgCount[ i ] = m_SendQueue[ i ].GetMessageCount();
+		nSent[ i ] = 0;
+
+		m_SendQueue[ i ].UnLockQueue();
+
+		nQueued += nMsgCount[ i ];
 	}
 
-	char* pData = NULL;
-	int* nDataLength = NULL;
+	if ( nQueued > m_Metrics.GetGauge( NET_GAUGE_PEAK_QUEUED_MESSAGES ) )
+		m_Metrics.SetGauge( NET_GAUGE_PEAK_QUEUED_MESSAGES, nQueued );
 
 	bool bTransmissionOK = true;
-	int nMsgCount = m_SendQueue.GetMessageCount();
+	bool bBundle = ( m_nBundleSize > 0 ) && ( m_nActiveFeatures & NET_FEATURE_BUNDLING );
+	bool bActivity = false;
+
+	CNETBundle bundle( this );
+	bundle.SetMaxSize( m_nBundleSize );
+
+	CNETTransferData chunk( this );
+
+	char data[ NET_TRANSFORM_CAPACITY ];
 
-	if ( nMsgCount )
+	/* Bytes taken by the weighted lanes during this call */
+	long long nInteractiveBytes = 0;
+	long long nBulkBytes = 0;
+
+	/* Messages are serialized as they go out, what the budget doesn't cover stays queued */
+	while ( true )
 	{
-		pData = new char[ NET_PAYLOAD_SIZE * nMsgCount ];
-		nDataLength = new int[ nMsgCount ];
+		int nLane = NET_PRIORITY_CONTROL;
+
+		/* Control messages queued from other threads, e.g. a disconnect, */
+		/* go out before the next message of the other lanes */
+		m_SendQueue[ NET_PRIORITY_CONTROL ].LockQueue();
+		nMsgCount[ NET_PRIORITY_CONTROL ] = m_SendQueue[ NET_PRIORITY_CONTROL ].GetMessageCount();
+		m_SendQueue[ NET_PRIORITY_CONTROL ].UnLockQueue();
 
-		for ( int i = 0; i < nMsgCount; ++i )
+		/* The budget is charged for control messages but never holds them back */
+		if ( nSent[ NET_PRIORITY_CONTROL ] >= nMsgCount[ NET_PRIORITY_CONTROL ] )
 		{
-			INetMessage* pNetMessage = m_SendQueue.GetMessageByIndex( i );
+			if ( nBudget >= 0 && ( long long ) ( m_nBytesSent - nBytesStart ) >= nBudget )
+				break;
+
+			bool bInteractive = ( nSent[ NET_PRIORITY_INTERACTIVE ] < nMsgCount[ NET_PRIORITY_INTERACTIVE ] );
+			bool bBulk = ( m_pActiveTransfer != NULL ) || ( nSent[ NET_PRIORITY_BULK ] < nMsgCount[ NET_PRIORITY_BULK ] );
 
-			char* pMessageData = ( char* ) ( pData + NET_PAYLOAD_SIZE * i );
-			nDataLength[ i ] = pNetMessage->Serialize( pMessageData, NET_PAYLOAD_SIZE );
+			if ( !bInteractive && !bBulk )
+				break;
 
-			if ( m_IntermediateProxy )
-				m_IntermediateProxy->ProcessOutgoing( ( char* ) ( pMessageData + PACKET_MANIFEST_SIZE ), nDataLength[ i ] - PACKET_MANIFEST_SIZE );
+			if ( bInteractive && ( !bBulk || nInteractiveBytes <= nBulkBytes * NET_PRIORITY_WEIGHT ) )
+				nLane = NET_PRIORITY_INTERACTIVE;
+			else
+				nLane = NET_PRIORITY_BULK;
 		}
-	}
 
-	m_SendQueue.UnLockQueue();
+		INetMessage* pNetMessage = NULL;
+
+		if ( nLane == NET_PRIORITY_BULK && m_pActiveTransfer )
+		{
+			/* A chunked transfer goes out a piece at a time, taking turns with the other lanes */
+			long nChunk = min( m_pActiveTransfer->GetTransmissionLength() - m_nTransferOffset, NET_TRANSFER_CHUNK_SIZE );
+
+			chunk.Init( m_pActiveTransfer->GetTransmissionId(), m_pActiveTransfer->GetTransmissionData() + m_nTransferOffset, nChunk );
+			m_nTransferOffset += nChunk;
 
-	for ( int i = 0; i < nMsgCount; ++i )
-	{
-		if ( pData && nDataLength && nDataLength[ i ] > 0 )
+			pNetMessage = &chunk;
+		}
+		else
+		{
+			m_SendQueue[ nLane ].LockQueue();
+
+			pNetMessage = m_SendQueue[ nLane ].GetMessageByIndex( nSent[ nLane ] );
+
+			/* The channel owns transfers until their data has been sent */
+			if ( pNetMessage->GetType() == net_Transfer )
+			{
+				m_pActiveTransfer = static_cast< CNETDataTransmission* >( pNetMessage );
+				m_SendQueue[ nLane ].RemoveMessage( nSent[ nLane ] );
+				--nMsgCount[ nLane ];
+			}
+			else
+			{
+				++nSent[ nLane ];
+			}
+
+			m_SendQueue[ nLane ].UnLockQueue();
+		}
+
+		if ( pNetMessage == m_pActiveTransfer )
 		{
-			m_nState = NET_SENDING;
-			if ( SendInternal( ( char* ) ( pData + NET_PAYLOAD_SIZE * i ), nDataLength[ i ] ) == -1 )
+			/* Keep the order, whatever has been bundled goes out first */
+			if ( !FlushBundle( &bundle ) || !BeginTransmission() )
 			{
 				bTransmissionOK = false;
 				break;
 			}
-		}
-	}
-
-	if( nMsgCount )
-		m_nLastPingCycle = 0;
 
-	if( pData )
-		delete[] pData;
+			bActivity = true;
 
-	if( nDataLength )
-		delete[] nDataLength;
+			if ( !m_pActiveTransfer || m_bChunkedTransfer )
+				continue;
 
-	m_SendQueue.ReleaseQueue();
-	return ( bTransmissionOK ? m_nOutgoingSequenceNr : -1 );
-}
+			long nRemaining = -1;
 
-long CBaseNetChannel::ProcessTransmissions()
-{
-	m_SendQueue.LockQueue();
+			if ( nBudget >= 0 )
+				nRemaining = max( nBudget - ( long ) ( m_nBytesSent - nBytesStart ), 0 );
 
-	char* pHeaderData = NULL;
-	char* pFileData = NULL;
+			long nResult = StreamTransmission( nRemaining );
 
-	long nFileLength = 0;
-	long nHeaderLength = 0;
+			if ( nResult == 0 )
+				continue;
 
-	std::vector< int > RemoveQueue;
+			bTransmissionOK = ( nResult == 1 );
+			break;
+		}
 
-	int nMsgCount = m_SendQueue.GetMessageCount();
-	for ( int i = 0; i < nMsgCount; ++i )
-	{
-		INetMessage* pNetMessage = m_SendQueue.GetMessageByIndex( i );
+		unsigned long long nTraceStart = bTrace ? NET_GetTime() : 0;
+		long nLength = pNetMessage->Serialize( data, NET_PAYLOAD_SIZE );
 
-		if ( pNetMessage->GetType() != net_Transfer )
+		if ( nLength <= 0 )
 			continue;
 
-		CNETDataTransmission* pHeaderMsg = static_cast< CNETDataTransmission* >( pNetMessage );
-		nFileLength = pHeaderMsg->GetTransmissionLength();
+		/* Transforms run here rather than at serialization, the handshake */
+		/* switches them on between two messages of the same batch */
+		nLength = TransformOutgoing( data, nLength, sizeof( data ) );
 
-		if ( nFileLength <= 0 )
+		if ( nLength <= 0 )
 		{
-			RemoveQueue.push_back( i );
-			continue;
+			bTransmissionOK = false;
+			break;
 		}
 
-		pHeaderData = new char[ NET_PAYLOAD_SIZE ];
-		nHeaderLength = pNetMessage->Serialize( pHeaderData, NET_PAYLOAD_SIZE );
+		m_Metrics.Add( NET_COUNTER_MESSAGES_OUT );
+
+		unsigned long nTraceId = pNetMessage->GetTraceId();
 
-		if ( m_IntermediateProxy )
-			m_IntermediateProxy->ProcessOutgoing( ( char* )( pHeaderData + PACKET_MANIFEST_SIZE ), nHeaderLength - PACKET_MANIFEST_SIZE );
+		if ( bTrace )
+		{
+			unsigned long long nNow = NET_GetTime();
+			NET_TraceEvent( NET_TRACE_SERIALIZE, GetTraceChannel(), nTraceId, pNetMessage->GetType(), nTraceStart, nNow - nTraceStart );
+			nTraceStart = nNow;
+		}
 
-		if ( nHeaderLength > 0 )
-			pFileData = pHeaderMsg->GetTransmissionData();
+		if ( nLane == NET_PRIORITY_INTERACTIVE )
+			nInteractiveBytes += nLength;
+		else if ( nLane == NET_PRIORITY_BULK )
+			nBulkBytes += nLength;
 
-		RemoveQueue.push_back( i );
-		break;
-	}
+		if ( pNetMessage == &chunk && m_nTransferOffset >= m_pActiveTransfer->GetTransmissionLength() )
+			EndTransmission();
 
-	m_SendQueue.UnLockQueue();
+		bool bBundleable = bBundle && CNETBundle::IsBundleable( ( ( long* ) data )[ 0 ] );
 
-	long nTransmissionId = 0;
-	if ( pHeaderData && nHeaderLength > 0 )
-	{
 		m_nState = NET_SENDING;
+		bActivity = true;
 
-		if ( pFileData && SendInternal( pHeaderData, nHeaderLength ) != -1 )
+		if ( bBundleable && bundle.AddMessage( data, nLength ) )
 		{
-			/* Start Transfering... */
-			nTransmissionId = m_nTransmissionSequenceNr + 1;
-
-			m_bIsActiveTransmission = true;
+			TraceBundled( nTraceId, pNetMessage->GetType() );
+			continue;
+		}
 
-			int nDataLeft = nFileLength;
-			int nTotalBytesSent = 0;
+		if ( !FlushBundle( &bundle ) )
+		{
+			bTransmissionOK = false;
+			break;
+		}
 
-			while ( nDataLeft > 0 )
-			{
-				int nBytesSent = send( m_hSocket, ( char* ) pFileData + nTotalBytesSent, min( nDataLeft, PACKET_TRANSFER_MTU ), 0 );
-				
-				if ( nBytesSent == SOCKET_ERROR )
-				{
-					nTransmissionId = -1;
-					break;
-				}
+		if ( bBundleable && bundle.AddMessage( data, nLength ) )
+		{
+			TraceBundled( nTraceId, pNetMessage->GetType() );
+			continue;
+		}
 
-				nDataLeft -= nBytesSent;
-				nTotalBytesSent += nBytesSent;
-			}
+		if ( bTrace )
+			nTraceStart = NET_GetTime();
 
-			m_bIsActiveTransmission = false;
+		if ( SendInternal( data, nLength ) == -1 )
+		{
+			bTransmissionOK = false;
+			break;
 		}
-		else
+
+		if ( bTrace && nTraceId )
+			NET_TraceEvent( NET_TRACE_SEND, GetTraceChannel(), nTraceId, pNetMessage->GetType(), nTraceStart, NET_GetTime() - nTraceStart );
+
+		/* Everything after the connect reply uses the negotiated features */
+		if ( ( ( long* ) data )[ 0 ] == svc_Connect )
+			m_nOutgoingFeatures = m_nActiveFeatures;
+
+		if ( pNetMessage->GetType() == clc_Connect && !m_bHasValidatedProtocol )
 		{
-			nTransmissionId = -1;
+			m_bIsAwaitingConnect = true;
+			break;
 		}
 	}
 
-	m_SendQueue.LockQueue();
-
-	nMsgCount = RemoveQueue.size();
-	for ( int i = 0; i < nMsgCount; ++i )
-		m_SendQueue.RemoveMessage( RemoveQueue[ i ] );
+	if ( bTransmissionOK && !FlushBundle( &bundle ) )
+		bTransmissionOK = false;
 
-	m_SendQueue.UnLockQueue();
+	if ( bActivity )
+		m_nLastPingCycle = 0;
 
+	nQueued = 0;
 
-	if( pHeaderData )
-		delete[] pHeaderData;
+	for ( int i = 0; i < NET_PRIORITY_COUNT; ++i )
+	{
+		m_SendQueue[ i ].ReleaseMessages( nSent[ i ] );
+		nQueued += nMsgCount[ i ] - nSent[ i ];
+	}
 
-	if ( pFileData )
-		delete[] pFileData;
+	m_Metrics.SetGauge( NET_GAUGE_QUEUED_MESSAGES, nQueued );
 
-	return nTransmissionId;
+	return ( bTransmissionOK ? m_nOutgoingSequenceNr : -1 );
 }
 
-bool CBaseNetChannel::ProcessSocket()
+bool CBaseNetChannel::FlushBundle( CNETBundle* pBundle )
 {
-	m_nState = NET_IDLE;
+	if ( !pBundle->GetMessageCount() )
+		return true;
 
-	if ( !IsConnected() )
-		return false;
+	char data[ NET_TRANSFORM_CAPACITY ];
+	long nLength = pBundle->Serialize( data, sizeof( data ) );
 
-	++m_nLastPingCycle;
+	pBundle->Reset();
 
-	int nIncomingSequenceNr = m_nIncomingSequenceNr;
-	int nSequenceNumber = ProcessIncoming();
+	unsigned long long nTraceStart = m_TraceBundle.empty() ? 0 : NET_GetTime();
+	bool bSent = ( nLength > 0 ) && ( SendInternal( data, nLength ) != -1 );
 
-	if ( nSequenceNumber != -1 && !m_bIsServer && IsConnected() )
+	if ( bSent && nTraceStart )
 	{
-		/* No packets were received this frame */
-		nSequenceNumber = ProcessOutgoing();
-	}
+		unsigned long long nDuration = NET_GetTime() - nTraceStart;
 
-	if ( nSequenceNumber == -1 )
-	{
-		m_nFlags |= NET_DISCONNECT_BY_PROTOCOL;
-		return false;
+		int c = m_TraceBundle.size();
+		for ( int i = 0; i < c; ++i )
+			NET_TraceEvent( NET_TRACE_SEND, GetTraceChannel(), m_TraceBundle[ i ].m_nTraceId, m_TraceBundle[ i ].m_nType, nTraceStart, nDuration );
 	}
 
-	return IsConnected();
+	m_TraceBundle.clear();
+	return bSent;
 }
 
-void CBaseNetChannel::SendNetData( char* pData, long nSize, const bf_write* pProps )
+void CBaseNetChannel::TraceBundled( unsigned long nTraceId, int nType )
 {
-	if ( nSize <= 0 )
+	if ( !nTraceId || !NET_IsTracing() )
 		return;
 
-	int nTransmissionId = ++m_nTransmissionSequenceNr;
+	net_trace_pending_t pending;
+	pending.m_nTraceId = nTraceId;
+	pending.m_nType = nType;
 
-	CNETDataTransmission* pDeltaTransmission = new CNETDataTransmission( this );
+	m_TraceBundle.push_back( pending );
+}
 
-	char* pFileBuffer = new char[ nSize ];
-	memcpy( pFileBuffer, pData, nSize );
+bool CBaseNetChannel::BeginTransmission()
+{
+	if ( m_pActiveTransfer->GetTransmissionLength() <= 0 )
+	{
+		EndTransmission();
+		return true;
+	}
 
-	pDeltaTransmission->SetTransmissionId( nTransmissionId );
-	if ( !pDeltaTransmission->Init( pFileBuffer, nSize ) )
+	unsigned long nTraceId = m_pActiveTransfer->GetTraceId();
+	unsigned long long nTraceStart = NET_IsTracing() ? NET_GetTime() : 0;
+
+	char header[ NET_TRANSFORM_CAPACITY ];
+	long nHeaderLength = m_pActiveTransfer->Serialize( header, NET_PAYLOAD_SIZE );
+
+	if ( nHeaderLength > 0 )
+		nHeaderLength = TransformOutgoing( header, nHeaderLength, sizeof( header ) );
+
+	m_nState = NET_SENDING;
+
+	if ( nTraceStart )
 	{
-		printf( "Unable to init delta transmission: Deleting payload!\n" );
-		delete[] pFileBuffer;
-		delete pDeltaTransmission;
-		return;
+		unsigned long long nNow = NET_GetTime();
+		NET_TraceEvent( NET_TRACE_SERIALIZE, GetTraceChannel(), nTraceId, net_Transfer, nTraceStart, nNow - nTraceStart );
+		nTraceStart = nNow;
 	}
 
-	if ( pProps )
+	if ( nHeaderLength <= 0 || SendInternal( header, nHeaderLength ) == -1 )
 	{
-		pDeltaTransmission->WriteProps( ( char* ) pProps->GetData(), pProps->GetNumBytesWritten() );
+		EndTransmission();
+		return false;
 	}
 
-	SendNetMessage( pDeltaTransmission );
-}
+	m_Metrics.Add( NET_COUNTER_MESSAGES_OUT );
 
-void CBaseNetChannel::SendNetMessage( INetMessage* pNetMessage )
+	if ( nTraceStart && nTraceId )
+		NET_TraceEvent( NET_TRACE_SEND, GetTraceChannel(), nTraceId, net_Transfer, nTraceStart, NET_GetTime() - nTraceStart );
+
+	/* The peer expects whichever form the features in effect for this header call for */
+	m_bChunkedTransfer = ( m_nOutgoingFeatures & NET_FEATURE_CHUNKED_TRANSFER ) != 0;
+	m_nTransferOffset = 0;
+	m_bIsActiveTransmission = true;
+	return true;
+}
+
+long CBaseNetChannel::StreamTransmission( long nBudget )
 {
-	m_SendQueue.AddMessage( pNetMessage );
+	unsigned long long nBytesStart = m_nBytesSent;
 
-	if ( m_bIsServer )
+	/* As much of the data as the budget allows, the rest goes out on later calls */
+	char* pFileData = m_pActiveTransfer->GetTransmissionData();
+	long nFileLength = m_pActiveTransfer->GetTransmissionLength();
+
+	while ( m_nTransferOffset < nFileLength )
 	{
-		if ( ProcessOutgoing() == -1 )
+		if ( nBudget >= 0 && ( long long ) ( m_nBytesSent - nBytesStart ) >= nBudget )
+			return 1;
+
+		m_nState = NET_SENDING;
+
+		int nBytesSent = send( m_hSocket, pFileData + m_nTransferOffset, min( nFileLength - m_nTransferOffset, PACKET_TRANSFER_MTU ), 0 );
+
+		m_Metrics.Add( NET_COUNTER_SEND_CALLS );
+
+		if ( nBytesSent == SOCKET_ERROR )
 		{
-			m_nFlags |= NET_DISCONNECT_BY_PROTOCOL;
-			CloseConnection();
+			EndTransmission();
+			return -1;
 		}
+
+		m_nTransferOffset += nBytesSent;
+		m_nBytesSent += nBytesSent;
+
+		m_Metrics.Add( NET_COUNTER_BYTES_OUT, nBytesSent );
+	}
+
+	EndTransmission();
+	return 0;
+}
+
+void CBaseNetChannel::EndTransmission()
+{
+	if ( m_pActiveTransfer )
+	{
+		NET_Free( m_pActiveTransfer->GetTransmissionData(), m_pActiveTransfer->GetTransmissionLength(), NET_ALLOC_TRANSFER, this );
+		delete m_pActiveTransfer;
+	}
+
+	m_pActiveTransfer = NULL;
+	m_nTransferOffset = 0;
+	m_bChunkedTransfer = false;
+	m_bIsActiveTransmission = false;
+}
+
+void CBaseNetChannel::EndIncomingTransmission()
+{
+	if ( m_pIncomingTransfer )
+	{
+		NET_Free( m_pIncomingTransfer->GetTransmissionData(), m_pIncomingTransfer->GetTransmissionLength(), NET_ALLOC_TRANSFER, this );
+		delete m_pIncomingTransfer;
+	}
+
+	m_pIncomingTransfer = NULL;
+	m_nIncomingTransferOffset = 0;
+}
+
+bool CBaseNetChannel::ProcessSocket()
+{
+	m_nState = NET_IDLE;
+
+	if ( !IsConnected() )
+		return false;
+
+	++m_nLastPingCycle;
+
+	int nIncomingSequenceNr = m_nIncomingSequenceNr;
+	int nSequenceNumber = ProcessIncoming();
+
+	if ( nSequenceNumber != -1 && !m_bIsServer && IsConnected() )
+	{
+		/* No packets were received this frame */
+		nSequenceNumber = ProcessOutgoing();
+	}
+
+	if ( nSequenceNumber == -1 )
+	{
+		m_nFlags |= NET_DISCONNECT_BY_PROTOCOL;
+		return false;
+	}
+
+	return IsConnected();
+}
+
+void CBaseNetChannel::SendNetData( char* pData, long nSize, const bf_write* pProps )
+{
+	if ( nSize <= 0 )
+		return;
+
+	int nTransmissionId = ++m_nTransmissionSequenceNr;
+
+	CNETDataTransmission* pDeltaTransmission = new CNETDataTransmission( this );
+
+	char* pFileBuffer = ( char* ) NET_Alloc( nSize, NET_ALLOC_TRANSFER, this );
+	memcpy( pFileBuffer, pData, nSize );
+
+	pDeltaTransmission->SetTransmissionId( nTransmissionId );
+	if ( !pDeltaTransmission->Init( pFileBuffer, nSize ) )
+	{
+		printf( "Unable to init delta transmission: Deleting payload!\n" );
+		NET_Free( pFileBuffer, nSize, NET_ALLOC_TRANSFER, this );
+		delete pDeltaTransmission;
+		return;
+	}
+
+	if ( pProps )
+	{
+		pDeltaTransmission->WriteProps( ( char* ) pProps->GetData(), pProps->GetNumBytesWritten() );
+	}
+
+	SendNetMessage( pDeltaTransmission );
+}
+
+void CBaseNetChannel::SendNetMessage( INetMessage* pNetMessage )
+{
+	int nLane = pNetMessage->GetPriority();
+
+	/* Transfers are picked up from the bulk lane only */
+	if ( pNetMessage->GetType() == net_Transfer )
+		nLane = NET_PRIORITY_BULK;
+	else if ( nLane < 0 || nLane >= NET_PRIORITY_COUNT )
+		nLane = NET_PRIORITY_INTERACTIVE;
+
+	if ( NET_IsTracing() )
+	{
+		pNetMessage->SetTraceId( ( unsigned long ) InterlockedIncrement( &m_nTraceOutgoing ) );
+		NET_TraceEvent( NET_TRACE_ENQUEUE, GetTraceChannel(), pNetMessage->GetTraceId(), pNetMessage->GetType(), NET_GetTime() );
+	}
+
+	/* Server channels are flushed together at the end of each server frame */
+	m_SendQueue[ nLane ].AddMessage( pNetMessage );
+}
+
+long CBaseNetChannel::FlushOutgoing( long nBudget )
+{
+	if ( !IsConnected() )
+		return 0;
+
+	unsigned long long nBytesSent = m_nBytesSent;
+
+	if ( ProcessOutgoing( nBudget ) == -1 )
+	{
+		/* Called with the listen channels locked, CloseConnection could wait on the */
+		/* network thread for seconds. Shutting the socket down fails its next recv, */
+		/* and the thread closes the connection itself */
+		CRITICAL_SECTION_AUTOLOCK( m_hResourceLock );
+
+		m_nFlags |= NET_DISCONNECT_BY_PROTOCOL;
+
+		if ( m_hSocket != INVALID_SOCKET )
+			shutdown( m_hSocket, SD_BOTH );
+	}
+
+	return ( long ) ( m_nBytesSent - nBytesSent );
+}
+
+bool CBaseNetChannel::HasOutgoing()
+{
+	CRITICAL_SECTION_AUTOLOCK( m_hResourceLock );
+
+	if ( !IsConnected() || m_bIsAwaitingConnect )
+		return false;
+
+	return ( GetQueuedMessageCount() > 0 ) || m_pActiveTransfer || IsPingDue();
+}
+
+int CBaseNetChannel::GetQueuedMessageCount()
+{
+	int nQueued = 0;
+
+	for ( int i = 0; i < NET_PRIORITY_COUNT; ++i )
+	{
+		m_SendQueue[ i ].LockQueue();
+		nQueued += m_SendQueue[ i ].GetMessageCount();
+		m_SendQueue[ i ].UnLockQueue();
 	}
+
+	return nQueued;
+}
+
+void CBaseNetChannel::UpdateTickRate( int nWindowFrames, int nCeiling )
+{
+	CRITICAL_SECTION_AUTOLOCK( m_hResourceLock );
+
+	if ( !IsConnected() || !m_bHasValidatedProtocol || !( m_nActiveFeatures & NET_FEATURE_ADAPTIVE_TICKRATE ) )
+		return;
+
+	int nQueued = GetQueuedMessageCount();
+
+	m_nAdaptiveMessages += nQueued;
+	m_nAdaptivePeakQueue = max( m_nAdaptivePeakQueue, nQueued );
+
+	if ( ++m_nAdaptiveFrames < nWindowFrames )
+		return;
+
+	m_nAdaptiveMessages += m_nRecvMessages;
+
+	/* Ticks much shorter than the round trip barely shorten it */
+	if ( m_Latency.m_nSamples && m_Latency.m_flRTT > 0.0 )
+		nCeiling = min( nCeiling, max( ( int ) ( NET_ADAPTIVE_RTT_TICKS / m_Latency.m_flRTT ), NET_TICKRATE_DEFAULT ) );
+
+	/* Speed up at once, slow down only after a few idle windows */
+	int nTickRate = m_nTickRate;
+
+	if ( m_nAdaptivePeakQueue >= NET_ADAPTIVE_BURST )
+		nTickRate = nCeiling;
+	else if ( m_nAdaptiveMessages > 0 )
+		nTickRate = max( nTickRate * 2, NET_TICKRATE_DEFAULT );
+	else if ( ++m_nAdaptiveIdleWindows > NET_ADAPTIVE_IDLE_WINDOWS )
+		nTickRate /= 2;
+
+	if ( m_nAdaptiveMessages > 0 )
+		m_nAdaptiveIdleWindows = 0;
+
+	nTickRate = max( min( nTickRate, nCeiling ), NET_TICKRATE_MIN );
+
+	m_nAdaptiveFrames = 0;
+	m_nAdaptiveMessages = 0;
+	m_nAdaptivePeakQueue = 0;
+	m_nRecvMessages = 0;
+
+	if ( nTickRate == m_nTickRate )
+		return;
+
+	/* Queued last, it goes out with this frame's flush and isn't counted next window */
+	m_nTickRate = nTickRate;
+
+	CSVCTickRate* pTickRate = new CSVCTickRate( this );
+	pTickRate->SetTickRate( nTickRate );
+	SendNetMessage( pTickRate );
 }
 
 void CBaseNetChannel::Disconnect( const char* pszReason )
@@ -788,6 +1505,9 @@ void CBaseNetChannel::Disconnect( const char* pszReason )
 	CNETDisconnect* pNETDisconnect = NULL;
 	{
 		CRITICAL_SECTION_AUTOLOCK( m_hResourceLock );
+		if ( m_hSocket != INVALID_SOCKET )
+			m_nFlags |= NET_DISCONNECT_LOCAL;
+
 		if ( pszReason && IsActiveSocket() && m_hSocket != INVALID_SOCKET )
 		{
 			strncpy( m_szDisconnectReason, pszReason, sizeof( m_szDisconnectReason ) );
@@ -798,6 +1518,10 @@ void CBaseNetChannel::Disconnect( const char* pszReason )
 	if( pNETDisconnect )
 		Transmit( pNETDisconnect );
 
+	/* Don't leave the reason for a frame that never comes */
+	if ( m_bIsServer )
+		FlushOutgoing();
+
 	CloseConnection();
 }
 
@@ -861,20 +1585,68 @@ void CBaseNetChannel::DisconnectInternal( CNETDisconnect* pNetDisconnect )
 
 long CBaseNetChannel::SendInternal( void* pBuf, unsigned long nSize )
 {
-	/* Create Header */
-	char* pMsg = new char[ nSize + PACKET_HEADER_LENGTH ];
-	( ( long* ) pMsg )[ 0 ] = m_nOutgoingSequenceNr;
-	( ( long* ) pMsg )[ 1 ] = nSize;
+	char* pMsg = m_pSendBuffer;
+	unsigned long nMsgSize = 0;
 
-	memcpy( ( void* ) ( pMsg + PACKET_HEADER_LENGTH ), pBuf, nSize );
+	if ( nSize > NET_TRANSFORM_CAPACITY )
+		return -1;
 
-	if ( send( m_hSocket, pMsg, nSize + PACKET_HEADER_LENGTH, 0 ) == SOCKET_ERROR )
+	if ( m_nOutgoingFeatures & NET_FEATURE_COMPACT_FRAMING )
 	{
-		delete[] pMsg;
-		return -1;
+		if ( nSize < PACKET_MANIFEST_SIZE )
+			return -1;
+
+		/* Compact header: payload length and type as varints, the sequence is implied */
+		unsigned long nPayloadSize = nSize - PACKET_MANIFEST_SIZE;
+
+		bf_write header;
+		header.Init( pMsg, PACKET_COMPACT_HEADER_MAX );
+		header.WriteVarInt32( nPayloadSize );
+		header.WriteVarInt32( ( ( long* ) pBuf )[ 0 ] );
+
+		memcpy( ( void* ) ( pMsg + header.GetNumBytesWritten() ), ( char* ) pBuf + PACKET_MANIFEST_SIZE, nPayloadSize );
+		nMsgSize = header.GetNumBytesWritten() + nPayloadSize;
+	}
+	else
+	{
+		/* Create Header */
+		( ( long* ) pMsg )[ 0 ] = m_nOutgoingSequenceNr;
+		( ( long* ) pMsg )[ 1 ] = nSize;
+
+		memcpy( ( void* ) ( pMsg + PACKET_HEADER_LENGTH ), pBuf, nSize );
+		nMsgSize = nSize + PACKET_HEADER_LENGTH;
+
+		if ( m_bLegacyTypes )
+			( ( long* ) pMsg )[ 2 ] = NET_TypeToLegacy( ( ( long* ) pBuf )[ 0 ] );
+	}
+
+	/* Trailer over the frame as it goes on the wire, after every transform */
+	if ( m_nOutgoingFeatures & NET_FEATURE_CHECKSUM )
+	{
+		unsigned int nCrc = ( unsigned int ) NET_Crc32C( pMsg, nMsgSize );
+		memcpy( pMsg + nMsgSize, &nCrc, PACKET_CHECKSUM_SIZE );
+		nMsgSize += PACKET_CHECKSUM_SIZE;
 	}
 
-	delete[] pMsg;
+	/* Two clock reads would cost more than the rest of the metrics, so only some sends are timed */
+	bool bTimed = ( m_nOutgoingSequenceNr & ( NET_SEND_TIME_SAMPLING - 1 ) ) == 0;
+	unsigned long long nSendStart = bTimed ? NET_GetTime() : 0;
+	int nResult = send( m_hSocket, pMsg, nMsgSize, 0 );
+
+	if ( bTimed )
+		m_Metrics.Record( NET_HISTOGRAM_SEND_TIME, NET_GetTime() - nSendStart );
+
+	m_Metrics.Add( NET_COUNTER_SEND_CALLS );
+
+	if ( nResult == SOCKET_ERROR )
+		return -1;
+
+	m_nBytesSent += nMsgSize;
+
+	m_Metrics.Add( NET_COUNTER_FRAMES_OUT );
+	m_Metrics.Add( NET_COUNTER_BYTES_OUT, nMsgSize );
+	m_Metrics.Record( NET_HISTOGRAM_FRAME_SIZE, nMsgSize );
+
 	return ++m_nOutgoingSequenceNr;
 }
 
@@ -905,8 +1677,11 @@ long CBaseNetChannel::RecvInternal( char** pBuf, unsigned long nSize )
 
 	m_nState = NET_RECEIVING;
 
-	/* Fetch the recv buffer */
-	( *pBuf ) = new char[ nSize + m_nRecvBackupLength ];
+	if ( nSize > NET_PAYLOAD_SIZE )
+		return -1;
+
+	/* Whatever was left of the last receive goes in front */
+	( *pBuf ) = m_pRecvBuffer;
 	memcpy( ( *pBuf ), m_pRecvBackup, m_nRecvBackupLength );
 
 	int nReceived = recv( m_hSocket, ( ( *pBuf ) + m_nRecvBackupLength ), nSize, 0 );
@@ -916,6 +1691,10 @@ long CBaseNetChannel::RecvInternal( char** pBuf, unsigned long nSize )
 
 	CRITICAL_SECTION_AUTOLOCK( m_hResourceLock );
 
+	/* Counted under the lock, the metrics have one writer at a time */
+	m_Metrics.Add( NET_COUNTER_RECV_CALLS );
+	m_Metrics.Add( NET_COUNTER_BYTES_IN, nReceived );
+
 	long nPreviousRecvLength = m_nRecvBackupLength;
 
 	memset( m_pRecvBackup, 0, sizeof( char ) * PACKET_BACKUP_LENGTH );
@@ -927,105 +1706,124 @@ long CBaseNetChannel::RecvInternal( char** pBuf, unsigned long nSize )
 		char* pData = ( char* ) ( *pBuf ) + nBytesSerialized;
 
 		long nDeltaBytes = ( nReceived - ( nBytesSerialized - nPreviousRecvLength ) );
-		if ( nDeltaBytes < ( long )( PACKET_HEADER_LENGTH + PACKET_MANIFEST_SIZE ) )
+
+		int nType = -1;
+		long nHeaderSize = 0;
+		long nLength = ProcessPacketHeader( pData, nDeltaBytes, &nType, &nHeaderSize );
+
+		if ( nLength == 0 )
 		{
+			/* Header split across reads */
+			if ( nDeltaBytes > PACKET_BACKUP_LENGTH )
+				return -1;
+
 			memcpy( m_pRecvBackup, pData, nDeltaBytes );
 			m_nRecvBackupLength = nDeltaBytes;
 
 			return m_nIncomingSequenceNr;
 		}
 
-		int nType = -1;
-		long nLength = ProcessPacketHeader( pData, nDeltaBytes, &nType );
-
-		if ( nLength <= 0 )
+		if ( nLength < 0 )
+		{
+			m_Metrics.Add( NET_COUNTER_DECODE_ERRORS );
 			return -1;
+		}
+
+		/* nLength counts the type manifest, which is part of the header in either framing */
+		long nFrameLength = nHeaderSize + nLength - PACKET_MANIFEST_SIZE;
+
+		if ( m_nIncomingFeatures & NET_FEATURE_CHECKSUM )
+			nFrameLength += PACKET_CHECKSUM_SIZE;
 
-		if ( nDeltaBytes < nLength + PACKET_HEADER_LENGTH )
+		if ( nDeltaBytes < nFrameLength )
 		{
+			/* Frames are bounded by ProcessPacketHeader, a partial one always fits */
+			if ( nDeltaBytes > PACKET_BACKUP_LENGTH )
+				return -1;
+
 			memcpy( m_pRecvBackup, pData, nDeltaBytes );
 			m_nRecvBackupLength = nDeltaBytes;
 
 			return --m_nIncomingSequenceNr;
 		}
 
-		if ( nLength + PACKET_HEADER_LENGTH > nReceived + nPreviousRecvLength )
+		if ( nFrameLength > nReceived + nPreviousRecvLength )
 			return -1;
 
+		if ( m_nIncomingFeatures & NET_FEATURE_CHECKSUM )
+		{
+			unsigned int nCrc = 0;
+			memcpy( &nCrc, pData + nFrameLength - PACKET_CHECKSUM_SIZE, PACKET_CHECKSUM_SIZE );
+
+			if ( nCrc != ( unsigned int ) NET_Crc32C( pData, nFrameLength - PACKET_CHECKSUM_SIZE ) )
+			{
+				m_Metrics.Add( NET_COUNTER_CHECKSUM_ERRORS );
+				strncpy( m_szDisconnectReason, "Frame checksum mismatch", sizeof( m_szDisconnectReason ) );
+				return -1;
+			}
+		}
+
 		if ( m_bIsServer )
 		{
 			if ( !m_bHasValidatedProtocol && nType != clc_Connect )
 				return -1;
 		}
 
-		char* pMessage = ( char* ) pData + PACKET_HEADER_LENGTH + PACKET_MANIFEST_SIZE;
+		if ( !IsValidMessageType( nType ) )
+		{
+			m_Metrics.Add( NET_COUNTER_DECODE_ERRORS );
+			return -1;
+		}
 
-		if ( m_IntermediateProxy )
-			m_IntermediateProxy->ProcessIncoming( pMessage, nLength - PACKET_MANIFEST_SIZE );
+		m_Metrics.Add( NET_COUNTER_FRAMES_IN );
 
-		/* DeSerialize */
-		INetMessage* pNetMessage = NULL;
+		char* pMessage = ( char* ) pData + nHeaderSize;
 
 		switch ( nType )
 		{
-		case net_Ping:
+		case net_Transfer:
 		{
-			pNetMessage = new CNETPing( this );
-
-			if ( !pNetMessage->DeSerialize( pMessage, nLength ) )
+			/* Chunked transfers arrive as ordinary frames */
+			if ( m_nIncomingFeatures & NET_FEATURE_CHUNKED_TRANSFER )
 			{
-				delete pNetMessage;
-				return -1;
-			}
-
-			break;
-		}
-		case net_Disconnect:
-		{
-			pNetMessage = new CNETDisconnect( this );
+				if ( !ProcessFrame( nType, pMessage, nLength ) )
+				{
+					m_Metrics.Add( NET_COUNTER_DECODE_ERRORS );
+					return -1;
+				}
 
-			if ( !pNetMessage->DeSerialize( pMessage, nLength ) )
-			{
-				delete pNetMessage;
-				return -1;
+				break;
 			}
 
-			break;
-		}
-		case net_HandlerMsg:
-		{
-			pNetMessage = new CNETHandlerMessage( this );
+			/* The transfer data follows the header as it is on the wire */
+			char* pTransmissionData = pData + nFrameLength;
 
-			if ( !pNetMessage->DeSerialize( pMessage, nLength ) )
+			if ( !TransformIncoming( nType, &pMessage, &nLength ) )
 			{
-				delete pNetMessage;
+				m_Metrics.Add( NET_COUNTER_DECODE_ERRORS );
 				return -1;
 			}
 
-			break;
-		}
-		case net_Transfer:
-		{
 			CNETDataTransmission* pTransmissionHeader = new CNETDataTransmission( this );
 
 			if ( !pTransmissionHeader->DeSerialize( pMessage, nLength ) )
 			{
+				m_Metrics.Add( NET_COUNTER_DECODE_ERRORS );
 				delete pTransmissionHeader;
 				return -1;
 			}
 
+			m_Metrics.Add( NET_COUNTER_MESSAGES_IN );
+
 			/*
-				Transfer block begin	=> pMessage + pTransmissionHeader->GetHeaderPacketSize() - PACKET_MANIFEST_SIZE;
+				Transfer block begin	=> pData + nFrameLength;
 				Transfer block size		=> min( nDataLeft, nTransmissionDelta )
 			*/
 
-			long nMessageOffset					= ( pTransmissionHeader->GetHeaderPacketSize() - PACKET_MANIFEST_SIZE );
-			char* pTransmissionData				= ( pMessage + nMessageOffset );
-
 			long nDataLeft						= pTransmissionHeader->GetTransmissionLength();
 			long nDataLength					= nDataLeft;
 
-			long nTransmissionDelta				= ( nReceived - ( nBytesSerialized + ( nMessageOffset ) + ( PACKET_MANIFEST_SIZE + PACKET_HEADER_LENGTH ) ) );
+			long nTransmissionDelta				= ( nReceived - ( nBytesSerialized + nFrameLength ) );
 			long nAbsTransmissionBlock			= min( nDataLeft, nTransmissionDelta );
 
 			if ( m_TransmissionProxy )
@@ -1034,7 +1832,9 @@ long CBaseNetChannel::RecvInternal( char** pBuf, unsigned long nSize )
 				m_TransmissionProxy( ( void* ) msg_props.GetData(), msg_props.GetNumBytesLeft(), nAbsTransmissionBlock, nDataLength );
 			}
 
-			char* pFileBuffer = new char[ nDataLength ];
+			char* pFileBuffer = ( char* ) NET_Alloc( nDataLength, NET_ALLOC_TRANSFER, this );
+			m_Metrics.Add( NET_COUNTER_ALLOCATIONS );
+
 			if ( pTransmissionHeader->Init( pFileBuffer, nDataLength ) )
 			{
 				memcpy( pFileBuffer, pTransmissionData, nAbsTransmissionBlock );
@@ -1045,13 +1845,17 @@ long CBaseNetChannel::RecvInternal( char** pBuf, unsigned long nSize )
 				{
 					int nDeltaTransfer = recv( m_hSocket, ( char * ) pFileBuffer + ( nDataLength - nDataLeft ), min( nDataLeft, PACKET_TRANSFER_MTU ), 0 );
 
+					m_Metrics.Add( NET_COUNTER_RECV_CALLS );
+
 					if ( nDeltaTransfer <= 0 )
 					{
-						delete[] pFileBuffer;
+						NET_Free( pFileBuffer, nDataLength, NET_ALLOC_TRANSFER, this );
 						delete pTransmissionHeader;
 						return -1;
 					}
 
+					m_Metrics.Add( NET_COUNTER_BYTES_IN, nDeltaTransfer );
+
 					if ( m_TransmissionProxy )
 					{
 						bf_read& msg_props = pTransmissionHeader->ReadProps();
@@ -1067,71 +1871,53 @@ long CBaseNetChannel::RecvInternal( char** pBuf, unsigned long nSize )
 
 			nBytesSerialized += nAbsTransmissionBlock;
 
-			delete[] pFileBuffer;
+			NET_Free( pFileBuffer, nDataLength, NET_ALLOC_TRANSFER, this );
 			delete pTransmissionHeader;
 			break;
 		}
-		default:
+		case net_Bundle:
 		{
-			if ( m_bIsServer )
-			{
-				switch ( nType )
-				{
-				case clc_Connect:
-				{
-					CCLCConnect* pCLCConnect = new CCLCConnect( this );
-
-					if ( !pCLCConnect->DeSerialize( pMessage, nLength ) )
-					{
-						delete pCLCConnect;
-						return -1;
-					}
-
-					long nProtoVersion = static_cast< CCLCConnect* >( pCLCConnect )->GetProtocolVersion();
-					long nProtoUid = static_cast< CCLCConnect* >( pCLCConnect )->GetProtocolUid();
-
-					m_bHasValidatedProtocol = ( nProtoVersion == ( NET_PROTOCOL_VERSION ^ NET_PROTOCOL_MASK ) ) && ( nProtoUid == NET_PROTOCOL_UID );
+			/* Unpack in place, the messages reference the receive buffer like plain frames */
+			bf_read bundle;
+			bundle.Init( pMessage, nLength - PACKET_MANIFEST_SIZE );
 
-					if ( !m_bHasValidatedProtocol )
-					{
-						delete pCLCConnect;
-						return -1;
-					}
+			while ( bundle.GetNumBytesLeft() > 0 )
+			{
+				unsigned long nSubLength = bundle.ReadVarInt32();
+				unsigned long nSubType = bundle.ReadVarInt32();
 
-					delete pCLCConnect;
-					break;
-				}
-				default:
+				if ( bundle.IsOverflowed() || nSubLength > bundle.GetNumBytesLeft() || !CNETBundle::IsBundleable( nSubType ) || !IsValidMessageType( nSubType ) )
+				{
+					m_Metrics.Add( NET_COUNTER_DECODE_ERRORS );
 					return -1;
 				}
-			}
-			else
-			{
-				switch ( nType )
-				{
-				case svc_Connect:
-					pNetMessage = new CSVCConnect( this );
 
-					if ( !pNetMessage->DeSerialize( pMessage, nLength ) )
-					{
-						delete pNetMessage;
-						return -1;
-					}
+				char* pSubMessage = ( char* ) bundle.GetData() + bundle.GetNumBytesRead();
 
-					break;
-				default:
+				if ( !ProcessFrame( nSubType, pSubMessage, nSubLength + PACKET_MANIFEST_SIZE ) )
+				{
+					m_Metrics.Add( NET_COUNTER_DECODE_ERRORS );
 					return -1;
 				}
+
+				bundle.SkipBytes( nSubLength );
 			}
 
 			break;
 		}
-		}
+		default:
+		{
+			if ( !ProcessFrame( nType, pMessage, nLength ) )
+			{
+				m_Metrics.Add( NET_COUNTER_DECODE_ERRORS );
+				return -1;
+			}
 
-		if ( pNetMessage )
-			m_RecvQueue.AddMessage( pNetMessage );
+			break;
+		}
+		}
 
-		nBytesSerialized += nLength + PACKET_HEADER_LENGTH;
+		nBytesSerialized += nFrameLength;
 
 		++nPacketsSerialized;
 	}
@@ -1143,7 +1929,451 @@ long CBaseNetChannel::RecvInternal( char** pBuf, unsigned long nSize )
 	return m_nIncomingSequenceNr;
 }
 
-void CBaseNetChannel::ProcessHandlerMessage( CNETHandlerMessage* pNetMessage )
+bool CBaseNetChannel::ProcessFrame( int nType, char* pMessage, long nLength )
+{
+	unsigned long long nTraceStart = NET_IsTracing() ? NET_GetTime() : 0;
+
+	/* Stateful transforms have to see every frame, so they run before the filter */
+	if ( !TransformIncoming( nType, &pMessage, &nLength ) )
+		return false;
+
+	m_Metrics.Add( NET_COUNTER_MESSAGES_IN );
+
+	/* Keepalives don't count as activity for the adaptive tickrate */
+	if ( nType != net_Ping )
+		++m_nRecvMessages;
+
+	/* Skip messages nobody consumes, timestamped pings feed the latency estimates regardless */
+	if ( !HasMessageConsumer( nType ) && !( nType == net_Ping && ( m_nIncomingFeatures & NET_FEATURE_PING_TIMESTAMPS ) ) )
+		return true;
+
+	unsigned long nTraceId = 0;
+
+	if ( nTraceStart )
+	{
+		nTraceId = ++m_nTraceIncoming;
+		NET_TraceEvent( NET_TRACE_PARSE, GetTraceChannel(), nTraceId, nType, nTraceStart );
+		nTraceStart = NET_GetTime();
+	}
+
+	switch ( nType )
+	{
+	case clc_Connect:
+	{
+		/* The handshake gates every following message, validate it in place */
+		if ( m_bHasValidatedProtocol )
+			return false;
+
+		CCLCConnect clc_connect( this );
+
+		if ( !clc_connect.DeSerialize( pMessage, nLength ) )
+			return false;
+
+		long nProtoVersion = clc_connect.GetProtocolVersion();
+		long nProtoUid = clc_connect.GetProtocolUid();
+
+		/* The numbering of the connect frame tells which version to expect */
+		long nExpectedVersion = m_bLegacyTypes ? NET_PROTOCOL_VERSION_LEGACY : NET_PROTOCOL_VERSION;
+
+		m_bHasValidatedProtocol = ( nProtoVersion == ( nExpectedVersion ^ NET_PROTOCOL_MASK ) ) && ( nProtoUid == NET_PROTOCOL_UID );
+
+		if ( !m_bHasValidatedProtocol )
+			return false;
+
+		/* The client holds further messages until our reply, so the */
+		/* negotiated framing applies from its next frame on */
+		unsigned long nFeatures = clc_connect.GetFeatures() & m_nFeatures;
+		unsigned long nDictionary = clc_connect.GetDictionary();
+
+		/* Any registered dictionary is accepted, otherwise compression goes on without one */
+		if ( !( nFeatures & NET_FEATURE_COMPRESSION ) || !NET_FindDictionary( nDictionary ) )
+			nDictionary = 0;
+
+		m_nSalt = NET_GenerateSalt();
+
+		if ( !ApplyFeatures( nFeatures, nDictionary, clc_connect.GetSalt(), m_nSalt ) )
+			return false;
+
+		m_nIncomingFeatures = m_nActiveFeatures;
+
+		/* Answer with only the fields the client knows about */
+		CSVCConnect* pSVCConnect = new CSVCConnect( this );
+		pSVCConnect->SetFieldCount( clc_connect.GetFieldCount() - 1 );
+		pSVCConnect->SetSalt( m_nSalt );
+		SendNetMessage( pSVCConnect );
+
+		if ( !IsConnected() )
+			return false;
+
+		break;
+	}
+	case svc_Connect:
+	{
+		/* Frames following the reply may already use the negotiated framing */
+		if ( m_bHasValidatedProtocol )
+			return false;
+
+		CSVCConnect svc_connect( this );
+
+		if ( !svc_connect.DeSerialize( pMessage, nLength ) )
+			return false;
+
+		svc_connect.ProcessMessage();
+
+		unsigned long nDictionary = svc_connect.GetDictionary();
+
+		/* The server can only pick the dictionary we offered */
+		if ( nDictionary && nDictionary != m_nDictionary )
+			return false;
+
+		if ( !ApplyFeatures( svc_connect.GetFeatures() & m_nFeatures, nDictionary, m_nSalt, svc_connect.GetSalt() ) )
+			return false;
+
+		m_nIncomingFeatures = m_nActiveFeatures;
+		m_nOutgoingFeatures = m_nActiveFeatures;
+
+		m_bHasValidatedProtocol = true;
+		m_bIsAwaitingConnect = false;
+		break;
+	}
+	case net_Ping:
+	{
+		/* Timestamped on arrival rather than when frames are dispatched */
+		CNETPing ping( this );
+
+		if ( !ping.DeSerialize( pMessage, nLength ) )
+			return false;
+
+		ProcessPing( &ping );
+		break;
+	}
+	case net_Transfer:
+	{
+		/* One transfer at a time, its data follows in net_TransferData frames */
+		if ( m_pIncomingTransfer )
+			return false;
+
+		CNETDataTransmission* pTransmissionHeader = new CNETDataTransmission( this );
+
+		if ( !pTransmissionHeader->DeSerialize( pMessage, nLength ) || pTransmissionHeader->GetTransmissionLength() <= 0 )
+		{
+			delete pTransmissionHeader;
+			return false;
+		}
+
+		long nDataLength = pTransmissionHeader->GetTransmissionLength();
+		pTransmissionHeader->Init( ( char* ) NET_Alloc( nDataLength, NET_ALLOC_TRANSFER, this ), nDataLength );
+
+		m_pIncomingTransfer = pTransmissionHeader;
+		m_nIncomingTransferOffset = 0;
+
+		if ( m_TransmissionProxy )
+		{
+			bf_read& msg_props = pTransmissionHeader->ReadProps();
+			m_TransmissionProxy( ( void* ) msg_props.GetData(), msg_props.GetNumBytesLeft(), 0, nDataLength );
+		}
+
+		break;
+	}
+	case net_TransferData:
+	{
+		CNETTransferData chunk( this );
+
+		if ( !m_pIncomingTransfer || !chunk.DeSerialize( pMessage, nLength ) )
+			return false;
+
+		long nDataLength = m_pIncomingTransfer->GetTransmissionLength();
+
+		if ( chunk.GetTransmissionId() != m_pIncomingTransfer->GetTransmissionId() || chunk.GetLength() > nDataLength - m_nIncomingTransferOffset )
+			return false;
+
+		memcpy( m_pIncomingTransfer->GetTransmissionData() + m_nIncomingTransferOffset, chunk.GetData(), chunk.GetLength() );
+		m_nIncomingTransferOffset += chunk.GetLength();
+
+		if ( m_TransmissionProxy )
+		{
+			bf_read& msg_props = m_pIncomingTransfer->ReadProps();
+			m_TransmissionProxy( ( void* ) msg_props.GetData(), msg_props.GetNumBytesLeft(), m_nIncomingTransferOffset, nDataLength );
+		}
+
+		if ( m_nIncomingTransferOffset < nDataLength )
+			break;
+
+		if ( m_MessageHandler )
+			m_MessageHandler( this, m_pIncomingTransfer );
+
+		EndIncomingTransmission();
+		break;
+	}
+	default:
+	{
+		/* Defer decoding until the frame is dispatched */
+		net_frame_t frame;
+		frame.m_nType		= nType;
+		frame.m_pData		= pMessage;
+		frame.m_nLength		= nLength;
+		frame.m_nTraceId	= nTraceId;
+
+		m_RecvFrames.push_back( frame );
+
+		/* Traced on as it is dispatched */
+		nTraceId = 0;
+		break;
+	}
+	}
+
+	/* The rest are handled right away */
+	if ( nTraceId )
+		NET_TraceEvent( NET_TRACE_DISPATCH, GetTraceChannel(), nTraceId, nType, nTraceStart, NET_GetTime() - nTraceStart );
+
+	return true;
+}
+
+CNETPing* CBaseNetChannel::CreatePing()
+{
+	CNETPing* pNETPing = new CNETPing( this );
+
+	if ( !( m_nOutgoingFeatures & NET_FEATURE_PING_TIMESTAMPS ) )
+	{
+		pNETPing->ClearTimestamps();
+		return pNETPing;
+	}
+
+	unsigned long long nNow = NET_GetTime();
+
+	/* Each ping of the peer is echoed once, so no round trip is counted twice */
+	pNETPing->SetTimestamps( nNow, m_nPingEchoTime, m_nPingEchoTime ? nNow - m_nPingEchoReceived : 0 );
+
+	m_nPingEchoTime = 0;
+	m_nNextPingTime = nNow + NET_PING_INTERVAL;
+	return pNETPing;
+}
+
+void CBaseNetChannel::ProcessPing( const CNETPing* pNetPing )
+{
+	if ( !pNetPing->HasTimestamps() )
+		return;
+
+	unsigned long long nNow = NET_GetTime();
+
+	m_nPingEchoTime = pNetPing->GetSendTime();
+	m_nPingEchoReceived = nNow;
+
+	/* The echo is our own send time, anything else is stale or bogus */
+	unsigned long long nEchoTime = pNetPing->GetEchoTime();
+
+	if ( !nEchoTime || nEchoTime > nNow || nNow - nEchoTime > NET_PING_ECHO_TIMEOUT )
+		return;
+
+	/* Four timestamps as in NTP: our send and receive, the peer's receive and send */
+	long long nHeld = ( long long ) pNetPing->GetEchoDelay();
+	long long nRoundTrip = ( long long ) ( nNow - nEchoTime ) - nHeld;
+
+	if ( nRoundTrip < 0 )
+		nRoundTrip = 0;
+
+	long long nPeerSend = ( long long ) pNetPing->GetSendTime();
+	long long nPeerRecv = nPeerSend - nHeld;
+
+	double flRTT = nRoundTrip * 1e-6;
+	double flOffset = ( ( nPeerRecv - ( long long ) nEchoTime ) + ( nPeerSend - ( long long ) nNow ) ) * 0.5e-6;
+
+	net_latency_stats_t& stats = m_Latency;
+
+	if ( !stats.m_nSamples )
+	{
+		stats.m_flRTT = flRTT;
+		stats.m_flRTTVariance = flRTT * 0.5;
+		stats.m_flMinRTT = flRTT;
+		stats.m_flJitter = 0.0;
+	}
+	else
+	{
+		stats.m_flRTTVariance = 0.75 * stats.m_flRTTVariance + 0.25 * fabs( stats.m_flRTT - flRTT );
+		stats.m_flRTT = 0.875 * stats.m_flRTT + 0.125 * flRTT;
+		stats.m_flMinRTT = min( stats.m_flMinRTT, flRTT );
+		stats.m_flJitter += ( fabs( flRTT - stats.m_flLastRTT ) - stats.m_flJitter ) / 16.0;
+	}
+
+	stats.m_flLastRTT = flRTT;
+	++stats.m_nSamples;
+
+	m_Metrics.Record( NET_HISTOGRAM_RTT, nRoundTrip );
+
+	/* Queueing delays skew the offset by up to half the round trip, so it */
+	/* follows the quickest recent exchange, the way NTP's clock filter does */
+	if ( flRTT <= m_flClockFilterRTT || ++m_nClockFilterAge >= NET_CLOCK_FILTER_SAMPLES )
+	{
+		stats.m_flClockOffset = flOffset;
+		m_flClockFilterRTT = flRTT;
+		m_nClockFilterAge = 0;
+	}
+}
+
+void CBaseNetChannel::ResetLatency()
+{
+	memset( &m_Latency, 0, sizeof( m_Latency ) );
+
+	m_nNextPingTime = 0;
+	m_nPingEchoTime = 0;
+	m_nPingEchoReceived = 0;
+	m_flClockFilterRTT = DBL_MAX;
+	m_nClockFilterAge = 0;
+}
+
+bool CBaseNetChannel::ApplyFeatures( unsigned long nFeatures, unsigned long nDictionary, unsigned long long nClientSalt, unsigned long long nServerSalt )
+{
+	m_nActiveFeatures = nFeatures;
+	m_nActiveDictionary = 0;
+
+	/* A keyed channel never falls back to plaintext */
+	if ( m_bHasEncryptionKey && !( nFeatures & NET_FEATURE_ENCRYPTION ) )
+		return false;
+
+	/* Raw transfer streams bypass the transforms, encrypted ones have to go in frames */
+	if ( ( nFeatures & NET_FEATURE_ENCRYPTION ) && !( nFeatures & NET_FEATURE_CHUNKED_TRANSFER ) )
+		return false;
+
+	if ( nFeatures & NET_FEATURE_ENCRYPTION )
+	{
+		if ( !m_pCipher )
+			m_pCipher = NET_New< CNetCipher >( NET_ALLOC_CHANNEL, this );
+
+		m_pCipher->SetKey( m_EncryptionKey, nClientSalt, nServerSalt, m_bIsServer );
+	}
+
+	if ( !( m_nActiveFeatures & NET_FEATURE_COMPRESSION ) )
+		return ( nDictionary == 0 );
+
+	const net_dictionary_t* pDictionary = NULL;
+
+	if ( nDictionary )
+	{
+		pDictionary = NET_FindDictionary( nDictionary );
+
+		if ( !pDictionary )
+			return false;
+
+		m_nActiveDictionary = nDictionary;
+	}
+
+	if ( !m_pCompressor )
+		m_pCompressor = NET_New< CNetCompressor >( NET_ALLOC_CHANNEL, this, ( INetChannel* ) this );
+
+	m_pCompressor->SetDictionary( pDictionary );
+	return true;
+}
+
+long CBaseNetChannel::TransformOutgoing( char* pData, long nLength, long nCapacity )
+{
+	char* pPayload = pData + PACKET_MANIFEST_SIZE;
+	long nPayloadLength = nLength - PACKET_MANIFEST_SIZE;
+	long nPayloadCapacity = nCapacity - PACKET_MANIFEST_SIZE;
+
+	if ( nPayloadLength < 0 )
+		return -1;
+
+	/* Compress first, there is nothing left to compress once encrypted */
+	if ( m_nOutgoingFeatures & NET_FEATURE_COMPRESSION )
+	{
+		nPayloadLength = m_pCompressor->TransformOutgoing( pPayload, nPayloadLength, nPayloadCapacity );
+
+		if ( nPayloadLength < 0 )
+			return -1;
+	}
+
+	if ( m_nOutgoingFeatures & NET_FEATURE_ENCRYPTION )
+	{
+		/* The tag covers the type and length as well, neither is encrypted */
+		unsigned int aad[ 2 ] = { ( unsigned int ) ( ( long* ) pData )[ 0 ], ( unsigned int ) nPayloadLength };
+		nPayloadLength = m_pCipher->TransformOutgoing( pPayload, nPayloadLength, nPayloadCapacity, aad, sizeof( aad ) );
+
+		if ( nPayloadLength < 0 )
+			return -1;
+	}
+
+	if ( m_IntermediateProxy )
+	{
+		if ( !m_IntermediateProxy->IsLengthChanging() )
+			m_IntermediateProxy->ProcessOutgoing( pPayload, nPayloadLength );
+		else
+			nPayloadLength = m_IntermediateProxy->TransformOutgoing( pPayload, nPayloadLength, nPayloadCapacity );
+
+		if ( nPayloadLength < 0 )
+			return -1;
+	}
+
+	return PACKET_MANIFEST_SIZE + nPayloadLength;
+}
+
+bool CBaseNetChannel::TransformIncoming( int nType, char** ppMessage, long* pLength )
+{
+	long nPayloadLength = *pLength - PACKET_MANIFEST_SIZE;
+
+	if ( m_IntermediateProxy )
+	{
+		if ( !m_IntermediateProxy->IsLengthChanging() )
+		{
+			m_IntermediateProxy->ProcessIncoming( *ppMessage, nPayloadLength );
+		}
+		else
+		{
+			char* pOut = AllocRecvScratch();
+			nPayloadLength = m_IntermediateProxy->TransformIncoming( *ppMessage, nPayloadLength, pOut, NET_TRANSFORM_CAPACITY );
+			*ppMessage = pOut;
+		}
+
+		if ( nPayloadLength < 0 )
+			return false;
+	}
+
+	if ( m_nIncomingFeatures & NET_FEATURE_ENCRYPTION )
+	{
+		unsigned int aad[ 2 ] = { ( unsigned int ) nType, ( unsigned int ) ( nPayloadLength - CNetCipher::TAG_SIZE ) };
+
+		char* pOut = AllocRecvScratch();
+		nPayloadLength = m_pCipher->TransformIncoming( *ppMessage, nPayloadLength, pOut, NET_TRANSFORM_CAPACITY, aad, sizeof( aad ) );
+		*ppMessage = pOut;
+
+		if ( nPayloadLength < 0 )
+			return false;
+	}
+
+	if ( m_nIncomingFeatures & NET_FEATURE_COMPRESSION )
+	{
+		char* pOut = AllocRecvScratch();
+		nPayloadLength = m_pCompressor->TransformIncoming( *ppMessage, nPayloadLength, pOut, NET_TRANSFORM_CAPACITY );
+		*ppMessage = pOut;
+
+		if ( nPayloadLength < 0 )
+			return false;
+	}
+
+	*pLength = PACKET_MANIFEST_SIZE + nPayloadLength;
+	return true;
+}
+
+char* CBaseNetChannel::AllocRecvScratch()
+{
+	net_scratch_t scratch;
+	scratch.m_pData = BitBuf_GetDefaultPool()->Alloc( NET_TRANSFORM_CAPACITY, &scratch.m_nCapacity );
+
+	m_RecvScratch.push_back( scratch );
+	m_Metrics.Add( NET_COUNTER_ALLOCATIONS );
+
+	return ( char* ) scratch.m_pData;
+}
+
+void CBaseNetChannel::ReleaseRecvScratch()
+{
+	int c = m_RecvScratch.size();
+	for ( int i = 0; i < c; ++i )
+		BitBuf_GetDefaultPool()->Free( m_RecvScratch[ i ].m_pData, m_RecvScratch[ i ].m_nCapacity );
+
+	m_RecvScratch.clear();
+}
+
+void CBaseNetChannel::ProcessHandlerMessage( INetMessage* pNetMessage )
 {
 	if ( !m_MessageHandler )
 	{
@@ -1156,10 +2386,84 @@ void CBaseNetChannel::ProcessHandlerMessage( CNETHandlerMessage* pNetMessage )
 	m_MessageHandler( this, pNetMessage );
 }
 
-long CBaseNetChannel::ProcessPacketHeader( void* pBuf, unsigned long nSize, int* pType )
+bool CBaseNetChannel::DispatchFrames()
+{
+	int c = m_RecvFrames.size();
+	for ( int i = 0; i < c; ++i )
+	{
+		const net_frame_t& frame = m_RecvFrames[ i ];
+
+		/* Frames parsed before tracing was switched on have no id */
+		bool bTrace = frame.m_nTraceId && NET_IsTracing();
+		unsigned long long nTraceStart = bTrace ? NET_GetTime() : 0;
+
+		INetMessage* pNetMessage = g_MessageRegistry[ frame.m_nType ].m_pfnFactory( this );
+		m_Metrics.Add( NET_COUNTER_ALLOCATIONS );
+
+		if ( !pNetMessage || !pNetMessage->DeSerialize( frame.m_pData, frame.m_nLength ) )
+		{
+			m_Metrics.Add( NET_COUNTER_DECODE_ERRORS );
+
+			if ( pNetMessage )
+				delete pNetMessage;
+
+			m_RecvFrames.clear();
+			return false;
+		}
+
+		if ( bTrace )
+		{
+			unsigned long long nNow = NET_GetTime();
+			NET_TraceEvent( NET_TRACE_DECODE, GetTraceChannel(), frame.m_nTraceId, frame.m_nType, nTraceStart, nNow - nTraceStart );
+			nTraceStart = nNow;
+		}
+
+		pNetMessage->ProcessMessage();
+
+		if ( bTrace )
+			NET_TraceEvent( NET_TRACE_DISPATCH, GetTraceChannel(), frame.m_nTraceId, frame.m_nType, nTraceStart, NET_GetTime() - nTraceStart );
+
+		delete pNetMessage;
+
+		/* We might disconnect while processing a handler message */
+		/* Make sure we are still connected to continue processing messages */
+		if ( !IsConnected() )
+			break;
+	}
+
+	m_RecvFrames.clear();
+	return true;
+}
+
+long CBaseNetChannel::ProcessPacketHeader( void* pBuf, unsigned long nSize, int* pType, long* pHeaderSize )
 {
+	if ( m_nIncomingFeatures & NET_FEATURE_COMPACT_FRAMING )
+	{
+		bf_read header;
+		header.Init( pBuf, min( nSize, PACKET_COMPACT_HEADER_MAX ) );
+
+		unsigned long nPayloadSize = header.ReadVarInt32();
+		unsigned long nType = header.ReadVarInt32();
+
+		/* Two varints never exceed PACKET_COMPACT_HEADER_MAX, so this is a partial header */
+		if ( header.IsOverflowed() )
+			return 0;
+
+		/* Nothing larger is ever sent, see SendInternal */
+		if ( nPayloadSize > NET_TRANSFORM_CAPACITY )
+			return -1;
+
+		++m_nIncomingSequenceNr;
+
+		if ( pType )
+			*pType = ( nType < NET_MESSAGE_TYPES_MAX ) ? ( int ) nType : -1;
+
+		*pHeaderSize = header.GetNumBytesRead();
+		return nPayloadSize + PACKET_MANIFEST_SIZE;
+	}
+
 	if ( nSize < PACKET_HEADER_LENGTH + PACKET_MANIFEST_SIZE )
-		return -1;
+		return 0;
 
 	long nIncomingAck = ( ( long* ) pBuf )[ 0 ];
 
@@ -1176,11 +2480,20 @@ long CBaseNetChannel::ProcessPacketHeader( void* pBuf, unsigned long nSize, int*
 	long nIncomingSize = ( ( long* ) pBuf )[ 1 ];
 
 	if ( pType )
-		*pType = ( ( int* ) pBuf )[ 2 ];
+	{
+		int nWireType = ( ( int* ) pBuf )[ 2 ];
+
+		/* Until the handshake a server learns the numbering from the client's connect frame */
+		if ( m_bIsServer && !m_bHasValidatedProtocol )
+			m_bLegacyTypes = ( nWireType == NET_LEGACY_clc_Connect );
 
-	if ( nIncomingSize <= 0 )
+		*pType = m_bLegacyTypes ? NET_TypeFromLegacy( nWireType ) : nWireType;
+	}
+
+	if ( nIncomingSize <= 0 || nIncomingSize > NET_TRANSFORM_CAPACITY )
 		return -1;
 
+	*pHeaderSize = PACKET_HEADER_LENGTH + PACKET_MANIFEST_SIZE;
 	return nIncomingSize;
 }
 
@@ -1221,19 +2534,234 @@ void CNetMessageQueue::ReleaseQueue()
 	m_Queue.clear();
 }
 
+void CNetMessageQueue::ReleaseMessages( int nCount )
+{
+	CRITICAL_SECTION_AUTOLOCK( m_hQueueLock );
+
+	int c = min( nCount, ( int ) m_Queue.size() );
+	for ( int i = 0; i < c; ++i )
+		delete m_Queue[ i ];
+
+	m_Queue.erase( m_Queue.begin(), m_Queue.begin() + c );
+}
+
 DWORD WINAPI NET_ProcessSocket( LPVOID lp )
 {
 	CBaseNetChannel* pNetChannel = ( CBaseNetChannel* ) lp;
 
+	CNetTickScheduler* pScheduler = pNetChannel->GetTickScheduler();
+	pScheduler->Start( pNetChannel->GetTickRate() );
+
 	while ( pNetChannel->ProcessSocket() )
-		Sleep( static_cast< int >( ( 1.0f / ( float ) pNetChannel->GetTickRate() ) * 1000.0f ) );
+	{
+		unsigned long long nTraceStart = NET_IsTracing() ? NET_GetTime() : 0;
 
+		pScheduler->WaitForNextTick( pNetChannel->GetTickRate() );
+
+		if ( nTraceStart )
+			NET_TraceEvent( NET_TRACE_WAIT, pNetChannel->GetTraceChannel(), 0, -1, nTraceStart, NET_GetTime() - nTraceStart );
+	}
+
+	pScheduler->Stop();
 	pNetChannel->CloseConnection();
 	return 0;
 }
 
-bool NET_StartUp()
+/* Sends the listen channels' queues, shared fairly when the egress limit can't cover them all */
+static void NET_FlushListenChannels()
+{
+	int c = g_ListenChannels.size();
+
+	g_EgressLimit.Refill();
+
+	if ( !g_EgressLimit.IsLimited() )
+	{
+		for ( int i = 0; i < c; ++i )
+			g_ListenChannels[ i ]->FlushOutgoing();
+
+		return;
+	}
+
+	/* Control messages go out whatever the budget, a zero budget sends nothing else. */
+	/* They're charged with the rest below, and the bucket's debt holds back later rounds */
+	long nTotalSent = 0;
+
+	for ( int i = 0; i < c; ++i )
+		nTotalSent += g_ListenChannels[ i ]->FlushOutgoing( 0 );
+
+	/* Deficit round robin: each round every channel with data is granted a quantum, */
+	/* what a channel sends past its deficit is carried as debt into the next round */
+	long nBudget = g_EgressLimit.GetTokens();
+
+	for ( bool bProgress = true; bProgress && nTotalSent < nBudget; )
+	{
+		bProgress = false;
+
+		int nActive = 0;
+		for ( int i = 0; i < c; ++i )
+		{
+			if ( g_ListenChannels[ i ]->HasOutgoing() )
+				++nActive;
+			else
+				g_ListenChannels[ i ]->SetDeficit( 0 );
+		}
+
+		if ( !nActive )
+			break;
+
+		long nQuantum = max( ( nBudget - nTotalSent ) / nActive, ( long ) PACKET_TRANSFER_MTU );
+
+		for ( int n = 0; n < c && nTotalSent < nBudget; ++n )
+		{
+			/* Rotate the first channel served so no one always goes last */
+			CBaseNetChannel* pNetChannel = g_ListenChannels[ ( g_nEgressRound + n ) % c ];
+
+			if ( !pNetChannel->HasOutgoing() )
+				continue;
+
+			long nDeficit = pNetChannel->GetDeficit() + nQuantum;
+
+			if ( nDeficit <= 0 )
+			{
+				pNetChannel->SetDeficit( nDeficit );
+				bProgress = true;
+				continue;
+			}
+
+			long nSent = pNetChannel->FlushOutgoing( min( nDeficit, nBudget - nTotalSent ) );
+
+			/* A grant the channel couldn't use, held back by its own limit, isn't banked */
+			pNetChannel->SetDeficit( nSent ? nDeficit - nSent : nDeficit - nQuantum );
+			nTotalSent += nSent;
+
+			if ( nSent > 0 )
+				bProgress = true;
+		}
+	}
+
+	g_EgressLimit.Consume( nTotalSent );
+	++g_nEgressRound;
+}
+
+void NET_SetEgressLimit( unsigned long nBytesPerSecond )
+{
+	CRITICAL_SECTION_AUTOLOCK( g_hListenChannelLock );
+	g_EgressLimit.SetRate( nBytesPerSecond );
+}
+
+/* Busy share of all cores since the previous sample */
+static double NET_SampleCpuLoad( unsigned long long* pLastIdle, unsigned long long* pLastTotal )
+{
+	FILETIME idle, kernel, user;
+	if ( !GetSystemTimes( &idle, &kernel, &user ) )
+		return 0.0;
+
+	/* Kernel time includes the idle time */
+	unsigned long long nIdle = ( ( unsigned long long ) idle.dwHighDateTime << 32 ) | idle.dwLowDateTime;
+	unsigned long long nTotal = ( ( ( unsigned long long ) kernel.dwHighDateTime << 32 ) | kernel.dwLowDateTime )
+		+ ( ( ( unsigned long long ) user.dwHighDateTime << 32 ) | user.dwLowDateTime );
+
+	unsigned long long nIdleDelta = nIdle - *pLastIdle;
+	unsigned long long nTotalDelta = nTotal - *pLastTotal;
+
+	*pLastIdle = nIdle;
+	*pLastTotal = nTotal;
+
+	if ( !nTotalDelta || nIdleDelta > nTotalDelta )
+		return 0.0;
+
+	return 1.0 - ( double ) nIdleDelta / ( double ) nTotalDelta;
+}
+
+DWORD WINAPI NET_ProcessServerSockets( LPVOID lp )
+{
+	NetSocketInfo_t* pSocketInfo = ( NetSocketInfo_t* ) lp;
+
+	CNetTickScheduler scheduler;
+	scheduler.Start( pSocketInfo->m_nTickRate );
+
+	int nWindowFrames = max( pSocketInfo->m_nTickRate / NET_ADAPTIVE_WINDOWS_PER_SEC, 1 );
+	int nFrame = 0;
+
+	/* Fastest rate adaptive clients get, lowered while the server is short of CPU */
+	int nCeiling = NET_TICKRATE_MAX;
+	double flLastWorkTime = 0.0;
+	unsigned long long nLastIdle = 0, nLastTotal = 0;
+
+	NET_SampleCpuLoad( &nLastIdle, &nLastTotal );
+
+	while ( pSocketInfo->m_bRunning )
+	{
+		/* The application queues this frame's updates... */
+		if ( pSocketInfo->m_pRunFrame )
+			pSocketInfo->m_pRunFrame();
+
+		/* ...and every client gets them in the same pass */
+		{
+			CRITICAL_SECTION_AUTOLOCK( g_hListenChannelLock );
+
+			int c = g_ListenChannels.size();
+			for ( int i = 0; i < c; ++i )
+				g_ListenChannels[ i ]->UpdateTickRate( nWindowFrames, nCeiling );
+
+			NET_FlushListenChannels();
+		}
+
+		if ( ++nFrame >= nWindowFrames )
+		{
+			net_tick_stats_t stats;
+			scheduler.GetStats( &stats );
+
+			/* Busy share of the frame interval, or of the machine, whichever is higher */
+			double flLoad = ( stats.m_flWorkTime - flLastWorkTime ) * pSocketInfo->m_nTickRate / nFrame;
+			flLoad = max( flLoad, NET_SampleCpuLoad( &nLastIdle, &nLastTotal ) );
+
+			if ( flLoad > 0.75 )
+				nCeiling = max( nCeiling / 2, NET_TICKRATE_MIN );
+			else if ( flLoad < 0.5 )
+				nCeiling = min( nCeiling * 2, NET_TICKRATE_MAX );
+
+			flLastWorkTime = stats.m_flWorkTime;
+			nFrame = 0;
+		}
+
+		unsigned long long nTraceStart = NET_IsTracing() ? NET_GetTime() : 0;
+
+		scheduler.WaitForNextTick( pSocketInfo->m_nTickRate );
+
+		if ( nTraceStart )
+			NET_TraceEvent( NET_TRACE_WAIT, 0, 0, -1, nTraceStart, NET_GetTime() - nTraceStart );
+	}
+
+	scheduler.Stop();
+	return 0;
+}
+
+bool NET_RegisterMessage( int nType, NetMessageFactoryFn pfnFactory, unsigned long nFlags )
+{
+	/* Protocol message types are reserved */
+	if ( nType < net_UserMessage || nType >= NET_MESSAGE_TYPES_MAX )
+		return false;
+
+	if ( !pfnFactory )
+		return false;
+
+	g_MessageRegistry[ nType ].m_pfnFactory	= pfnFactory;
+	g_MessageRegistry[ nType ].m_nFlags		= nFlags;
+	return true;
+}
+
+static void NET_RegisterProtocolMessage( int nType, NetMessageFactoryFn pfnFactory, unsigned long nFlags )
 {
+	g_MessageRegistry[ nType ].m_pfnFactory	= pfnFactory;
+	g_MessageRegistry[ nType ].m_nFlags		= nFlags;
+}
+
+bool NET_StartUp( INetAllocator* pAllocator )
+{
+	if ( !NET_SetAllocator( pAllocator ) )
+		return false;
+
 	WSADATA wsaData;
 	if ( WSAStartup( MAKEWORD( 2, 2 ), &wsaData ) )
 		return false;
@@ -1244,6 +2772,16 @@ bool NET_StartUp()
 	InitializeCriticalSection( &g_hNotificationLock );
 #endif
 
+	NET_RegisterProtocolMessage( clc_Connect,		&NET_CreateMessage< CCLCConnect >,				NET_MSG_FROM_CLIENT | NET_MSG_REQUIRED );
+	NET_RegisterProtocolMessage( svc_Connect,		&NET_CreateMessage< CSVCConnect >,				NET_MSG_FROM_SERVER | NET_MSG_REQUIRED );
+	NET_RegisterProtocolMessage( net_Ping,			&NET_CreateMessage< CNETPing >,					NET_MSG_FROM_CLIENT | NET_MSG_FROM_SERVER );
+	NET_RegisterProtocolMessage( net_Disconnect,	&NET_CreateMessage< CNETDisconnect >,			NET_MSG_FROM_CLIENT | NET_MSG_FROM_SERVER | NET_MSG_REQUIRED );
+	NET_RegisterProtocolMessage( net_HandlerMsg,	&NET_CreateMessage< CNETHandlerMessage >,		NET_MSG_DEFAULT );
+	NET_RegisterProtocolMessage( net_Transfer,		&NET_CreateMessage< CNETDataTransmission >,		NET_MSG_FROM_CLIENT | NET_MSG_FROM_SERVER | NET_MSG_REQUIRED );
+	NET_RegisterProtocolMessage( net_TransferData,	&NET_CreateMessage< CNETTransferData >,			NET_MSG_FROM_CLIENT | NET_MSG_FROM_SERVER | NET_MSG_REQUIRED );
+	NET_RegisterProtocolMessage( svc_TickRate,		&NET_CreateMessage< CSVCTickRate >,				NET_MSG_FROM_SERVER | NET_MSG_REQUIRED );
+	NET_RegisterProtocolMessage( net_Bundle,		&NET_CreateMessage< CNETBundle >,				NET_MSG_FROM_CLIENT | NET_MSG_FROM_SERVER | NET_MSG_REQUIRED );
+
 	g_bIsNetInitialized = true;
 	return true;
 }
@@ -1272,7 +2810,7 @@ void NET_Shutdown()
 
 INetChannel* NET_CreateChannel()
 {
-	CBaseNetChannel* pNetChannel = new CBaseNetChannel();
+	CBaseNetChannel* pNetChannel = NET_New< CBaseNetChannel >( NET_ALLOC_CHANNEL, NULL );
 	return pNetChannel;
 }
 
@@ -1288,8 +2826,10 @@ void NET_DestroyChannel( INetChannel* pNetChannel )
 		}
 	}
 
-	static_cast< CBaseNetChannel* >( pNetChannel )->CloseConnection();
-	delete pNetChannel;
+	CBaseNetChannel* pBaseChannel = static_cast< CBaseNetChannel* >( pNetChannel );
+
+	pBaseChannel->CloseConnection();
+	NET_Delete( pBaseChannel, NET_ALLOC_CHANNEL, NULL );
 }
 
 bool NET_ProcessListenSocket( const char* pszPort, int nTickRate, ServerRunFrameFn pfnPerFrame, ServerConnectionNotifyFn pfnNotify, INetIntermediateContext* pContext )
@@ -1328,12 +2868,19 @@ bool NET_ProcessListenSocket( const char* pszPort, int nTickRate, ServerRunFrame
 
 	nTickRate = max( min( nTickRate, NET_TICKRATE_MAX ), NET_TICKRATE_MIN );
 
-	//NetSocketInfo_t nSocketInfo;
-	//nSocketInfo.m_nTickRate = nTickRate;
-	//nSocketInfo.m_pRunFrame = pfnPerFrame;
+	NetSocketInfo_t nSocketInfo;
+	nSocketInfo.m_nTickRate = nTickRate;
+	nSocketInfo.m_pRunFrame = pfnPerFrame;
+	nSocketInfo.m_bRunning = true;
 
-	//DWORD dwNetworkThreadId;
-	//HANDLE hNetworkThread = CreateThread( NULL, NULL, &NET_ProcessServerSockets, &nSocketInfo, NULL, &dwNetworkThreadId );
+	DWORD dwNetworkThreadId;
+	HANDLE hNetworkThread = CreateThread( NULL, NULL, &NET_ProcessServerSockets, &nSocketInfo, NULL, &dwNetworkThreadId );
+
+	if ( !hNetworkThread )
+	{
+		closesocket( hListenSocket );
+		return false;
+	}
 
 	while ( listen( hListenSocket, SOMAXCONN ) != SOCKET_ERROR )
 	{
@@ -1368,7 +2915,9 @@ bool NET_ProcessListenSocket( const char* pszPort, int nTickRate, ServerRunFrame
 		}
 	}
 
-	//TerminateThread( hNetworkThread, 0 );
+	nSocketInfo.m_bRunning = false;
+	WaitForSingleObject( hNetworkThread, INFINITE );
+	CloseHandle( hNetworkThread );
 
 	{
 		CRITICAL_SECTION_AUTOLOCK( g_hListenChannelLock );
@@ -0,0 +1,155 @@
+#include "string.h"
+#include "Inc/Checksum.h"
+
+/* MSVC emits crc32 for any x86 target, GCC and Clang only when built for SSE4.2 */
+#if defined( _MSC_VER ) && ( defined( _M_IX86 ) || defined( _M_X64 ) )
+#include "nmmintrin.h"
+#include "intrin.h"
+#define CRC32C_HARDWARE
+#elif defined( __SSE4_2__ ) && ( defined( __i386__ ) || defined( __x86_64__ ) )
+#include "nmmintrin.h"
+#include "cpuid.h"
+#define CRC32C_HARDWARE
+#endif
+
+#define CRC32C_POLYNOMIAL	0x82F63B78	/* Castagnoli, reflected */
+#define CRC32C_STRIPE		256			/* Bytes per stripe of the interleaved loop */
+
+struct crc32c_tables_t
+{
+	crc32c_tables_t();
+
+	unsigned int			m_Slice[ 8 ][ 256 ];
+
+	/* Advancing a crc over CRC32C_STRIPE zero bytes, one table per byte of the crc */
+	unsigned int			m_Shift[ 4 ][ 256 ];
+
+	bool					m_bHardware;
+};
+
+static unsigned int Crc32C_Portable( const crc32c_tables_t& tables, unsigned int nCrc, const unsigned char* pData, unsigned long nLength )
+{
+	const unsigned int ( *t )[ 256 ] = tables.m_Slice;
+
+	for ( ; nLength >= 8; nLength -= 8, pData += 8 )
+	{
+		unsigned int nLow, nHigh;
+		memcpy( &nLow, pData, 4 );
+		memcpy( &nHigh, pData + 4, 4 );
+		nLow ^= nCrc;
+
+		nCrc = t[ 7 ][ nLow & 0xFF ] ^ t[ 6 ][ ( nLow >> 8 ) & 0xFF ] ^ t[ 5 ][ ( nLow >> 16 ) & 0xFF ] ^ t[ 4 ][ nLow >> 24 ]
+			^ t[ 3 ][ nHigh & 0xFF ] ^ t[ 2 ][ ( nHigh >> 8 ) & 0xFF ] ^ t[ 1 ][ ( nHigh >> 16 ) & 0xFF ] ^ t[ 0 ][ nHigh >> 24 ];
+	}
+
+	for ( ; nLength; --nLength )
+		nCrc = t[ 0 ][ ( nCrc ^ *pData++ ) & 0xFF ] ^ ( nCrc >> 8 );
+
+	return nCrc;
+}
+
+crc32c_tables_t::crc32c_tables_t()
+{
+	for ( unsigned int n = 0; n < 256; ++n )
+	{
+		unsigned int nCrc = n;
+		for ( int i = 0; i < 8; ++i )
+			nCrc = ( nCrc & 1 ) ? ( nCrc >> 1 ) ^ CRC32C_POLYNOMIAL : nCrc >> 1;
+
+		m_Slice[ 0 ][ n ] = nCrc;
+	}
+
+	for ( unsigned int n = 0; n < 256; ++n )
+	{
+		for ( int i = 1; i < 8; ++i )
+			m_Slice[ i ][ n ] = ( m_Slice[ i - 1 ][ n ] >> 8 ) ^ m_Slice[ 0 ][ m_Slice[ i - 1 ][ n ] & 0xFF ];
+	}
+
+	/* The crc is linear, so shifting it is the xor of its shifted bytes */
+	unsigned char zeros[ CRC32C_STRIPE ];
+	memset( zeros, 0, sizeof( zeros ) );
+
+	for ( int i = 0; i < 4; ++i )
+	{
+		for ( unsigned int n = 0; n < 256; ++n )
+			m_Shift[ i ][ n ] = Crc32C_Portable( *this, n << ( i * 8 ), zeros, CRC32C_STRIPE );
+	}
+
+	m_bHardware = false;
+
+#if defined( CRC32C_HARDWARE ) && defined( _MSC_VER )
+	int info[ 4 ];
+	__cpuid( info, 1 );
+	m_bHardware = ( info[ 2 ] & ( 1 << 20 ) ) != 0;
+#elif defined( CRC32C_HARDWARE )
+	unsigned int nEax, nEbx, nEcx, nEdx;
+	m_bHardware = __get_cpuid( 1, &nEax, &nEbx, &nEcx, &nEdx ) && ( nEcx & ( 1 << 20 ) ) != 0;
+#endif
+}
+
+static const crc32c_tables_t& Crc32C_GetTables()
+{
+	static crc32c_tables_t tables;
+	return tables;
+}
+
+#ifdef CRC32C_HARDWARE
+__forceinline unsigned int Crc32C_Step8( unsigned int nCrc, const unsigned char* pData )
+{
+#if defined( _M_X64 ) || defined( __x86_64__ )
+	unsigned long long nWord;
+	memcpy( &nWord, pData, 8 );
+	return ( unsigned int ) _mm_crc32_u64( nCrc, nWord );
+#else
+	unsigned int nLow, nHigh;
+	memcpy( &nLow, pData, 4 );
+	memcpy( &nHigh, pData + 4, 4 );
+	return _mm_crc32_u32( _mm_crc32_u32( nCrc, nLow ), nHigh );
+#endif
+}
+
+__forceinline unsigned int Crc32C_Shift( const crc32c_tables_t& tables, unsigned int nCrc )
+{
+	return tables.m_Shift[ 0 ][ nCrc & 0xFF ] ^ tables.m_Shift[ 1 ][ ( nCrc >> 8 ) & 0xFF ]
+		^ tables.m_Shift[ 2 ][ ( nCrc >> 16 ) & 0xFF ] ^ tables.m_Shift[ 3 ][ nCrc >> 24 ];
+}
+
+static unsigned int Crc32C_Hardware( const crc32c_tables_t& tables, unsigned int nCrc, const unsigned char* pData, unsigned long nLength )
+{
+	/* crc32 has a latency of three cycles but issues every cycle, three independent stripes keep it busy */
+	for ( ; nLength >= CRC32C_STRIPE * 3; nLength -= CRC32C_STRIPE * 3, pData += CRC32C_STRIPE * 3 )
+	{
+		unsigned int nCrc0 = nCrc, nCrc1 = 0, nCrc2 = 0;
+
+		for ( int i = 0; i < CRC32C_STRIPE; i += 8 )
+		{
+			nCrc0 = Crc32C_Step8( nCrc0, pData + i );
+			nCrc1 = Crc32C_Step8( nCrc1, pData + CRC32C_STRIPE + i );
+			nCrc2 = Crc32C_Step8( nCrc2, pData + CRC32C_STRIPE * 2 + i );
+		}
+
+		nCrc = Crc32C_Shift( tables, Crc32C_Shift( tables, nCrc0 ) ^ nCrc1 ) ^ nCrc2;
+	}
+
+	for ( ; nLength >= 8; nLength -= 8, pData += 8 )
+		nCrc = Crc32C_Step8( nCrc, pData );
+
+	for ( ; nLength; --nLength )
+		nCrc = _mm_crc32_u8( nCrc, *pData++ );
+
+	return nCrc;
+}
+#endif
+
+unsigned long NET_Crc32C( const void* pData, unsigned long nLength, unsigned long nCrc )
+{
+	const crc32c_tables_t& tables = Crc32C_GetTables();
+	unsigned int nState = ~( unsigned int ) nCrc;
+
+#ifdef CRC32C_HARDWARE
+	if ( tables.m_bHardware )
+		return ( unsigned int ) ~Crc32C_Hardware( tables, nState, ( const unsigned char* ) pData, nLength );
+#endif
+
+	return ( unsigned int ) ~Crc32C_Portable( tables, nState, ( const unsigned char* ) pData, nLength );
+}
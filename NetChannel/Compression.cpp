@@ -0,0 +1,811 @@
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include "windows.h"
+#include "vector"
+#include "Inc/Compression.h"
+
+#define HISTORY_CAPACITY	( CNetCompressor::WINDOW_SIZE + NET_TRANSFORM_CAPACITY )
+
+__forceinline unsigned long LZ_Read32( const unsigned char* p )
+{
+	unsigned long val = 0;
+	memcpy( &val, p, 4 );
+	return val;
+}
+
+__forceinline unsigned long LZ_Hash( unsigned long val )
+{
+	return ( unsigned int ) ( val * 2654435761U ) >> ( 32 - CNetCompressor::HASH_LOG );
+}
+
+__forceinline unsigned long LZ_HashDmer( const unsigned char* p, int nLog )
+{
+	unsigned long long val = 0;
+	memcpy( &val, p, 6 );
+
+	return ( unsigned long ) ( ( val * 0xCF1BBCDCB7A56463ULL ) >> ( 64 - nLog ) );
+}
+
+__forceinline unsigned char* LZ_WriteLength( unsigned char* op, unsigned long nLength )
+{
+	while ( nLength >= 255 )
+	{
+		*op++ = 255;
+		nLength -= 255;
+	}
+
+	*op++ = ( unsigned char ) nLength;
+	return op;
+}
+
+/* Token, literal length, literals, offset, match length; NULL when it doesn't fit */
+__forceinline unsigned char* LZ_WriteSequence( unsigned char* op, unsigned char* oend, const unsigned char* anchor, unsigned long nLiterals, unsigned long nOffset, unsigned long nMatchLength )
+{
+	if ( op + 1 + ( nLiterals / 255 ) + 1 + nLiterals + 2 + ( nMatchLength / 255 ) + 1 > oend )
+		return NULL;
+
+	unsigned char* token = op++;
+	*token = ( unsigned char ) ( ( min( nLiterals, 15UL ) << 4 ) | min( nMatchLength, 15UL ) );
+
+	if ( nLiterals >= 15 )
+		op = LZ_WriteLength( op, nLiterals - 15 );
+
+	memcpy( op, anchor, nLiterals );
+	op += nLiterals;
+
+	*op++ = ( unsigned char ) ( nOffset & 0xFF );
+	*op++ = ( unsigned char ) ( nOffset >> 8 );
+
+	if ( nMatchLength >= 15 )
+		op = LZ_WriteLength( op, nMatchLength - 15 );
+
+	return op;
+}
+
+__forceinline unsigned char* LZ_WriteLastLiterals( unsigned char* op, unsigned char* oend, const unsigned char* anchor, unsigned long nLiterals )
+{
+	if ( op + 1 + ( nLiterals / 255 ) + 1 + nLiterals > oend )
+		return NULL;
+
+	*op++ = ( unsigned char ) ( min( nLiterals, 15UL ) << 4 );
+
+	if ( nLiterals >= 15 )
+		op = LZ_WriteLength( op, nLiterals - 15 );
+
+	memcpy( op, anchor, nLiterals );
+	return op + nLiterals;
+}
+
+class CNetDictionaryRegistry
+{
+public:
+	CNetDictionaryRegistry()
+	{
+		InitializeCriticalSection( &m_hLock );
+	}
+
+	~CNetDictionaryRegistry()
+	{
+		int c = m_Dictionaries.size();
+		for ( int i = 0; i < c; ++i )
+		{
+			NET_Free( m_Dictionaries[ i ]->m_pData, m_Dictionaries[ i ]->m_nLength, NET_ALLOC_GLOBAL );
+			NET_Delete( m_Dictionaries[ i ], NET_ALLOC_GLOBAL );
+		}
+
+		DeleteCriticalSection( &m_hLock );
+	}
+
+	unsigned long Register( const void* pData, unsigned long nLength );
+	const net_dictionary_t* Find( unsigned long nDictionaryId );
+
+private:
+	std::vector< net_dictionary_t* >	m_Dictionaries;
+	CRITICAL_SECTION					m_hLock;
+};
+
+CNetDictionaryRegistry* NET_GetDictionaryRegistry()
+{
+	static CNetDictionaryRegistry s_Registry;
+	return &s_Registry;
+}
+
+unsigned long CNetDictionaryRegistry::Register( const void* pData, unsigned long nLength )
+{
+	const unsigned char* pBytes = ( const unsigned char* ) pData;
+
+	/* FNV-1a of the contents, both ends arrive at the same id on their own */
+	unsigned long nDictionaryId = 2166136261U;
+
+	for ( unsigned long i = 0; i < nLength; ++i )
+		nDictionaryId = ( unsigned int ) ( ( nDictionaryId ^ pBytes[ i ] ) * 16777619U );
+
+	if ( !nDictionaryId )
+		nDictionaryId = 1;
+
+	CRITICAL_SECTION_AUTOLOCK( m_hLock );
+
+	int c = m_Dictionaries.size();
+	for ( int i = 0; i < c; ++i )
+	{
+		if ( m_Dictionaries[ i ]->m_nId == nDictionaryId )
+			return nDictionaryId;
+	}
+
+	net_dictionary_t* pDictionary = NET_New< net_dictionary_t >( NET_ALLOC_GLOBAL, NULL );
+	pDictionary->m_nId = nDictionaryId;
+	pDictionary->m_nLength = nLength;
+	pDictionary->m_pData = ( unsigned char* ) NET_Alloc( nLength, NET_ALLOC_GLOBAL );
+
+	memcpy( pDictionary->m_pData, pData, nLength );
+	memset( pDictionary->m_HashTable, 0, sizeof( pDictionary->m_HashTable ) );
+
+	for ( unsigned long i = 0; i + 4 <= nLength; ++i )
+		pDictionary->m_HashTable[ LZ_Hash( LZ_Read32( pBytes + i ) ) ] = i;
+
+	m_Dictionaries.push_back( pDictionary );
+	return nDictionaryId;
+}
+
+const net_dictionary_t* CNetDictionaryRegistry::Find( unsigned long nDictionaryId )
+{
+	CRITICAL_SECTION_AUTOLOCK( m_hLock );
+
+	int c = m_Dictionaries.size();
+	for ( int i = 0; i < c; ++i )
+	{
+		if ( m_Dictionaries[ i ]->m_nId == nDictionaryId )
+			return m_Dictionaries[ i ];
+	}
+
+	return NULL;
+}
+
+const net_dictionary_t* NET_FindDictionary( unsigned long nDictionaryId )
+{
+	if ( !nDictionaryId )
+		return NULL;
+
+	return NET_GetDictionaryRegistry()->Find( nDictionaryId );
+}
+
+unsigned long NET_RegisterDictionary( const void* pData, long nLength )
+{
+	if ( !pData || nLength <= 0 || nLength > NET_DICTIONARY_MAX_SIZE )
+		return 0;
+
+	return NET_GetDictionaryRegistry()->Register( pData, nLength );
+}
+
+long NET_TrainDictionary( const char* const* ppSamples, const long* pSampleLengths, int nSamples, char* pDict, long nCapacity )
+{
+	/*
+		Segment selection in the spirit of COVER: score every window of
+		SEGMENT bytes by how many samples share its d-mers, take the best
+		window of each epoch and forget its d-mers so the next picks cover
+		something else.
+	*/
+	enum { DMER = 6, SEGMENT = 32, FREQ_LOG = 18 };
+
+	nCapacity = min( nCapacity, ( long ) NET_DICTIONARY_MAX_SIZE );
+
+	long nTotal = 0;
+	for ( int i = 0; i < nSamples; ++i )
+		nTotal += max( pSampleLengths[ i ], 0L );
+
+	if ( nCapacity < SEGMENT || nTotal < SEGMENT )
+		return 0;
+
+	/* Samples back to back, each position holds the d-mer starting there or -1 across a boundary */
+	unsigned char* samples = ( unsigned char* ) NET_Alloc( nTotal, NET_ALLOC_GLOBAL );
+	long* dmers = ( long* ) NET_Alloc( nTotal * sizeof( long ), NET_ALLOC_GLOBAL );
+	unsigned long* freq = ( unsigned long* ) NET_Alloc( ( 1 << FREQ_LOG ) * sizeof( unsigned long ), NET_ALLOC_GLOBAL );
+	int* lastSample = ( int* ) NET_Alloc( ( 1 << FREQ_LOG ) * sizeof( int ), NET_ALLOC_GLOBAL );
+
+	memset( dmers, -1, nTotal * sizeof( long ) );
+	memset( freq, 0, ( 1 << FREQ_LOG ) * sizeof( unsigned long ) );
+	memset( lastSample, -1, ( 1 << FREQ_LOG ) * sizeof( int ) );
+
+	long nOffset = 0;
+	for ( int i = 0; i < nSamples; ++i )
+	{
+		long nLength = pSampleLengths[ i ];
+
+		if ( nLength <= 0 )
+			continue;
+
+		memcpy( &samples[ nOffset ], ppSamples[ i ], nLength );
+
+		for ( long j = 0; j + DMER <= nLength; ++j )
+		{
+			long nHash = LZ_HashDmer( &samples[ nOffset + j ], FREQ_LOG );
+			dmers[ nOffset + j ] = nHash;
+
+			/* Count the samples a d-mer appears in, not its repeats within one */
+			if ( lastSample[ nHash ] != i )
+			{
+				lastSample[ nHash ] = i;
+				++freq[ nHash ];
+			}
+		}
+
+		nOffset += nLength;
+	}
+
+	/* Content of a single sample isn't worth a place */
+	for ( int i = 0; i < ( 1 << FREQ_LOG ); ++i )
+	{
+		if ( freq[ i ] < 2 )
+			freq[ i ] = 0;
+	}
+
+	long nEpochs = max( min( nCapacity / SEGMENT, nTotal / SEGMENT ), 1L );
+	long nEpochSize = nTotal / nEpochs;
+	long nWindow = SEGMENT - DMER + 1;
+
+	long nDictLength = 0;
+	bool bProgress = true;
+
+	while ( bProgress && nDictLength + SEGMENT <= nCapacity )
+	{
+		bProgress = false;
+
+		for ( long e = 0; e < nEpochs && nDictLength + SEGMENT <= nCapacity; ++e )
+		{
+			long nBegin = e * nEpochSize;
+			long nEnd = min( nBegin + nEpochSize, nTotal - DMER + 1 );
+
+			unsigned long nScore = 0;
+			unsigned long nBestScore = 0;
+			long nBest = -1;
+
+			for ( long p = nBegin; p < nEnd; ++p )
+			{
+				if ( dmers[ p ] >= 0 )
+					nScore += freq[ dmers[ p ] ];
+
+				if ( p - nBegin >= nWindow && dmers[ p - nWindow ] >= 0 )
+					nScore -= freq[ dmers[ p - nWindow ] ];
+
+				long nStart = p - nWindow + 1;
+
+				if ( nStart >= nBegin && nScore > nBestScore )
+				{
+					nBestScore = nScore;
+					nBest = nStart;
+				}
+			}
+
+			if ( nBest < 0 )
+				continue;
+
+			memcpy( pDict + nDictLength, &samples[ nBest ], SEGMENT );
+			nDictLength += SEGMENT;
+
+			for ( long p = nBest; p < nBest + nWindow; ++p )
+			{
+				if ( dmers[ p ] >= 0 )
+					freq[ dmers[ p ] ] = 0;
+			}
+
+			bProgress = true;
+		}
+	}
+
+	NET_Free( samples, nTotal, NET_ALLOC_GLOBAL );
+	NET_Free( dmers, nTotal * sizeof( long ), NET_ALLOC_GLOBAL );
+	NET_Free( freq, ( 1 << FREQ_LOG ) * sizeof( unsigned long ), NET_ALLOC_GLOBAL );
+	NET_Free( lastSample, ( 1 << FREQ_LOG ) * sizeof( int ), NET_ALLOC_GLOBAL );
+
+	return nDictLength;
+}
+
+CNetCompressor::CNetCompressor( INetChannel* pNetChannel )
+{
+	m_pNetChannel = pNetChannel;
+	m_Outgoing.m_pData = NULL;
+	m_Incoming.m_pData = NULL;
+	m_pScratch = ( unsigned char* ) NET_Alloc( NET_TRANSFORM_CAPACITY, NET_ALLOC_CHANNEL, m_pNetChannel );
+	m_pDictionary = NULL;
+	m_nFrameTag = 0;
+
+	AllocHistory( &m_Outgoing, HISTORY_CAPACITY );
+	AllocHistory( &m_Incoming, HISTORY_CAPACITY );
+
+	LARGE_INTEGER nFrequency;
+	QueryPerformanceFrequency( &nFrequency );
+	m_flTickInterval = 1.0 / ( double ) nFrequency.QuadPart;
+
+	Reset();
+}
+
+CNetCompressor::~CNetCompressor()
+{
+	NET_Free( m_Outgoing.m_pData, m_Outgoing.m_nCapacity, NET_ALLOC_CHANNEL, m_pNetChannel );
+	NET_Free( m_Incoming.m_pData, m_Incoming.m_nCapacity, NET_ALLOC_CHANNEL, m_pNetChannel );
+	NET_Free( m_pScratch, NET_TRANSFORM_CAPACITY, NET_ALLOC_CHANNEL, m_pNetChannel );
+}
+
+void CNetCompressor::Reset()
+{
+	m_Outgoing.m_nLength	= 0;
+	m_Outgoing.m_nBase		= 0;
+	m_Incoming.m_nLength	= 0;
+	m_Incoming.m_nBase		= 0;
+
+	m_nFailures = 0;
+	m_nSkipFrames = 0;
+	m_nFrameTag = 0;
+
+	memset( m_HashTable, 0, sizeof( m_HashTable ) );
+	memset( &m_Stats, 0, sizeof( m_Stats ) );
+}
+
+void CNetCompressor::SetDictionary( const net_dictionary_t* pDictionary )
+{
+	m_pDictionary = pDictionary;
+
+	/* Frames never reference each other with a dictionary, there is no history to keep */
+	unsigned long nCapacity = pDictionary ? 0 : HISTORY_CAPACITY;
+
+	AllocHistory( &m_Outgoing, nCapacity );
+	AllocHistory( &m_Incoming, nCapacity );
+
+	Reset();
+}
+
+void CNetCompressor::AllocHistory( history_t* pHistory, unsigned long nCapacity )
+{
+	if ( pHistory->m_pData && pHistory->m_nCapacity == nCapacity )
+		return;
+
+	if ( pHistory->m_pData )
+		NET_Free( pHistory->m_pData, pHistory->m_nCapacity, NET_ALLOC_CHANNEL, m_pNetChannel );
+
+	pHistory->m_pData = nCapacity ? ( unsigned char* ) NET_Alloc( nCapacity, NET_ALLOC_CHANNEL, m_pNetChannel ) : NULL;
+	pHistory->m_nCapacity = nCapacity;
+}
+
+void CNetCompressor::GetStats( net_compression_stats_t* pStats ) const
+{
+	*pStats = m_Stats;
+}
+
+unsigned char* CNetCompressor::Append( history_t* pHistory, unsigned long nLength )
+{
+	/* Slide the window once the next payload doesn't fit, both ends do it at the same point */
+	if ( pHistory->m_nLength + nLength > pHistory->m_nCapacity )
+	{
+		unsigned long nShift = pHistory->m_nLength - WINDOW_SIZE;
+
+		memmove( pHistory->m_pData, pHistory->m_pData + nShift, WINDOW_SIZE );
+		pHistory->m_nLength = WINDOW_SIZE;
+		pHistory->m_nBase += nShift;
+	}
+
+	unsigned char* pData = pHistory->m_pData + pHistory->m_nLength;
+	pHistory->m_nLength += nLength;
+
+	return pData;
+}
+
+long CNetCompressor::TransformOutgoing( char* pData, long nLength, long nCapacity )
+{
+	if ( nLength < 0 || nLength > NET_TRANSFORM_CAPACITY - 1 || nLength + 1 > nCapacity )
+		return -1;
+
+	LARGE_INTEGER nStart, nEnd;
+	QueryPerformanceCounter( &nStart );
+
+	/* Frames stand alone with a dictionary, they are compressed straight from the payload */
+	const unsigned char* pSrc = ( const unsigned char* ) pData;
+
+	if ( !m_pDictionary )
+	{
+		unsigned char* pHistory = Append( &m_Outgoing, nLength );
+		memcpy( pHistory, pData, nLength );
+		pSrc = pHistory;
+	}
+
+	long nCompressed = -1;
+
+	if ( nLength >= MIN_INPUT && !m_nSkipFrames )
+	{
+		m_pScratch[ 0 ] = COMPRESSION_LZ;
+
+		bf_write header;
+		header.Init( m_pScratch + 1, 5 );
+		header.WriteVarInt32( nLength );
+
+		long nHeaderSize = 1 + header.GetNumBytesWritten();
+
+		/* Only worth it when it saves at least 1/16th */
+		long nBudget = min( nLength - ( nLength >> 4 ), nCapacity ) - nHeaderSize;
+
+		if ( nBudget > 0 && m_pDictionary )
+			nCompressed = CompressDictionary( pSrc, nLength, m_pScratch + nHeaderSize, nBudget );
+		else if ( nBudget > 0 )
+			nCompressed = Compress( pSrc, nLength, m_pScratch + nHeaderSize, nBudget );
+
+		if ( nCompressed > 0 )
+		{
+			nCompressed += nHeaderSize;
+			memcpy( pData, m_pScratch, nCompressed );
+
+			m_nFailures = 0;
+		}
+		else
+		{
+			/* Back off exponentially while the stream stays incompressible */
+			m_nFailures = min( m_nFailures + 1, 6 );
+			m_nSkipFrames = min( 1 << m_nFailures, ( int ) MAX_SKIP_FRAMES );
+		}
+	}
+	else if ( m_nSkipFrames )
+	{
+		--m_nSkipFrames;
+	}
+
+	if ( nCompressed <= 0 )
+	{
+		memmove( pData + 1, pData, nLength );
+		pData[ 0 ] = COMPRESSION_RAW;
+
+		nCompressed = nLength + 1;
+		++m_Stats.m_nFramesRaw;
+	}
+	else
+	{
+		++m_Stats.m_nFramesCompressed;
+	}
+
+	QueryPerformanceCounter( &nEnd );
+
+	m_Stats.m_nRawBytesOut += nLength;
+	m_Stats.m_nWireBytesOut += nCompressed;
+	m_Stats.m_flCompressTime += ( double ) ( nEnd.QuadPart - nStart.QuadPart ) * m_flTickInterval;
+
+	return nCompressed;
+}
+
+long CNetCompressor::TransformIncoming( const char* pData, long nLength, char* pOut, long nOutCapacity )
+{
+	if ( nLength < 1 )
+		return -1;
+
+	LARGE_INTEGER nStart, nEnd;
+	QueryPerformanceCounter( &nStart );
+
+	long nRawLength = -1;
+
+	switch ( ( unsigned char ) pData[ 0 ] )
+	{
+	case COMPRESSION_RAW:
+	{
+		nRawLength = nLength - 1;
+
+		if ( nRawLength > nOutCapacity || nRawLength > NET_TRANSFORM_CAPACITY )
+			return -1;
+
+		if ( !m_pDictionary )
+			memcpy( Append( &m_Incoming, nRawLength ), pData + 1, nRawLength );
+
+		memcpy( pOut, pData + 1, nRawLength );
+		break;
+	}
+	case COMPRESSION_LZ:
+	{
+		bf_read header;
+		header.Init( pData + 1, min( nLength - 1, 5L ) );
+
+		nRawLength = header.ReadVarInt32();
+
+		if ( header.IsOverflowed() || nRawLength < 0 || nRawLength > nOutCapacity || nRawLength > NET_TRANSFORM_CAPACITY )
+			return -1;
+
+		long nHeaderSize = 1 + header.GetNumBytesRead();
+		unsigned char* pDst = m_pDictionary ? ( unsigned char* ) pOut : Append( &m_Incoming, nRawLength );
+
+		if ( !Decompress( ( const unsigned char* ) pData + nHeaderSize, nLength - nHeaderSize, pDst, nRawLength ) )
+			return -1;
+
+		if ( pDst != ( unsigned char* ) pOut )
+			memcpy( pOut, pDst, nRawLength );
+
+		break;
+	}
+	default:
+		return -1;
+	}
+
+	QueryPerformanceCounter( &nEnd );
+
+	m_Stats.m_nRawBytesIn += nRawLength;
+	m_Stats.m_nWireBytesIn += nLength;
+	m_Stats.m_flDecompressTime += ( double ) ( nEnd.QuadPart - nStart.QuadPart ) * m_flTickInterval;
+
+	return nRawLength;
+}
+
+long CNetCompressor::Compress( const unsigned char* pSrc, unsigned long nLength, unsigned char* pDst, unsigned long nCapacity )
+{
+	const unsigned char* pBase = m_Outgoing.m_pData;
+	const unsigned long nBasePos = m_Outgoing.m_nBase;
+
+	const unsigned char* ip = pSrc;
+	const unsigned char* anchor = pSrc;
+	const unsigned char* iend = pSrc + nLength;
+	const unsigned char* matchlimit = iend - LAST_LITERALS;
+	const unsigned char* mflimit = iend - ( MIN_MATCH + LAST_LITERALS + 3 );
+
+	unsigned char* op = pDst;
+	unsigned char* oend = pDst + nCapacity;
+
+	while ( ip < mflimit )
+	{
+		/* Find a match, stepping faster the longer nothing turns up */
+		const unsigned char* match = NULL;
+		unsigned long nSearches = 1 << SKIP_TRIGGER;
+
+		while ( ip < mflimit )
+		{
+			unsigned long nPos = nBasePos + ( unsigned long ) ( ip - pBase );
+			unsigned long nHash = LZ_Hash( LZ_Read32( ip ) );
+			unsigned long nCandidate = m_HashTable[ nHash ];
+			m_HashTable[ nHash ] = nPos;
+
+			unsigned long nDistance = nPos - nCandidate;
+
+			if ( nDistance - 1 < WINDOW_SIZE && nDistance <= nPos - nBasePos )
+			{
+				const unsigned char* candidate = ip - nDistance;
+
+				if ( LZ_Read32( candidate ) == LZ_Read32( ip ) )
+				{
+					match = candidate;
+					break;
+				}
+			}
+
+			ip += ( nSearches++ >> SKIP_TRIGGER );
+		}
+
+		if ( !match )
+			break;
+
+		/* Catch up backwards over equal bytes */
+		while ( ip > anchor && match > pBase && ip[ -1 ] == match[ -1 ] )
+		{
+			--ip;
+			--match;
+		}
+
+		unsigned long nLiterals = ( unsigned long ) ( ip - anchor );
+		unsigned long nOffset = ( unsigned long ) ( ip - match );
+
+		const unsigned char* mp = ip + MIN_MATCH;
+		const unsigned char* rp = match + MIN_MATCH;
+
+		while ( mp < matchlimit && *mp == *rp )
+		{
+			++mp;
+			++rp;
+		}
+
+		op = LZ_WriteSequence( op, oend, anchor, nLiterals, nOffset, ( unsigned long ) ( mp - ip ) - MIN_MATCH );
+
+		if ( !op )
+			return -1;
+
+		ip = mp;
+		anchor = ip;
+
+		/* Keep the table warm inside long matches */
+		if ( ip < mflimit )
+			m_HashTable[ LZ_Hash( LZ_Read32( ip - 2 ) ) ] = nBasePos + ( unsigned long ) ( ip - 2 - pBase );
+	}
+
+	op = LZ_WriteLastLiterals( op, oend, anchor, ( unsigned long ) ( iend - anchor ) );
+
+	return op ? ( long ) ( op - pDst ) : -1;
+}
+
+long CNetCompressor::CompressDictionary( const unsigned char* pSrc, unsigned long nLength, unsigned char* pDst, unsigned long nCapacity )
+{
+	/*
+		The frame sits right behind the dictionary. Earlier frame positions
+		come from m_HashTable, tagged with the frame so stale entries need no
+		clearing; dictionary positions come from its own shared table.
+	*/
+	const unsigned char* pDict = m_pDictionary->m_pData;
+	const unsigned char* pDictEnd = pDict + m_pDictionary->m_nLength;
+	const unsigned long* pDictTable = m_pDictionary->m_HashTable;
+
+	if ( ++m_nFrameTag > 0xFFFF )
+	{
+		memset( m_HashTable, 0, sizeof( m_HashTable ) );
+		m_nFrameTag = 1;
+	}
+
+	const unsigned long nTag = m_nFrameTag << 16;
+
+	const unsigned char* ip = pSrc;
+	const unsigned char* anchor = pSrc;
+	const unsigned char* iend = pSrc + nLength;
+	const unsigned char* matchlimit = iend - LAST_LITERALS;
+	const unsigned char* mflimit = iend - ( MIN_MATCH + LAST_LITERALS + 3 );
+
+	unsigned char* op = pDst;
+	unsigned char* oend = pDst + nCapacity;
+
+	while ( ip < mflimit )
+	{
+		const unsigned char* match = NULL;
+		const unsigned char* pMatchBegin = NULL;
+		const unsigned char* pMatchEnd = NULL;
+		unsigned long nSearches = 1 << SKIP_TRIGGER;
+
+		while ( ip < mflimit )
+		{
+			unsigned long nValue = LZ_Read32( ip );
+			unsigned long nHash = LZ_Hash( nValue );
+			unsigned long nEntry = m_HashTable[ nHash ];
+			m_HashTable[ nHash ] = nTag | ( unsigned long ) ( ip - pSrc );
+
+			/* Earlier in this frame first, it is closer */
+			if ( ( nEntry & 0xFFFF0000 ) == nTag && LZ_Read32( pSrc + ( nEntry & 0xFFFF ) ) == nValue )
+			{
+				match = pSrc + ( nEntry & 0xFFFF );
+				pMatchBegin = pSrc;
+				pMatchEnd = iend;
+				break;
+			}
+
+			const unsigned char* candidate = pDict + pDictTable[ nHash ];
+
+			if ( candidate + MIN_MATCH <= pDictEnd && LZ_Read32( candidate ) == nValue )
+			{
+				match = candidate;
+				pMatchBegin = pDict;
+				pMatchEnd = pDictEnd;
+				break;
+			}
+
+			ip += ( nSearches++ >> SKIP_TRIGGER );
+		}
+
+		if ( !match )
+			break;
+
+		while ( ip > anchor && match > pMatchBegin && ip[ -1 ] == match[ -1 ] )
+		{
+			--ip;
+			--match;
+		}
+
+		unsigned long nLiterals = ( unsigned long ) ( ip - anchor );
+		unsigned long nOffset = ( pMatchBegin == pDict ) ? ( unsigned long ) ( ( pDictEnd - match ) + ( ip - pSrc ) ) : ( unsigned long ) ( ip - match );
+
+		const unsigned char* mp = ip + MIN_MATCH;
+		const unsigned char* rp = match + MIN_MATCH;
+
+		/* Dictionary matches stop at its end rather than running on into the frame */
+		while ( mp < matchlimit && rp < pMatchEnd && *mp == *rp )
+		{
+			++mp;
+			++rp;
+		}
+
+		op = LZ_WriteSequence( op, oend, anchor, nLiterals, nOffset, ( unsigned long ) ( mp - ip ) - MIN_MATCH );
+
+		if ( !op )
+			return -1;
+
+		ip = mp;
+		anchor = ip;
+
+		if ( ip < mflimit )
+			m_HashTable[ LZ_Hash( LZ_Read32( ip - 2 ) ) ] = nTag | ( unsigned long ) ( ip - 2 - pSrc );
+	}
+
+	op = LZ_WriteLastLiterals( op, oend, anchor, ( unsigned long ) ( iend - anchor ) );
+
+	return op ? ( long ) ( op - pDst ) : -1;
+}
+
+bool CNetCompressor::Decompress( const unsigned char* pSrc, unsigned long nLength, unsigned char* pDst, unsigned long nRawLength )
+{
+	const unsigned char* ip = pSrc;
+	const unsigned char* iend = pSrc + nLength;
+
+	unsigned char* op = pDst;
+	unsigned char* oend = pDst + nRawLength;
+
+	/* Offsets reach back over the history in front of pDst, or through the frame into the dictionary */
+	const unsigned char* pPrefix = m_pDictionary ? m_pDictionary->m_pData : NULL;
+	unsigned long nPrefixLength = m_pDictionary ? m_pDictionary->m_nLength : 0;
+	unsigned long nHistory = m_pDictionary ? 0 : ( unsigned long ) ( pDst - m_Incoming.m_pData );
+
+	while ( ip < iend )
+	{
+		unsigned long nToken = *ip++;
+		unsigned long nLiterals = nToken >> 4;
+
+		if ( nLiterals == 15 )
+		{
+			unsigned char b;
+			do
+			{
+				if ( ip >= iend )
+					return false;
+
+				b = *ip++;
+				nLiterals += b;
+			}
+			while ( b == 255 );
+		}
+
+		if ( nLiterals > ( unsigned long ) ( iend - ip ) || nLiterals > ( unsigned long ) ( oend - op ) )
+			return false;
+
+		memcpy( op, ip, nLiterals );
+		op += nLiterals;
+		ip += nLiterals;
+
+		/* The last sequence has literals only */
+		if ( ip == iend )
+			break;
+
+		if ( iend - ip < 2 )
+			return false;
+
+		unsigned long nOffset = ip[ 0 ] | ( ip[ 1 ] << 8 );
+		ip += 2;
+
+		unsigned long nBehind = nHistory + ( unsigned long ) ( op - pDst );
+
+		if ( !nOffset || nOffset > nBehind + nPrefixLength )
+			return false;
+
+		unsigned long nMatchLength = ( nToken & 15 );
+
+		if ( nMatchLength == 15 )
+		{
+			unsigned char b;
+			do
+			{
+				if ( ip >= iend )
+					return false;
+
+				b = *ip++;
+				nMatchLength += b;
+			}
+			while ( b == 255 );
+		}
+
+		nMatchLength += MIN_MATCH;
+
+		if ( nMatchLength > ( unsigned long ) ( oend - op ) )
+			return false;
+
+		/* The dictionary part first, the rest continues at the start of the frame */
+		if ( nOffset > nBehind )
+		{
+			unsigned long nChunk = min( nMatchLength, nOffset - nBehind );
+
+			memcpy( op, pPrefix + nPrefixLength - ( nOffset - nBehind ), nChunk );
+			op += nChunk;
+			nMatchLength -= nChunk;
+		}
+
+		/* Matches may overlap their own output, copy forwards */
+		const unsigned char* match = op - nOffset;
+
+		while ( nMatchLength-- )
+			*op++ = *match++;
+	}
+
+	return ( op == oend );
+}
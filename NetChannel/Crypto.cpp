@@ -0,0 +1,556 @@
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include "windows.h"
+#include "bcrypt.h"
+#include "Inc/Crypto.h"
+
+#pragma comment( lib, "bcrypt.lib" )
+
+/* Words load and store little endian, as on every target we build for */
+
+static const unsigned int g_ChaChaConstants[ 4 ] = { 0x61707865, 0x3320646E, 0x79622D32, 0x6B206574 };
+
+__forceinline unsigned int ChaCha_Rotl( unsigned int v, int n )
+{
+	return ( v << n ) | ( v >> ( 32 - n ) );
+}
+
+__forceinline void ChaCha_QuarterRound( unsigned int& a, unsigned int& b, unsigned int& c, unsigned int& d )
+{
+	a += b; d ^= a; d = ChaCha_Rotl( d, 16 );
+	c += d; b ^= c; b = ChaCha_Rotl( b, 12 );
+	a += b; d ^= a; d = ChaCha_Rotl( d, 8 );
+	c += d; b ^= c; b = ChaCha_Rotl( b, 7 );
+}
+
+void ChaCha_DoubleRounds( unsigned int* x )
+{
+	for ( int i = 0; i < 10; ++i )
+	{
+		ChaCha_QuarterRound( x[ 0 ], x[ 4 ], x[ 8 ], x[ 12 ] );
+		ChaCha_QuarterRound( x[ 1 ], x[ 5 ], x[ 9 ], x[ 13 ] );
+		ChaCha_QuarterRound( x[ 2 ], x[ 6 ], x[ 10 ], x[ 14 ] );
+		ChaCha_QuarterRound( x[ 3 ], x[ 7 ], x[ 11 ], x[ 15 ] );
+		ChaCha_QuarterRound( x[ 0 ], x[ 5 ], x[ 10 ], x[ 15 ] );
+		ChaCha_QuarterRound( x[ 1 ], x[ 6 ], x[ 11 ], x[ 12 ] );
+		ChaCha_QuarterRound( x[ 2 ], x[ 7 ], x[ 8 ], x[ 13 ] );
+		ChaCha_QuarterRound( x[ 3 ], x[ 4 ], x[ 9 ], x[ 14 ] );
+	}
+}
+
+#ifdef BITBUF_SSE2
+template< int N >
+__forceinline __m128i ChaCha_Rotl128( __m128i v )
+{
+	return _mm_or_si128( _mm_slli_epi32( v, N ), _mm_srli_epi32( v, 32 - N ) );
+}
+
+template<>
+__forceinline __m128i ChaCha_Rotl128< 16 >( __m128i v )
+{
+	return _mm_shufflehi_epi16( _mm_shufflelo_epi16( v, 0xB1 ), 0xB1 );
+}
+
+__forceinline void ChaCha_QuarterRound128( __m128i& a, __m128i& b, __m128i& c, __m128i& d )
+{
+	a = _mm_add_epi32( a, b ); d = _mm_xor_si128( d, a ); d = ChaCha_Rotl128< 16 >( d );
+	c = _mm_add_epi32( c, d ); b = _mm_xor_si128( b, c ); b = ChaCha_Rotl128< 12 >( b );
+	a = _mm_add_epi32( a, b ); d = _mm_xor_si128( d, a ); d = ChaCha_Rotl128< 8 >( d );
+	c = _mm_add_epi32( c, d ); b = _mm_xor_si128( b, c ); b = ChaCha_Rotl128< 7 >( b );
+}
+#endif
+
+/* Four blocks at once, block i at pCounters[ i ] under the nonce at pNonces[ i * 3 ] */
+void ChaCha20_Blocks( const unsigned int* pKey, const unsigned int* pCounters, const unsigned int* pNonces, unsigned char* pOut )
+{
+#ifdef BITBUF_SSE2
+	/* One register per state word, holding that word of all four blocks */
+	__m128i in[ 16 ];
+	__m128i x[ 16 ];
+
+	for ( int i = 0; i < 4; ++i )
+		in[ i ] = _mm_set1_epi32( g_ChaChaConstants[ i ] );
+
+	for ( int i = 0; i < 8; ++i )
+		in[ 4 + i ] = _mm_set1_epi32( pKey[ i ] );
+
+	in[ 12 ] = _mm_setr_epi32( pCounters[ 0 ], pCounters[ 1 ], pCounters[ 2 ], pCounters[ 3 ] );
+	in[ 13 ] = _mm_setr_epi32( pNonces[ 0 ], pNonces[ 3 ], pNonces[ 6 ], pNonces[ 9 ] );
+	in[ 14 ] = _mm_setr_epi32( pNonces[ 1 ], pNonces[ 4 ], pNonces[ 7 ], pNonces[ 10 ] );
+	in[ 15 ] = _mm_setr_epi32( pNonces[ 2 ], pNonces[ 5 ], pNonces[ 8 ], pNonces[ 11 ] );
+
+	for ( int i = 0; i < 16; ++i )
+		x[ i ] = in[ i ];
+
+	for ( int i = 0; i < 10; ++i )
+	{
+		ChaCha_QuarterRound128( x[ 0 ], x[ 4 ], x[ 8 ], x[ 12 ] );
+		ChaCha_QuarterRound128( x[ 1 ], x[ 5 ], x[ 9 ], x[ 13 ] );
+		ChaCha_QuarterRound128( x[ 2 ], x[ 6 ], x[ 10 ], x[ 14 ] );
+		ChaCha_QuarterRound128( x[ 3 ], x[ 7 ], x[ 11 ], x[ 15 ] );
+		ChaCha_QuarterRound128( x[ 0 ], x[ 5 ], x[ 10 ], x[ 15 ] );
+		ChaCha_QuarterRound128( x[ 1 ], x[ 6 ], x[ 11 ], x[ 12 ] );
+		ChaCha_QuarterRound128( x[ 2 ], x[ 7 ], x[ 8 ], x[ 13 ] );
+		ChaCha_QuarterRound128( x[ 3 ], x[ 4 ], x[ 9 ], x[ 14 ] );
+	}
+
+	/* Transpose four words at a time back into blocks */
+	for ( int i = 0; i < 16; i += 4 )
+	{
+		__m128i a = _mm_add_epi32( x[ i + 0 ], in[ i + 0 ] );
+		__m128i b = _mm_add_epi32( x[ i + 1 ], in[ i + 1 ] );
+		__m128i c = _mm_add_epi32( x[ i + 2 ], in[ i + 2 ] );
+		__m128i d = _mm_add_epi32( x[ i + 3 ], in[ i + 3 ] );
+
+		__m128i ab01 = _mm_unpacklo_epi32( a, b );
+		__m128i cd01 = _mm_unpacklo_epi32( c, d );
+		__m128i ab23 = _mm_unpackhi_epi32( a, b );
+		__m128i cd23 = _mm_unpackhi_epi32( c, d );
+
+		_mm_storeu_si128( ( __m128i* ) ( pOut + 0 * CNetCipher::BLOCK_SIZE + i * 4 ), _mm_unpacklo_epi64( ab01, cd01 ) );
+		_mm_storeu_si128( ( __m128i* ) ( pOut + 1 * CNetCipher::BLOCK_SIZE + i * 4 ), _mm_unpackhi_epi64( ab01, cd01 ) );
+		_mm_storeu_si128( ( __m128i* ) ( pOut + 2 * CNetCipher::BLOCK_SIZE + i * 4 ), _mm_unpacklo_epi64( ab23, cd23 ) );
+		_mm_storeu_si128( ( __m128i* ) ( pOut + 3 * CNetCipher::BLOCK_SIZE + i * 4 ), _mm_unpackhi_epi64( ab23, cd23 ) );
+	}
+#else
+	for ( int nBlock = 0; nBlock < 4; ++nBlock )
+	{
+		unsigned int in[ 16 ];
+		unsigned int x[ 16 ];
+
+		memcpy( in, g_ChaChaConstants, 16 );
+		memcpy( in + 4, pKey, 32 );
+
+		in[ 12 ] = pCounters[ nBlock ];
+		memcpy( in + 13, pNonces + nBlock * 3, 12 );
+
+		memcpy( x, in, sizeof( x ) );
+		ChaCha_DoubleRounds( x );
+
+		for ( int i = 0; i < 16; ++i )
+			x[ i ] += in[ i ];
+
+		memcpy( pOut + nBlock * CNetCipher::BLOCK_SIZE, x, CNetCipher::BLOCK_SIZE );
+	}
+#endif
+}
+
+void HChaCha20( const unsigned char* pKey, const unsigned char* pInput, unsigned int* pOut )
+{
+	unsigned int x[ 16 ];
+
+	memcpy( x, g_ChaChaConstants, 16 );
+	memcpy( x + 4, pKey, 32 );
+	memcpy( x + 12, pInput, 16 );
+
+	ChaCha_DoubleRounds( x );
+
+	memcpy( pOut, x, 16 );
+	memcpy( pOut + 4, x + 12, 16 );
+
+	SecureZeroMemory( x, sizeof( x ) );
+}
+
+__forceinline void ChaCha_Xor( unsigned char* pData, const unsigned char* pStream, unsigned long nLength )
+{
+#ifdef BITBUF_SSE2
+	for ( ; nLength >= 16; nLength -= 16, pData += 16, pStream += 16 )
+	{
+		__m128i data = _mm_loadu_si128( ( const __m128i* ) pData );
+		__m128i stream = _mm_loadu_si128( ( const __m128i* ) pStream );
+
+		_mm_storeu_si128( ( __m128i* ) pData, _mm_xor_si128( data, stream ) );
+	}
+#endif
+
+	while ( nLength-- )
+		*pData++ ^= *pStream++;
+}
+
+/* Poly1305 in 26 bit limbs */
+
+struct poly1305_t
+{
+	unsigned int			r[ 5 ];
+	unsigned int			h[ 5 ];
+	unsigned int			pad[ 4 ];
+};
+
+__forceinline unsigned int Poly_Load32( const unsigned char* p )
+{
+	unsigned int val;
+	memcpy( &val, p, 4 );
+	return val;
+}
+
+void Poly1305_Init( poly1305_t* pState, const unsigned char* pKey )
+{
+	/* Clamped r */
+	pState->r[ 0 ] = ( Poly_Load32( pKey + 0 ) ) & 0x3FFFFFF;
+	pState->r[ 1 ] = ( Poly_Load32( pKey + 3 ) >> 2 ) & 0x3FFFF03;
+	pState->r[ 2 ] = ( Poly_Load32( pKey + 6 ) >> 4 ) & 0x3FFC0FF;
+	pState->r[ 3 ] = ( Poly_Load32( pKey + 9 ) >> 6 ) & 0x3F03FFF;
+	pState->r[ 4 ] = ( Poly_Load32( pKey + 12 ) >> 8 ) & 0x00FFFFF;
+
+	memset( pState->h, 0, sizeof( pState->h ) );
+
+	for ( int i = 0; i < 4; ++i )
+		pState->pad[ i ] = Poly_Load32( pKey + 16 + i * 4 );
+}
+
+void Poly1305_Blocks( poly1305_t* pState, const unsigned char* m, unsigned long nLength )
+{
+	typedef unsigned long long u64;
+
+	const unsigned int r0 = pState->r[ 0 ], r1 = pState->r[ 1 ], r2 = pState->r[ 2 ], r3 = pState->r[ 3 ], r4 = pState->r[ 4 ];
+	const unsigned int s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+
+	unsigned int h0 = pState->h[ 0 ], h1 = pState->h[ 1 ], h2 = pState->h[ 2 ], h3 = pState->h[ 3 ], h4 = pState->h[ 4 ];
+
+	for ( ; nLength >= 16; nLength -= 16, m += 16 )
+	{
+		h0 += ( Poly_Load32( m + 0 ) ) & 0x3FFFFFF;
+		h1 += ( Poly_Load32( m + 3 ) >> 2 ) & 0x3FFFFFF;
+		h2 += ( Poly_Load32( m + 6 ) >> 4 ) & 0x3FFFFFF;
+		h3 += ( Poly_Load32( m + 9 ) >> 6 ) & 0x3FFFFFF;
+		h4 += ( Poly_Load32( m + 12 ) >> 8 ) | ( 1 << 24 );
+
+		u64 d0 = ( u64 ) h0 * r0 + ( u64 ) h1 * s4 + ( u64 ) h2 * s3 + ( u64 ) h3 * s2 + ( u64 ) h4 * s1;
+		u64 d1 = ( u64 ) h0 * r1 + ( u64 ) h1 * r0 + ( u64 ) h2 * s4 + ( u64 ) h3 * s3 + ( u64 ) h4 * s2;
+		u64 d2 = ( u64 ) h0 * r2 + ( u64 ) h1 * r1 + ( u64 ) h2 * r0 + ( u64 ) h3 * s4 + ( u64 ) h4 * s3;
+		u64 d3 = ( u64 ) h0 * r3 + ( u64 ) h1 * r2 + ( u64 ) h2 * r1 + ( u64 ) h3 * r0 + ( u64 ) h4 * s4;
+		u64 d4 = ( u64 ) h0 * r4 + ( u64 ) h1 * r3 + ( u64 ) h2 * r2 + ( u64 ) h3 * r1 + ( u64 ) h4 * r0;
+
+		unsigned int c;
+		c = ( unsigned int ) ( d0 >> 26 ); h0 = ( unsigned int ) d0 & 0x3FFFFFF;
+		d1 += c; c = ( unsigned int ) ( d1 >> 26 ); h1 = ( unsigned int ) d1 & 0x3FFFFFF;
+		d2 += c; c = ( unsigned int ) ( d2 >> 26 ); h2 = ( unsigned int ) d2 & 0x3FFFFFF;
+		d3 += c; c = ( unsigned int ) ( d3 >> 26 ); h3 = ( unsigned int ) d3 & 0x3FFFFFF;
+		d4 += c; c = ( unsigned int ) ( d4 >> 26 ); h4 = ( unsigned int ) d4 & 0x3FFFFFF;
+		h0 += c * 5; c = h0 >> 26; h0 &= 0x3FFFFFF;
+		h1 += c;
+	}
+
+	pState->h[ 0 ] = h0;
+	pState->h[ 1 ] = h1;
+	pState->h[ 2 ] = h2;
+	pState->h[ 3 ] = h3;
+	pState->h[ 4 ] = h4;
+}
+
+void Poly1305_Finish( poly1305_t* pState, unsigned char* pTag )
+{
+	unsigned int h0 = pState->h[ 0 ], h1 = pState->h[ 1 ], h2 = pState->h[ 2 ], h3 = pState->h[ 3 ], h4 = pState->h[ 4 ];
+	unsigned int c;
+
+	c = h1 >> 26; h1 &= 0x3FFFFFF;
+	h2 += c; c = h2 >> 26; h2 &= 0x3FFFFFF;
+	h3 += c; c = h3 >> 26; h3 &= 0x3FFFFFF;
+	h4 += c; c = h4 >> 26; h4 &= 0x3FFFFFF;
+	h0 += c * 5; c = h0 >> 26; h0 &= 0x3FFFFFF;
+	h1 += c;
+
+	/* h - p, selected without branching when h >= p */
+	unsigned int g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3FFFFFF;
+	unsigned int g1 = h1 + c; c = g1 >> 26; g1 &= 0x3FFFFFF;
+	unsigned int g2 = h2 + c; c = g2 >> 26; g2 &= 0x3FFFFFF;
+	unsigned int g3 = h3 + c; c = g3 >> 26; g3 &= 0x3FFFFFF;
+	unsigned int g4 = h4 + c - ( 1 << 26 );
+
+	unsigned int nMask = ( g4 >> 31 ) - 1;
+	h0 = ( h0 & ~nMask ) | ( g0 & nMask );
+	h1 = ( h1 & ~nMask ) | ( g1 & nMask );
+	h2 = ( h2 & ~nMask ) | ( g2 & nMask );
+	h3 = ( h3 & ~nMask ) | ( g3 & nMask );
+	h4 = ( h4 & ~nMask ) | ( g4 & nMask );
+
+	h0 = ( h0 ) | ( h1 << 26 );
+	h1 = ( h1 >> 6 ) | ( h2 << 20 );
+	h2 = ( h2 >> 12 ) | ( h3 << 14 );
+	h3 = ( h3 >> 18 ) | ( h4 << 8 );
+
+	unsigned long long f;
+	f = ( unsigned long long ) h0 + pState->pad[ 0 ]; h0 = ( unsigned int ) f;
+	f = ( unsigned long long ) h1 + pState->pad[ 1 ] + ( f >> 32 ); h1 = ( unsigned int ) f;
+	f = ( unsigned long long ) h2 + pState->pad[ 2 ] + ( f >> 32 ); h2 = ( unsigned int ) f;
+	f = ( unsigned long long ) h3 + pState->pad[ 3 ] + ( f >> 32 ); h3 = ( unsigned int ) f;
+
+	memcpy( pTag + 0, &h0, 4 );
+	memcpy( pTag + 4, &h1, 4 );
+	memcpy( pTag + 8, &h2, 4 );
+	memcpy( pTag + 12, &h3, 4 );
+
+	SecureZeroMemory( pState, sizeof( poly1305_t ) );
+}
+
+/* Zero padded to a whole number of blocks */
+void Poly1305_Padded( poly1305_t* pState, const unsigned char* m, unsigned long nLength )
+{
+	unsigned long nFull = nLength & ~15UL;
+	Poly1305_Blocks( pState, m, nFull );
+
+	if ( nLength & 15 )
+	{
+		unsigned char last[ 16 ] = { 0 };
+		memcpy( last, m + nFull, nLength & 15 );
+
+		Poly1305_Blocks( pState, last, 16 );
+	}
+}
+
+/* AEAD tag, the associated data and ciphertext each padded to 16 bytes then both lengths */
+void ChaCha_ComputeTag( const unsigned char* pPolyKey, const unsigned char* pAAD, unsigned long nAADLength, const unsigned char* pCipherText, unsigned long nLength, unsigned char* pTag )
+{
+	poly1305_t poly;
+	Poly1305_Init( &poly, pPolyKey );
+
+	Poly1305_Padded( &poly, pAAD, nAADLength );
+	Poly1305_Padded( &poly, pCipherText, nLength );
+
+	unsigned char lengths[ 16 ];
+	unsigned long long nAADBytes = nAADLength;
+	unsigned long long nCipherLength = nLength;
+	memcpy( lengths, &nAADBytes, 8 );
+	memcpy( lengths + 8, &nCipherLength, 8 );
+
+	Poly1305_Blocks( &poly, lengths, 16 );
+	Poly1305_Finish( &poly, pTag );
+}
+
+unsigned long long NET_GenerateSalt()
+{
+	unsigned long long nSalt = 0;
+
+	if ( !BCRYPT_SUCCESS( BCryptGenRandom( NULL, ( PUCHAR ) &nSalt, sizeof( nSalt ), BCRYPT_USE_SYSTEM_PREFERRED_RNG ) ) )
+	{
+		/* Sessions still need distinct salts, predictable ones only weaken the nonce space */
+		LARGE_INTEGER nCounter;
+		QueryPerformanceCounter( &nCounter );
+
+		nSalt = ( unsigned long long ) nCounter.QuadPart * 0x9E3779B97F4A7C15ULL;
+	}
+
+	return nSalt;
+}
+
+CNetCipher::CNetCipher()
+{
+	memset( m_Key, 0, sizeof( m_Key ) );
+
+	ResetDirection( &m_Outgoing, 0 );
+	ResetDirection( &m_Incoming, 1 );
+}
+
+CNetCipher::~CNetCipher()
+{
+	SecureZeroMemory( m_Key, sizeof( m_Key ) );
+	SecureZeroMemory( m_Outgoing.m_Cache, sizeof( m_Outgoing.m_Cache ) );
+	SecureZeroMemory( m_Incoming.m_Cache, sizeof( m_Incoming.m_Cache ) );
+}
+
+void CNetCipher::SetKey( const unsigned char* pKey, unsigned long long nClientSalt, unsigned long long nServerSalt, bool bServer )
+{
+	unsigned char salts[ 16 ];
+	memcpy( salts, &nClientSalt, 8 );
+	memcpy( salts + 8, &nServerSalt, 8 );
+
+	HChaCha20( pKey, salts, m_Key );
+
+	/* Frames from the client use direction 0, frames from the server 1 */
+	ResetDirection( &m_Outgoing, bServer ? 1 : 0 );
+	ResetDirection( &m_Incoming, bServer ? 0 : 1 );
+}
+
+void CNetCipher::ResetDirection( direction_t* pDirection, unsigned int nDirection )
+{
+	pDirection->m_nDirection = nDirection;
+	pDirection->m_nFrame = 0;
+	pDirection->m_bCached = false;
+	pDirection->m_nCachedFrame = 0;
+}
+
+void CNetCipher::Crypt( direction_t* pDirection, unsigned char* pData, unsigned long nLength, unsigned char* pPolyKey )
+{
+	unsigned long long nFrame = pDirection->m_nFrame++;
+
+	unsigned int counters[ BLOCKS_PER_PASS ];
+	unsigned int nonces[ BLOCKS_PER_PASS * 3 ];
+
+	/* Block 0 keys Poly1305 and block 1 covers the payload, so two small frames share a pass */
+	if ( nLength <= BLOCK_SIZE )
+	{
+		if ( !pDirection->m_bCached || nFrame - pDirection->m_nCachedFrame > 1 )
+		{
+			for ( int i = 0; i < BLOCKS_PER_PASS; ++i )
+			{
+				unsigned long long nLaneFrame = nFrame + ( i >> 1 );
+
+				counters[ i ] = i & 1;
+				nonces[ i * 3 + 0 ] = pDirection->m_nDirection;
+				nonces[ i * 3 + 1 ] = ( unsigned int ) nLaneFrame;
+				nonces[ i * 3 + 2 ] = ( unsigned int ) ( nLaneFrame >> 32 );
+			}
+
+			ChaCha20_Blocks( m_Key, counters, nonces, pDirection->m_Cache );
+
+			pDirection->m_nCachedFrame = nFrame;
+			pDirection->m_bCached = true;
+		}
+
+		const unsigned char* pStream = pDirection->m_Cache + ( nFrame - pDirection->m_nCachedFrame ) * BLOCK_SIZE * 2;
+
+		memcpy( pPolyKey, pStream, 32 );
+		ChaCha_Xor( pData, pStream + BLOCK_SIZE, nLength );
+		return;
+	}
+
+	for ( int i = 0; i < BLOCKS_PER_PASS; ++i )
+	{
+		nonces[ i * 3 + 0 ] = pDirection->m_nDirection;
+		nonces[ i * 3 + 1 ] = ( unsigned int ) nFrame;
+		nonces[ i * 3 + 2 ] = ( unsigned int ) ( nFrame >> 32 );
+	}
+
+	unsigned char stream[ BLOCK_SIZE * BLOCKS_PER_PASS ];
+
+	for ( unsigned int nBlock = 0; nLength > 0; nBlock += BLOCKS_PER_PASS )
+	{
+		for ( int i = 0; i < BLOCKS_PER_PASS; ++i )
+			counters[ i ] = nBlock + i;
+
+		ChaCha20_Blocks( m_Key, counters, nonces, stream );
+
+		const unsigned char* pStream = stream;
+		unsigned long nStream = sizeof( stream );
+
+		if ( nBlock == 0 )
+		{
+			memcpy( pPolyKey, stream, 32 );
+
+			pStream += BLOCK_SIZE;
+			nStream -= BLOCK_SIZE;
+		}
+
+		unsigned long nChunk = min( nLength, nStream );
+		ChaCha_Xor( pData, pStream, nChunk );
+
+		pData += nChunk;
+		nLength -= nChunk;
+	}
+
+	SecureZeroMemory( stream, sizeof( stream ) );
+}
+
+long CNetCipher::TransformOutgoing( char* pData, long nLength, long nCapacity )
+{
+	return TransformOutgoing( pData, nLength, nCapacity, NULL, 0 );
+}
+
+long CNetCipher::TransformIncoming( const char* pData, long nLength, char* pOut, long nOutCapacity )
+{
+	return TransformIncoming( pData, nLength, pOut, nOutCapacity, NULL, 0 );
+}
+
+long CNetCipher::TransformOutgoing( char* pData, long nLength, long nCapacity, const void* pAAD, unsigned long nAADLength )
+{
+	if ( nLength < 0 || nLength + TAG_SIZE > nCapacity )
+		return -1;
+
+	unsigned char polyKey[ 32 ];
+	Crypt( &m_Outgoing, ( unsigned char* ) pData, nLength, polyKey );
+
+	ChaCha_ComputeTag( polyKey, ( const unsigned char* ) pAAD, nAADLength, ( const unsigned char* ) pData, nLength, ( unsigned char* ) pData + nLength );
+	SecureZeroMemory( polyKey, sizeof( polyKey ) );
+
+	return nLength + TAG_SIZE;
+}
+
+long CNetCipher::TransformIncoming( const char* pData, long nLength, char* pOut, long nOutCapacity, const void* pAAD, unsigned long nAADLength )
+{
+	long nPlainLength = nLength - TAG_SIZE;
+
+	if ( nPlainLength < 0 || nPlainLength > nOutCapacity )
+		return -1;
+
+	unsigned char polyKey[ 32 ];
+	unsigned char tag[ TAG_SIZE ];
+
+	memcpy( pOut, pData, nPlainLength );
+	Crypt( &m_Incoming, ( unsigned char* ) pOut, nPlainLength, polyKey );
+
+	ChaCha_ComputeTag( polyKey, ( const unsigned char* ) pAAD, nAADLength, ( const unsigned char* ) pData, nPlainLength, tag );
+	SecureZeroMemory( polyKey, sizeof( polyKey ) );
+
+	/* Compare in constant time */
+	unsigned char nDiff = 0;
+	for ( int i = 0; i < TAG_SIZE; ++i )
+		nDiff |= tag[ i ] ^ ( unsigned char ) pData[ nPlainLength + i ];
+
+	if ( nDiff )
+	{
+		SecureZeroMemory( pOut, nPlainLength );
+		return -1;
+	}
+
+	return nPlainLength;
+}
+
+bool NET_CipherSelfTest()
+{
+	/* AEAD test vector of RFC 8439, section 2.8.2 */
+	static const char szPlainText[] = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+
+	static const unsigned char aad[] = { 0x50, 0x51, 0x52, 0x53, 0xC0, 0xC1, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7 };
+
+	static const unsigned char cipherText[] =
+	{
+		0xD3, 0x1A, 0x8D, 0x34, 0x64, 0x8E, 0x60, 0xDB, 0x7B, 0x86, 0xAF, 0xBC, 0x53, 0xEF, 0x7E, 0xC2,
+		0xA4, 0xAD, 0xED, 0x51, 0x29, 0x6E, 0x08, 0xFE, 0xA9, 0xE2, 0xB5, 0xA7, 0x36, 0xEE, 0x62, 0xD6,
+		0x3D, 0xBE, 0xA4, 0x5E, 0x8C, 0xA9, 0x67, 0x12, 0x82, 0xFA, 0xFB, 0x69, 0xDA, 0x92, 0x72, 0x8B,
+		0x1A, 0x71, 0xDE, 0x0A, 0x9E, 0x06, 0x0B, 0x29, 0x05, 0xD6, 0xA5, 0xB6, 0x7E, 0xCD, 0x3B, 0x36,
+		0x92, 0xDD, 0xBD, 0x7F, 0x2D, 0x77, 0x8B, 0x8C, 0x98, 0x03, 0xAE, 0xE3, 0x28, 0x09, 0x1B, 0x58,
+		0xFA, 0xB3, 0x24, 0xE4, 0xFA, 0xD6, 0x75, 0x94, 0x55, 0x85, 0x80, 0x8B, 0x48, 0x31, 0xD7, 0xBC,
+		0x3F, 0xF4, 0xDE, 0xF0, 0x8E, 0x4B, 0x7A, 0x9D, 0xE5, 0x76, 0xD2, 0x65, 0x86, 0xCE, 0xC6, 0x4B,
+		0x61, 0x16
+	};
+
+	static const unsigned char expectedTag[ CNetCipher::TAG_SIZE ] =
+	{
+		0x1A, 0xE1, 0x0B, 0x59, 0x4F, 0x09, 0xE2, 0x6A, 0x7E, 0x90, 0x2E, 0xCB, 0xD0, 0x60, 0x06, 0x91
+	};
+
+	const unsigned long nLength = sizeof( szPlainText ) - 1;
+
+	unsigned char key[ CNetCipher::KEY_SIZE ];
+	for ( int i = 0; i < CNetCipher::KEY_SIZE; ++i )
+		key[ i ] = ( unsigned char ) ( 0x80 + i );
+
+	unsigned int keyWords[ CNetCipher::KEY_SIZE / 4 ];
+	memcpy( keyWords, key, sizeof( keyWords ) );
+
+	/* 07000000 40414243 44454647, block 0 keys Poly1305 and the payload starts at block 1 */
+	static const unsigned char nonce[ 12 ] = { 0x07, 0x00, 0x00, 0x00, 0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47 };
+
+	unsigned int counters[ CNetCipher::BLOCKS_PER_PASS ];
+	unsigned int nonces[ CNetCipher::BLOCKS_PER_PASS * 3 ];
+
+	for ( int i = 0; i < CNetCipher::BLOCKS_PER_PASS; ++i )
+	{
+		counters[ i ] = i;
+		memcpy( nonces + i * 3, nonce, sizeof( nonce ) );
+	}
+
+	unsigned char stream[ CNetCipher::BLOCK_SIZE * CNetCipher::BLOCKS_PER_PASS ];
+	ChaCha20_Blocks( keyWords, counters, nonces, stream );
+
+	unsigned char data[ sizeof( szPlainText ) ];
+	memcpy( data, szPlainText, nLength );
+	ChaCha_Xor( data, stream + CNetCipher::BLOCK_SIZE, nLength );
+
+	unsigned char tag[ CNetCipher::TAG_SIZE ];
+	ChaCha_ComputeTag( stream, aad, sizeof( aad ), data, nLength, tag );
+
+	return !memcmp( data, cipherText, nLength ) && !memcmp( tag, expectedTag, sizeof( tag ) );
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "stddef.h"
+#include "new"
+
+/*
+	Allocations
+
+	Steady state traffic doesn't touch the heap: frames are built and
+	received in buffers each channel allocates once, and messages come from
+	size classed free lists that keep the blocks of deleted messages, up to
+	a fixed number of bytes per class.
+
+	Every block the library does allocate comes from the allocator given
+	to NET_StartUp, the heap by default. Calls into it are counted per
+	path, so an allocation that creeps into the hot path shows up in
+	NET_GetAllocationStats. Containers the library keeps internally grow
+	on the global heap.
+*/
+
+class INetChannel;
+
+enum net_alloc_path_t
+{
+	NET_ALLOC_CHANNEL,			/* Channels, compressors and ciphers */
+	NET_ALLOC_SEND,				/* Frame buffers, one per channel */
+	NET_ALLOC_RECV,				/* Receive buffers, one per channel */
+	NET_ALLOC_MESSAGE,			/* Blocks for the message free lists, and messages too large for them */
+	NET_ALLOC_POOL,				/* Buffer pool blocks, transform scratch and growable writers */
+	NET_ALLOC_TRANSFER,			/* Transfer data, one buffer per transfer */
+	NET_ALLOC_GLOBAL,			/* Dictionaries, trace rings and other process wide state */
+
+	NET_ALLOC_PATH_COUNT
+};
+
+/* Power of two size classes, a hint for pooling allocators */
+#define NET_SIZE_CLASS_MIN_SHIFT	6		/* 64 bytes */
+#define NET_SIZE_CLASSES			16		/* ..2 megabytes, larger blocks have no class */
+
+/* -1 past the last class */
+__forceinline int			NET_GetSizeClass( size_t nBytes )
+{
+	int nSizeClass = 0;
+	while ( nSizeClass < NET_SIZE_CLASSES && ( ( size_t ) 1 << ( nSizeClass + NET_SIZE_CLASS_MIN_SHIFT ) ) < nBytes )
+		++nSizeClass;
+
+	return ( nSizeClass < NET_SIZE_CLASSES ) ? nSizeClass : -1;
+}
+
+__forceinline size_t		NET_GetSizeClassBytes( int nSizeClass ) { return ( size_t ) 1 << ( nSizeClass + NET_SIZE_CLASS_MIN_SHIFT ); }
+
+/* Free is called with the size, path and channel the block was allocated with, */
+/* so implementations can account per channel without keeping headers */
+class INetAllocator
+{
+public:
+	virtual ~INetAllocator() {};
+
+	/* nSizeClass is NET_GetSizeClass( nBytes ). pNetChannel owns the block, NULL for */
+	/* blocks shared between channels and the channel objects themselves. Mustn't */
+	/* return NULL, throw or abort on exhaustion like operator new */
+	virtual void*			Alloc( size_t nBytes, int nSizeClass, net_alloc_path_t nPath, INetChannel* pNetChannel ) = 0;
+	virtual void			Free( void* pBlock, size_t nBytes, int nSizeClass, net_alloc_path_t nPath, INetChannel* pNetChannel ) = 0;
+};
+
+struct net_alloc_stats_t
+{
+	unsigned long long		m_nAllocations[ NET_ALLOC_PATH_COUNT ];	/* Calls into the allocator */
+	unsigned long long		m_nBytes[ NET_ALLOC_PATH_COUNT ];
+	unsigned long long		m_nPooledMessages;	/* Messages served from the free lists */
+};
+
+void					NET_GetAllocationStats( net_alloc_stats_t* pStats );
+
+/* Used by NET_StartUp, NULL keeps the current one. The allocator can't change once anything */
+/* was allocated through the current one, it has to stay valid until the process exits */
+bool					NET_SetAllocator( INetAllocator* pAllocator );
+
+void*					NET_Alloc( size_t nBytes, net_alloc_path_t nPath, INetChannel* pNetChannel = NULL );
+void					NET_Free( void* pBlock, size_t nBytes, net_alloc_path_t nPath, INetChannel* pNetChannel = NULL );
+
+template< class T, class... Args >
+T*						NET_New( net_alloc_path_t nPath, INetChannel* pNetChannel, Args... args )
+{
+	return new ( NET_Alloc( sizeof( T ), nPath, pNetChannel ) ) T( args... );
+}
+
+template< class T >
+void					NET_Delete( T* pObject, net_alloc_path_t nPath, INetChannel* pNetChannel = NULL )
+{
+	if ( !pObject )
+		return;
+
+	pObject->~T();
+	NET_Free( pObject, sizeof( T ), nPath, pNetChannel );
+}
+
+/* Message storage, see INetMessage::operator new */
+void*					NET_AllocMessage( size_t nBytes );
+void					NET_FreeMessage( void* pBlock, size_t nBytes );
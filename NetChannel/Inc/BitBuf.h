@@ -1,115 +1,598 @@
 #pragma once
 
+#include "string.h"
+
+#if defined( _M_IX86 ) || defined( _M_X64 ) || defined( __SSE2__ )
+#include "emmintrin.h"
+#define BITBUF_SSE2
+#ifdef _MSC_VER
+#include "intrin.h"
+#endif
+#endif
+
+/*
+	Bit buffers
+
+	The cursor is kept in bits, bits are packed LSB first. Whole byte writes
+	and reads take a direct store / load when the cursor is byte aligned and
+	fall back to bit packing otherwise, so byte oriented payloads cost the
+	same as before.
+
+	Every access is bounds checked. Running past the end sets the overflow
+	flag instead of touching memory outside the buffer, unless the writer
+	was initialized as growable, in which case it moves to a larger block
+	from its buffer pool.
+*/
+
+#define BITS_TO_BYTES( nBits )		( ( ( nBits ) + 7 ) >> 3 )
+
+/* Size classed free lists for growable writers */
+class CBitBufPool
+{
+public:
+	CBitBufPool();
+	~CBitBufPool();
+
+	unsigned char		*Alloc( unsigned long nBytes, unsigned long *pCapacity );
+	void				Free( unsigned char *pData, unsigned long nCapacity );
+
+private:
+	enum
+	{
+		POOL_MIN_SHIFT	= 8,	/* 256 bytes */
+		POOL_BUCKETS	= 12	/* ..512 kilobytes */
+	};
+
+	struct free_block_t
+	{
+		free_block_t	*m_pNext;
+	};
+
+	free_block_t		*m_pFree[ POOL_BUCKETS ];
+	void				*m_hLock;
+};
+
+CBitBufPool				*BitBuf_GetDefaultPool();
+
+#ifdef BITBUF_SSE2
+__forceinline unsigned long BitBuf_CountTrailingZeros( unsigned int nMask )
+{
+#ifdef _MSC_VER
+	unsigned long nIndex;
+	_BitScanForward( &nIndex, nMask );
+	return nIndex;
+#else
+	return ( unsigned long ) __builtin_ctz( nMask );
+#endif
+}
+#endif
+
+/* Index of the first zero byte in pData, or nMax when there is none */
+__forceinline unsigned long BitBuf_FindTerminator( const unsigned char *pData, unsigned long nMax )
+{
+	unsigned long nOffset = 0;
+
+	if ( !nMax )
+		return 0;
+
+#ifdef BITBUF_SSE2
+	/* Aligned loads never cross a page, so reading the whole first block is safe */
+	const __m128i vZero = _mm_setzero_si128();
+	unsigned long nMisalign = ( unsigned long ) ( ( size_t ) pData & 15 );
+
+	unsigned int nMask = _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_load_si128( ( const __m128i * ) ( pData - nMisalign ) ), vZero ) ) >> nMisalign;
+	nOffset = 16 - nMisalign;
+
+	while ( !nMask )
+	{
+		if ( nOffset >= nMax )
+			return nMax;
+
+		nMask = _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_load_si128( ( const __m128i * ) ( pData + nOffset ) ), vZero ) ) << 16;
+		nOffset += 16;
+	}
+
+	/* Masks of later blocks are shifted up by 16 so the index math is shared */
+	unsigned long nIndex = ( nMask >> 16 ) ? ( nOffset - 32 + BitBuf_CountTrailingZeros( nMask ) ) : BitBuf_CountTrailingZeros( nMask );
+	return ( nIndex < nMax ) ? nIndex : nMax;
+#else
+	while ( nOffset < nMax && pData[ nOffset ] )
+		++nOffset;
+
+	return nOffset;
+#endif
+}
+
+__forceinline unsigned int BitBuf_ZigZagEncode32( int val )				{ return ( ( unsigned int ) val << 1 ) ^ ( unsigned int ) ( val >> 31 ); }
+__forceinline int BitBuf_ZigZagDecode32( unsigned int val )				{ return ( int ) ( val >> 1 ) ^ -( int ) ( val & 1 ); }
+__forceinline int BitBuf_VarInt32Size( unsigned int val )				{ return ( val < ( 1u << 7 ) ) ? 1 : ( val < ( 1u << 14 ) ) ? 2 : ( val < ( 1u << 21 ) ) ? 3 : ( val < ( 1u << 28 ) ) ? 4 : 5; }
+
 class bf_write
 {
 public:
+	bf_write()														{ m_pData = NULL; m_nDataBytes = 0; m_nCurBit = 0; m_bOverflow = false; m_pPool = NULL; }
+	~bf_write()														{ Release(); }
 
-	void				Init( void *pData, int nBytes )				{ m_pData = (unsigned char *) pData; m_nDataBytes = nBytes; m_nCurByte = 0; }
-	void				Reset()										{ m_nCurByte = 0; }
-	void				WriteChar( char val )						{ *(char *) ( m_pData + m_nCurByte ) = val; m_nCurByte += 1; }
-	void				WriteByte( unsigned char val )				{ *(unsigned char *) ( m_pData + m_nCurByte ) = val; m_nCurByte += 1; }
-	void				WriteShort( short val )						{ *(short *) ( m_pData + m_nCurByte ) = val; m_nCurByte += 2; }
-	void				WriteWord( unsigned short val )				{ *(unsigned short *) ( m_pData + m_nCurByte ) = val; m_nCurByte += 2; }
-	void				WriteLong( long val )						{ *(long *) ( m_pData + m_nCurByte ) = val; m_nCurByte += 4; }
-	void				WriteDWord( unsigned long val )				{ *(unsigned long *) ( m_pData + m_nCurByte ) = val; m_nCurByte += 4; }
-	void				WriteFloat( float val )						{ *(float *) ( m_pData + m_nCurByte ) = val; m_nCurByte += 4; }
+	void				Init( void *pData, int nBytes )				{ Release(); m_pData = (unsigned char *) pData; m_nDataBytes = nBytes; m_nCurBit = 0; m_bOverflow = false; }
+	void				InitGrowable( int nBytes, CBitBufPool *pPool = BitBuf_GetDefaultPool() );
+	void				Release();
+	void				Reset()										{ m_nCurBit = 0; m_bOverflow = false; }
+	void				WriteChar( char val )						{ WriteByte( ( unsigned char ) val ); }
+	void				WriteByte( unsigned char val );
+	void				WriteShort( short val )						{ WriteWord( ( unsigned short ) val ); }
+	void				WriteWord( unsigned short val );
+	void				WriteLong( long val )						{ WriteDWord( ( unsigned long ) val ); }
+	void				WriteDWord( unsigned long val );
+	void				WriteFloat( float val )						{ unsigned long nBits; memcpy( &nBits, &val, 4 ); WriteDWord( nBits ); }
 	void				WriteBytes( const void *pBuf, int nBytes );
 	void				WriteString( const char *pStr );
 
+	/* Bit granular writes */
+	void				WriteOneBit( int nValue );
+	void				WriteUBitLong( unsigned int val, int nBits );
+	void				WriteSBitLong( int val, int nBits )			{ WriteUBitLong( ( unsigned int ) val, nBits ); }
+	void				WriteRangedFloat( float val, float flMin, float flMax, int nBits );
+
+	/* Variable length integers, 7 bits per byte, small values take a single byte */
+	void				WriteVarInt32( unsigned int val );
+	void				WriteSignedVarInt32( int val )				{ WriteVarInt32( BitBuf_ZigZagEncode32( val ) ); }
+
+	bool				IsOverflowed() const						{ return m_bOverflow; }
+	bool				IsGrowable() const							{ return ( m_pPool != NULL ); }
+	bool				IsByteAligned() const						{ return ( m_nCurBit & 7 ) == 0; }
 	unsigned char		*GetData() const							{ return m_pData; }
-	unsigned long		GetNumBytesLeft() const						{ return m_nDataBytes - m_nCurByte; }
-	unsigned long		GetNumBytesWritten() const					{ return m_nCurByte; }
+	unsigned long		GetNumBytesLeft() const						{ return m_nDataBytes - BITS_TO_BYTES( m_nCurBit ); }
+	unsigned long		GetNumBytesWritten() const					{ return BITS_TO_BYTES( m_nCurBit ); }
+	unsigned long		GetNumBitsWritten() const					{ return m_nCurBit; }
 
 protected:
+	/* Makes room for nBits more bits, false when the write has to be dropped */
+	bool				CheckForOverflow( unsigned long nBits )
+	{
+		if ( m_nCurBit + nBits <= ( m_nDataBytes << 3 ) )
+			return true;
+
+		return Grow( nBits );
+	}
+
+	bool				Grow( unsigned long nBits );
+
 	unsigned char		*m_pData;
 	unsigned long		m_nDataBytes;
-	unsigned long		m_nCurByte;
+	unsigned long		m_nCurBit;
+	bool				m_bOverflow;
+
+	/* Growable writers own m_pData, which came from m_pPool */
+	CBitBufPool			*m_pPool;
+
+private:
+	bf_write( const bf_write& );
+	bf_write& operator=( const bf_write& );
 };
 
-__forceinline void bf_write::WriteBytes( const void *pBuf, int nBytes )
+__forceinline void bf_write::WriteUBitLong( unsigned int val, int nBits )
 {
-	int nStart = 0;
+	if ( !CheckForOverflow( nBits ) )
+		return;
 
-	do
+	while ( nBits > 0 )
 	{
-		WriteByte( *(unsigned char *) ( (unsigned char *) pBuf + nStart ) );
-		++nStart;
-		--nBytes;
+		unsigned long nByte = m_nCurBit >> 3;
+		int nBitOffset = m_nCurBit & 7;
+		int nChunk = 8 - nBitOffset;
+
+		if ( nChunk > nBits )
+			nChunk = nBits;
+
+		unsigned int nMask = ( ( 1u << nChunk ) - 1 ) << nBitOffset;
+		m_pData[ nByte ] = ( unsigned char ) ( ( m_pData[ nByte ] & ~nMask ) | ( ( val << nBitOffset ) & nMask ) );
+
+		val >>= nChunk;
+		nBits -= nChunk;
+		m_nCurBit += nChunk;
 	}
-	while ( nBytes );
 }
 
-__forceinline void bf_write::WriteString( const char *pStr )
+__forceinline void bf_write::WriteOneBit( int nValue )
 {
-	int nStart = 0;
+	if ( !CheckForOverflow( 1 ) )
+		return;
 
-	if ( pStr )
+	unsigned long nByte = m_nCurBit >> 3;
+	unsigned char nMask = ( unsigned char ) ( 1 << ( m_nCurBit & 7 ) );
+
+	if ( nValue )
+		m_pData[ nByte ] |= nMask;
+	else
+		m_pData[ nByte ] &= ~nMask;
+
+	++m_nCurBit;
+}
+
+__forceinline void bf_write::WriteByte( unsigned char val )
+{
+	if ( !IsByteAligned() )
+	{
+		WriteUBitLong( val, 8 );
+		return;
+	}
+
+	if ( !CheckForOverflow( 8 ) )
+		return;
+
+	m_pData[ m_nCurBit >> 3 ] = val;
+	m_nCurBit += 8;
+}
+
+__forceinline void bf_write::WriteWord( unsigned short val )
+{
+	if ( !IsByteAligned() )
 	{
-		do
+		WriteUBitLong( val, 16 );
+		return;
+	}
+
+	if ( !CheckForOverflow( 16 ) )
+		return;
+
+	memcpy( m_pData + ( m_nCurBit >> 3 ), &val, 2 );
+	m_nCurBit += 16;
+}
+
+__forceinline void bf_write::WriteDWord( unsigned long val )
+{
+	if ( !IsByteAligned() )
+	{
+		WriteUBitLong( ( unsigned int ) val, 32 );
+		return;
+	}
+
+	if ( !CheckForOverflow( 32 ) )
+		return;
+
+	memcpy( m_pData + ( m_nCurBit >> 3 ), &val, 4 );
+	m_nCurBit += 32;
+}
+
+__forceinline void bf_write::WriteRangedFloat( float val, float flMin, float flMax, int nBits )
+{
+	unsigned int nRange = ( nBits >= 32 ) ? 0xFFFFFFFF : ( ( 1u << nBits ) - 1 );
+	double flNormal = ( ( double ) val - flMin ) / ( ( double ) flMax - flMin );
+
+	/* NaN goes to the bottom of the range */
+	if ( !( flNormal > 0.0 ) )
+		flNormal = 0.0;
+	else if ( flNormal > 1.0 )
+		flNormal = 1.0;
+
+	/* A float can't hold 2^32 - 1, in double the product stays in range for 32 bits */
+	double flValue = flNormal * nRange + 0.5;
+
+	WriteUBitLong( ( flValue >= ( double ) nRange ) ? nRange : ( unsigned int ) flValue, nBits );
+}
+
+__forceinline void bf_write::WriteVarInt32( unsigned int val )
+{
+	if ( !IsByteAligned() )
+	{
+		while ( val > 0x7F )
 		{
-			WriteChar( *pStr );
-			++nStart;
-			++pStr;
+			WriteUBitLong( ( val & 0x7F ) | 0x80, 8 );
+			val >>= 7;
 		}
-		while ( *( pStr - 1 ) != 0 );
+
+		WriteUBitLong( val, 8 );
+		return;
 	}
-	else
+
+	/* One check for the whole value, then straight stores */
+	int nBytes = BitBuf_VarInt32Size( val );
+
+	if ( !CheckForOverflow( ( unsigned long ) nBytes << 3 ) )
+		return;
+
+	unsigned char *pDest = m_pData + ( m_nCurBit >> 3 );
+
+	for ( int i = 0; i < nBytes - 1; ++i )
 	{
-		WriteChar( 0 );
+		pDest[ i ] = ( unsigned char ) ( ( val & 0x7F ) | 0x80 );
+		val >>= 7;
+	}
+
+	pDest[ nBytes - 1 ] = ( unsigned char ) val;
+	m_nCurBit += ( unsigned long ) nBytes << 3;
+}
+
+__forceinline void bf_write::WriteBytes( const void *pBuf, int nBytes )
+{
+	if ( nBytes <= 0 )
+		return;
+
+	const unsigned char *pData = (const unsigned char *) pBuf;
+
+	if ( !IsByteAligned() )
+	{
+		while ( nBytes > 0 )
+		{
+			WriteUBitLong( *pData, 8 );
+			++pData;
+			--nBytes;
+		}
+
+		return;
 	}
+
+	if ( !CheckForOverflow( ( unsigned long ) nBytes << 3 ) )
+		return;
+
+	memcpy( m_pData + ( m_nCurBit >> 3 ), pData, nBytes );
+	m_nCurBit += ( unsigned long ) nBytes << 3;
+}
+
+__forceinline void bf_write::WriteString( const char *pStr )
+{
+	if ( pStr )
+		WriteBytes( pStr, ( int ) strlen( pStr ) + 1 );
+	else
+		WriteChar( 0 );
 }
 
 class bf_read
 {
 public:
+	bf_read()														{ m_pData = NULL; m_nDataBytes = 0; m_nCurBit = 0; m_bOverflow = false; }
 
-	void				Init( const void *pData, int nBytes )		{ m_pData = (unsigned char *) pData; m_nDataBytes = nBytes; m_nCurByte = 0; }
-	void				Reset()										{ m_nCurByte = 0; }
-	char				ReadChar()									{ char ret = *(char *) ( m_pData + m_nCurByte ); m_nCurByte += 1; return ret; }
-	unsigned char		ReadByte()									{ unsigned char ret = *(unsigned char *) ( m_pData + m_nCurByte ); m_nCurByte += 1; return ret; }
-	short				ReadShort()									{ short ret = *(short *) ( m_pData + m_nCurByte ); m_nCurByte += 2; return ret; }
-	unsigned short		ReadWord()									{ unsigned short ret = *(unsigned short *) ( m_pData + m_nCurByte ); m_nCurByte += 2; return ret; }
-	long				ReadLong()									{ long ret = *(long *) ( m_pData + m_nCurByte ); m_nCurByte += 4; return ret; }
-	unsigned long		ReadDWord()									{ unsigned long ret = *(unsigned long *) ( m_pData + m_nCurByte ); m_nCurByte += 4; return ret; }
-	float				ReadFloat()									{ float ret = *(float *) ( m_pData + m_nCurByte ); m_nCurByte += 4; return ret; }
+	void				Init( const void *pData, int nBytes )		{ m_pData = (unsigned char *) pData; m_nDataBytes = nBytes; m_nCurBit = 0; m_bOverflow = false; }
+	void				Reset()										{ m_nCurBit = 0; m_bOverflow = false; }
+	char				ReadChar()									{ return ( char ) ReadByte(); }
+	unsigned char		ReadByte();
+	short				ReadShort()									{ return ( short ) ReadWord(); }
+	unsigned short		ReadWord();
+	long				ReadLong()									{ return ( long ) ReadDWord(); }
+	unsigned long		ReadDWord();
+	float				ReadFloat()									{ unsigned long nBits = ReadDWord(); float ret; memcpy( &ret, &nBits, 4 ); return ret; }
 	void				ReadBytes( void *pOut, int nBytes );
+	void				SkipBytes( int nBytes )						{ if ( nBytes > 0 && CheckForOverflow( ( unsigned long ) nBytes << 3 ) ) m_nCurBit += ( unsigned long ) nBytes << 3; }
 	int					ReadString( char *pStr, int bufLen );
 
+	/* Bit granular reads */
+	int					ReadOneBit();
+	unsigned int		ReadUBitLong( int nBits );
+	int					ReadSBitLong( int nBits );
+	float				ReadRangedFloat( float flMin, float flMax, int nBits );
+
+	unsigned int		ReadVarInt32();
+	int					ReadSignedVarInt32()						{ return BitBuf_ZigZagDecode32( ReadVarInt32() ); }
+
+	bool				IsOverflowed() const						{ return m_bOverflow; }
+	bool				IsByteAligned() const						{ return ( m_nCurBit & 7 ) == 0; }
 	const unsigned char	*GetData() const							{ return m_pData; }
-	unsigned long		GetNumBytesLeft() const						{ return m_nDataBytes - m_nCurByte; }
-	unsigned long		GetNumBytesRead() const						{ return m_nCurByte; }
+	unsigned long		GetNumBytesLeft() const						{ return m_nDataBytes - BITS_TO_BYTES( m_nCurBit ); }
+	unsigned long		GetNumBytesRead() const						{ return BITS_TO_BYTES( m_nCurBit ); }
+	unsigned long		GetNumBitsRead() const						{ return m_nCurBit; }
+
+protected:
+	bool				CheckForOverflow( unsigned long nBits )
+	{
+		if ( m_nCurBit + nBits <= ( m_nDataBytes << 3 ) )
+			return true;
+
+		m_nCurBit = m_nDataBytes << 3;
+		m_bOverflow = true;
+		return false;
+	}
 
 public:
 	const unsigned char	*m_pData;
 	unsigned long		m_nDataBytes;
-	unsigned long		m_nCurByte;
+	unsigned long		m_nCurBit;
+	bool				m_bOverflow;
 };
 
-__forceinline void bf_read::ReadBytes( void *pOut, int nBytes )
+__forceinline unsigned int bf_read::ReadUBitLong( int nBits )
+{
+	if ( !CheckForOverflow( nBits ) )
+		return 0;
+
+	unsigned int ret = 0;
+	int nShift = 0;
+
+	while ( nBits > 0 )
+	{
+		int nBitOffset = m_nCurBit & 7;
+		int nChunk = 8 - nBitOffset;
+
+		if ( nChunk > nBits )
+			nChunk = nBits;
+
+		unsigned int nValue = ( m_pData[ m_nCurBit >> 3 ] >> nBitOffset ) & ( ( 1u << nChunk ) - 1 );
+		ret |= nValue << nShift;
+
+		nShift += nChunk;
+		nBits -= nChunk;
+		m_nCurBit += nChunk;
+	}
+
+	return ret;
+}
+
+__forceinline int bf_read::ReadSBitLong( int nBits )
+{
+	if ( nBits <= 0 )
+		return 0;
+
+	unsigned int ret = ReadUBitLong( nBits );
+
+	/* Sign extend */
+	if ( nBits < 32 && ( ret & ( 1u << ( nBits - 1 ) ) ) )
+		ret |= ~( ( 1u << nBits ) - 1 );
+
+	return ( int ) ret;
+}
+
+__forceinline int bf_read::ReadOneBit()
+{
+	if ( !CheckForOverflow( 1 ) )
+		return 0;
+
+	int ret = ( m_pData[ m_nCurBit >> 3 ] >> ( m_nCurBit & 7 ) ) & 1;
+	++m_nCurBit;
+	return ret;
+}
+
+__forceinline unsigned char bf_read::ReadByte()
+{
+	if ( !IsByteAligned() )
+		return ( unsigned char ) ReadUBitLong( 8 );
+
+	if ( !CheckForOverflow( 8 ) )
+		return 0;
+
+	unsigned char ret = m_pData[ m_nCurBit >> 3 ];
+	m_nCurBit += 8;
+	return ret;
+}
+
+__forceinline unsigned short bf_read::ReadWord()
+{
+	if ( !IsByteAligned() )
+		return ( unsigned short ) ReadUBitLong( 16 );
+
+	if ( !CheckForOverflow( 16 ) )
+		return 0;
+
+	unsigned short ret;
+	memcpy( &ret, m_pData + ( m_nCurBit >> 3 ), 2 );
+	m_nCurBit += 16;
+	return ret;
+}
+
+__forceinline unsigned long bf_read::ReadDWord()
+{
+	if ( !IsByteAligned() )
+		return ReadUBitLong( 32 );
+
+	if ( !CheckForOverflow( 32 ) )
+		return 0;
+
+	unsigned long ret = 0;
+	memcpy( &ret, m_pData + ( m_nCurBit >> 3 ), 4 );
+	m_nCurBit += 32;
+	return ret;
+}
+
+__forceinline float bf_read::ReadRangedFloat( float flMin, float flMax, int nBits )
 {
-	int nStart = 0;
+	unsigned int nRange = ( nBits >= 32 ) ? 0xFFFFFFFF : ( ( 1u << nBits ) - 1 );
+	unsigned int val = ReadUBitLong( nBits );
+
+	return flMin + ( flMax - flMin ) * ( ( float ) val / ( float ) nRange );
+}
+
+__forceinline unsigned int bf_read::ReadVarInt32()
+{
+	/* Room for the longest encoding, decode in place and advance once */
+	if ( IsByteAligned() && GetNumBytesLeft() >= 5 )
+	{
+		const unsigned char *pSrc = m_pData + ( m_nCurBit >> 3 );
+		unsigned int ret = pSrc[ 0 ] & 0x7F;
+		int nBytes = 1;
+
+		while ( nBytes < 5 && ( pSrc[ nBytes - 1 ] & 0x80 ) )
+		{
+			ret |= ( unsigned int ) ( pSrc[ nBytes ] & 0x7F ) << ( 7 * nBytes );
+			++nBytes;
+		}
+
+		m_nCurBit += ( unsigned long ) nBytes << 3;
+		return ret;
+	}
+
+	unsigned int ret = 0;
+	int nShift = 0;
+	unsigned char b;
 
 	do
 	{
-		*(unsigned char *) ( (int) pOut + nStart ) = ReadByte();
-		++nStart;
-		--nBytes;
+		if ( nShift >= 35 )
+			return ret;
+
+		b = ReadByte();
+		ret |= ( unsigned int ) ( b & 0x7F ) << nShift;
+		nShift += 7;
 	}
-	while ( nBytes );
+	while ( b & 0x80 );
+
+	return ret;
+}
+
+__forceinline void bf_read::ReadBytes( void *pOut, int nBytes )
+{
+	if ( nBytes <= 0 )
+		return;
+
+	unsigned char *pData = (unsigned char *) pOut;
+
+	if ( !IsByteAligned() )
+	{
+		while ( nBytes > 0 )
+		{
+			*pData = ( unsigned char ) ReadUBitLong( 8 );
+			++pData;
+			--nBytes;
+		}
+
+		return;
+	}
+
+	if ( !CheckForOverflow( ( unsigned long ) nBytes << 3 ) )
+	{
+		memset( pOut, 0, nBytes );
+		return;
+	}
+
+	memcpy( pData, m_pData + ( m_nCurBit >> 3 ), nBytes );
+	m_nCurBit += ( unsigned long ) nBytes << 3;
 }
 
 __forceinline int bf_read::ReadString( char *pStr, int bufLen )
 {
-	int nStart = 0;
-	char c = 0;
+	if ( bufLen <= 0 )
+		return 0;
 
-	do
+	int nLength = 0;
+
+	if ( IsByteAligned() )
 	{
-		c = ReadChar();
-		*(char *) ( pStr + nStart ) = c;
-		++nStart;
+		unsigned long nBytesLeft = GetNumBytesLeft();
+		const unsigned char *pData = m_pData + ( m_nCurBit >> 3 );
+		unsigned long nTerminator = BitBuf_FindTerminator( pData, nBytesLeft );
+
+		/* Strings that don't fit are truncated, the rest is skipped */
+		nLength = ( nTerminator < ( unsigned long ) bufLen - 1 ) ? ( int ) nTerminator : bufLen - 1;
+		memcpy( pStr, pData, nLength );
+
+		if ( nTerminator == nBytesLeft )
+		{
+			m_nCurBit = m_nDataBytes << 3;
+			m_bOverflow = true;
+		}
+		else
+		{
+			m_nCurBit += ( nTerminator + 1 ) << 3;
+		}
+	}
+	else
+	{
+		char c;
+
+		while ( ( c = ReadChar() ) != 0 && !m_bOverflow )
+		{
+			if ( nLength < bufLen - 1 )
+				pStr[ nLength++ ] = c;
+		}
 	}
-	while ( nStart < bufLen && c );
 
-	return nStart - 1;
+	pStr[ nLength ] = 0;
+	return nLength;
 }
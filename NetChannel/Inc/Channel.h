@@ -2,6 +2,8 @@
 
 #include "Protocol.h"
 #include "BitBuf.h"
+#include "Schema.h"
+#include "Alloc.h"
 
 #include "winsock2.h"
 #include "ws2tcpip.h"
@@ -13,9 +15,33 @@
 enum net_channel_flags_t
 {
 	NET_DISCONNECT_BY_HOST		= ( 1 << 0 ),
-	NET_DISCONNECT_BY_PROTOCOL	= ( 1 << 1 )
+	NET_DISCONNECT_BY_PROTOCOL	= ( 1 << 1 ),
+	NET_DISCONNECT_LOCAL		= ( 1 << 2 )
 };
 
+enum net_message_flags_t
+{
+	NET_MSG_FROM_CLIENT			= ( 1 << 0 ),	/* Accepted by server channels */
+	NET_MSG_FROM_SERVER			= ( 1 << 1 ),	/* Accepted by client channels */
+	NET_MSG_REQUIRED			= ( 1 << 2 ),	/* Can't be disabled with SetMessageFilter */
+	NET_MSG_HANDLER				= ( 1 << 3 ),	/* Skipped when the channel has no message handler */
+
+	NET_MSG_DEFAULT				= ( NET_MSG_FROM_CLIENT | NET_MSG_FROM_SERVER | NET_MSG_HANDLER )
+};
+
+/* Each channel queues outgoing messages per lane. Control goes out first, */
+/* interactive and bulk share the rest by NET_PRIORITY_WEIGHT */
+enum net_priority_t
+{
+	NET_PRIORITY_CONTROL,		/* Handshake, pings, tickrate and disconnects */
+	NET_PRIORITY_INTERACTIVE,
+	NET_PRIORITY_BULK,			/* Transfers */
+
+	NET_PRIORITY_COUNT
+};
+
+struct net_metrics_t;
+
 class INetChannel;
 class INetMessage;
 class INetIntermediateContext;
@@ -27,6 +53,43 @@ typedef void( *ServerRunFrameFn )();
 typedef bool ( *ServerConnectionNotifyFn )( INetChannel* pNetChannel, int nState );
 typedef void( *OnHandlerMessageReceivedFn )( INetChannel* pNetChannel, INetMessage* pNetMessage );
 typedef void( *OnDataTransmissionProgressFn )( const void* pProps, long nPropsLength, long nBytesReceived, long nBytesTotal );
+typedef INetMessage* ( *NetMessageFactoryFn )( INetChannel* pNetChannel );
+
+struct net_compression_stats_t
+{
+	unsigned long long		m_nRawBytesOut;
+	unsigned long long		m_nWireBytesOut;
+	unsigned long long		m_nRawBytesIn;
+	unsigned long long		m_nWireBytesIn;
+	unsigned long			m_nFramesCompressed;
+	unsigned long			m_nFramesRaw;		/* Incompressible, too small or skipped */
+	double					m_flCompressTime;	/* Seconds */
+	double					m_flDecompressTime;
+};
+
+struct net_tick_stats_t
+{
+	unsigned long long		m_nTicks;
+	unsigned long long		m_nOverruns;		/* Ticks that ran past the next deadline */
+	unsigned long long		m_nSkippedTicks;	/* Whole intervals dropped after overruns */
+	double					m_flWorkTime;		/* Seconds spent in ProcessSocket */
+	double					m_flMaxWorkTime;
+	double					m_flJitter;			/* Seconds off the deadline, summed over ticks that waited */
+	double					m_flMaxJitter;
+	bool					m_bHighResolution;	/* Waits aren't rounded to the 1 ms timer period */
+};
+
+/* Estimates from timestamped pings, all in seconds */
+struct net_latency_stats_t
+{
+	unsigned long long		m_nSamples;
+	double					m_flRTT;			/* Smoothed as in RFC 6298 */
+	double					m_flRTTVariance;	/* Mean deviation, RTTVAR of RFC 6298 */
+	double					m_flMinRTT;
+	double					m_flLastRTT;
+	double					m_flJitter;			/* Smoothed change between consecutive samples, as in RFC 3550 */
+	double					m_flClockOffset;	/* Peer clock minus ours, see NET_GetTime */
+};
 
 class CCriticalSectionAutolock
 {
@@ -54,11 +117,18 @@ public:
 	INetMessage( INetChannel* pNetChannel );
 	virtual ~INetMessage() {};
 
+	/* Deleted messages keep their block for the next one of the size, see Alloc.h */
+	static void*			operator new( size_t nBytes )					{ return NET_AllocMessage( nBytes ); }
+	static void				operator delete( void* pBlock, size_t nBytes )	{ NET_FreeMessage( pBlock, nBytes ); }
+
 	virtual int				Serialize( void* pBuf, unsigned long nSize ) = 0;
 	virtual bool			DeSerialize( void* pBuf, unsigned long nSize ) = 0;
-	virtual void			ProcessMessage() = 0;
+
+	/* Delivers the message to the channel's message handler by default */
+	virtual void			ProcessMessage();
 
 	virtual int				GetType() const = 0;
+	virtual int				GetPriority() const { return NET_PRIORITY_INTERACTIVE; }
 	
 	void*					CreateManifest( void* pBuf, unsigned long nSize ) const
 	{
@@ -69,13 +139,18 @@ public:
 		return static_cast< void* >( ( char* ) pBuf + PACKET_MANIFEST_SIZE );
 	}
 
-	INetChannel*			GetChannel()
+	INetChannel*			GetChannel() const
 	{
 		return m_pNetChannel;
 	}
 
+	/* Assigned when queued while tracing, see Trace.h */
+	unsigned long			GetTraceId() const						{ return m_nTraceId; }
+	void					SetTraceId( unsigned long nTraceId )	{ m_nTraceId = nTraceId; }
+
 private:
 	INetChannel*			m_pNetChannel;
+	unsigned long			m_nTraceId;
 };
 
 class INetChannel
@@ -96,16 +171,47 @@ public:
 	virtual void			SetTickRate( long nTickRate ) = 0;
 	virtual void			SetOutgoingSequenceNr( long nSeq )		= 0;
 	virtual void			SetIncomingSequenceNr( long nSeq )		= 0;
+	virtual void			SetZeroCopyReceive( bool bEnable )		= 0;
+	virtual void			SetMessageFilter( int nType, bool bAccept ) = 0;
+
+	/* Features offered on the next handshake, GetFeatures returns the negotiated set */
+	virtual void			SetFeatures( unsigned long nFeatures )	= 0;
+
+	/* Largest bundle ProcessOutgoing packs small messages into, 0 sends each on its own */
+	virtual void			SetBundleSize( long nBytes )			= 0;
+
+	/* Egress cap in bytes per second, 0 for none. Transfers are paced to it as well */
+	virtual void			SetRateLimit( unsigned long nBytesPerSecond ) = 0;
+
+	/* Registered dictionary offered with compression, see NET_RegisterDictionary */
+	virtual void			SetDictionary( unsigned long nDictionaryId ) = 0;
+
+	/* NET_ENCRYPTION_KEY_SIZE byte pre-shared key, NULL clears it. A keyed channel refuses */
+	/* peers that don't negotiate NET_FEATURE_ENCRYPTION and NET_FEATURE_CHUNKED_TRANSFER */
+	virtual void			SetEncryptionKey( const unsigned char* pKey ) = 0;
 
 	virtual bool			IsConnected()							const = 0;
 	virtual bool			IsSending()								const = 0;
 	virtual bool			IsReceiving()							const = 0;
 	virtual bool			IsActiveTransmission()					const = 0;
 	virtual bool			IsActiveSocket()						const = 0;
+	virtual bool			IsZeroCopyReceive()						const = 0;
+	virtual bool			IsMessageAccepted( int nType )			const = 0;
 	virtual const char*		GetDisconnectReason()					const = 0;
 	virtual const char*		GetHostIPString()						const = 0;
 	virtual unsigned long	GetHostIP()								const = 0;
 	virtual unsigned long	GetFlags()								const = 0;
+	virtual unsigned long	GetFeatures()							const = 0;
+	virtual unsigned long	GetDictionary()							const = 0;
+	virtual bool			GetCompressionStats( net_compression_stats_t* pStats ) const = 0;
+	virtual void			GetTickStats( net_tick_stats_t* pStats )	const = 0;
+
+	/* False until the first round trip has been measured */
+	virtual bool			GetLatencyStats( net_latency_stats_t* pStats ) const = 0;
+	virtual double			GetRTT()								const = 0;
+
+	/* Counters and histograms of this channel, see Metrics.h */
+	virtual void			GetMetrics( net_metrics_t* pMetrics )	const = 0;
 	virtual long			GetOutgoingSequenceNr()					const = 0;
 	virtual long			GetIncomingSequenceNr()					const = 0;
 	virtual long			GetTransferSequenceNr()					const = 0;
@@ -113,10 +219,11 @@ public:
 	virtual unsigned int	GetSocket()								const = 0;
 
 protected:
+	friend class INetMessage;
 	friend class CNETHandlerMessage;
 	friend class CNETDisconnect;
 
-	virtual void			ProcessHandlerMessage( CNETHandlerMessage* pNetMessage ) = 0;
+	virtual void			ProcessHandlerMessage( INetMessage* pNetMessage ) = 0;
 	virtual void			DisconnectInternal( CNETDisconnect* pNetDisconnect ) = 0;
 };
 
@@ -124,28 +231,129 @@ class INetIntermediateContext
 {
 public:
 	virtual ~INetIntermediateContext() {};
-	virtual void			ProcessOutgoing( char* pData, long nLength ) = 0;
-	virtual void			ProcessIncoming( char* pData, long nLength ) = 0;
+
+	/* In place, the length stays the same */
+	virtual void			ProcessOutgoing( char* pData, long nLength ) {}
+	virtual void			ProcessIncoming( char* pData, long nLength ) {}
+
+	/* Contexts that change the length return true here and get the Transform calls */
+	/* instead. Both return the new length, or -1 to drop the connection. */
+	/* TransformOutgoing works in place, pData has room for nCapacity bytes */
+	virtual bool			IsLengthChanging() const { return false; }
+	virtual long			TransformOutgoing( char* pData, long nLength, long nCapacity ) { return -1; }
+	virtual long			TransformIncoming( const char* pData, long nLength, char* pOut, long nOutCapacity ) { return -1; }
+};
+
+/* Fixed layout messages generated from a schema */
+
+template< class T, int nType, class... Fields >
+class CNetSchemaMessage : public INetMessage
+{
+public:
+	typedef net_schema_t< Fields... > schema_t;
+
+	CNetSchemaMessage( INetChannel* pNetChannel ) : INetMessage( pNetChannel )
+	{
+		memset( &m_Schema, 0, sizeof( m_Schema ) );
+	}
+
+	int						Serialize( void* pBuf, unsigned long nSize )
+	{
+		unsigned char* pData = ( unsigned char* ) CreateManifest( pBuf, nSize );
+
+		if ( !pData || nSize < GetSchemaPacketSize() )
+			return -1;
+
+		static_cast< T* >( this )->PreSerialize();
+
+		m_Schema.Encode( pData );
+		return GetSchemaPacketSize();
+	}
+
+	bool					DeSerialize( void* pBuf, unsigned long nSize )
+	{
+		if ( nSize != GetSchemaPacketSize() )
+			return false;
+
+		m_Schema.Decode( ( const unsigned char* ) pBuf );
+		return true;
+	}
+
+	int						GetType() const { return nType; }
+
+	static constexpr unsigned long GetSchemaPacketSize()		{ return PACKET_MANIFEST_SIZE + schema_t::SIZE; }
+
+	/* Non-virtual codecs for the payload without the manifest */
+	__forceinline void		Encode( unsigned char* pData ) const	{ m_Schema.Encode( pData ); }
+	__forceinline void		Decode( const unsigned char* pData )	{ m_Schema.Decode( pData ); }
+
+protected:
+	/* Called before encoding, derived messages hide it to fill fields from the channel */
+	void					PreSerialize() {}
+
+	/* Peers on an older revision omit the fields appended since, */
+	/* those decode as zero */
+	bool					DeSerializePrefix( void* pBuf, unsigned long nSize, unsigned long nMinSize )
+	{
+		if ( nSize < nMinSize || nSize > GetSchemaPacketSize() )
+			return false;
+
+		unsigned char data[ schema_t::SIZE + 1 ] = { 0 };
+		memcpy( data, pBuf, nSize - PACKET_MANIFEST_SIZE );
+
+		m_Schema.Decode( data );
+		return true;
+	}
+
+	template< int N >
+	decltype( auto )		Field()							{ return net_schema_field_t< N >::Get( m_Schema ); }
+
+	template< int N >
+	decltype( auto )		Field() const					{ return net_schema_field_t< N >::Get( m_Schema ); }
+
+private:
+	schema_t				m_Schema;
 };
 
 /* Networked messages derived from INetMessage */
 
-class CNETPing : public INetMessage
+/* Timestamps are NET_GetTime microseconds. The echo is the send time of the */
+/* last ping received from the peer and how long it was held before this one */
+class CNETPing : public CNetSchemaMessage< CNETPing, net_Ping, long, unsigned long long, unsigned long long, unsigned long long >
 {
+	enum { SEQUENCE_NR, SEND_TIME, ECHO_TIME, ECHO_DELAY, FIELD_COUNT };
+
 public:
-	CNETPing( INetChannel* pNetChannel ) : INetMessage( pNetChannel )
+	CNETPing( INetChannel* pNetChannel ) : CNetSchemaMessage( pNetChannel )
 	{
-		m_nSequenceNr = 0;
+		m_nFields = FIELD_COUNT;
 	}
 
 	int						Serialize( void* pBuf, unsigned long nSize );
 	bool					DeSerialize( void* pBuf, unsigned long nSize );
+	void					PreSerialize();
 	void					ProcessMessage();
 
-	int						GetType() const { return net_Ping; }
+	int						GetPriority()				const { return NET_PRIORITY_CONTROL; }
+	long					GetSequenceNr()				const { return Field< SEQUENCE_NR >(); }
+	bool					HasTimestamps()				const { return ( m_nFields == FIELD_COUNT ); }
+	unsigned long long		GetSendTime()				const { return Field< SEND_TIME >(); }
+	unsigned long long		GetEchoTime()				const { return Field< ECHO_TIME >(); }
+	unsigned long long		GetEchoDelay()				const { return Field< ECHO_DELAY >(); }
+
+	/* Peers without NET_FEATURE_PING_TIMESTAMPS only take the sequence */
+	void					SetTimestamps( unsigned long long nSendTime, unsigned long long nEchoTime, unsigned long long nEchoDelay )
+	{
+		Field< SEND_TIME >() = nSendTime;
+		Field< ECHO_TIME >() = nEchoTime;
+		Field< ECHO_DELAY >() = nEchoDelay;
+		m_nFields = FIELD_COUNT;
+	}
+
+	void					ClearTimestamps()			{ m_nFields = SEND_TIME; }
 
 private:
-	long					m_nSequenceNr;
+	int						m_nFields;
 };
 
 class CNETDisconnect : public INetMessage
@@ -159,6 +367,7 @@ public:
 	void					ProcessMessage();
 
 	int						GetType()					const { return net_Disconnect; }
+	int						GetPriority()				const { return NET_PRIORITY_CONTROL; }
 	const char*				GetDisconnectReason()		const { return m_szDisconnectReason; }
 
 private:
@@ -185,6 +394,7 @@ public:
 	void					ProcessMessage();
 
 	int						GetType()							const { return net_Transfer; }
+	int						GetPriority()						const { return NET_PRIORITY_BULK; }
 	bool					GetTransmissionHasProps()			const { return ( m_nPropsLength > 0 ); }
 	long					GetTransmissionLength()				const { return m_nLength; }
 	long					GetTransmissionId()					const { return m_nId; }
@@ -227,12 +437,48 @@ private:
 	bf_read					m_ReadProps;
 };
 
+/* A piece of transfer data, sent after the CNETDataTransmission header when */
+/* NET_FEATURE_CHUNKED_TRANSFER is negotiated. Points into the transfer's buffer */
+class CNETTransferData : public INetMessage
+{
+public:
+	CNETTransferData( INetChannel* pNetChannel ) : INetMessage( pNetChannel )
+	{
+		m_nId		= -1;
+		m_nLength	= 0;
+		m_pData		= NULL;
+	}
+
+	int						Serialize( void* pBuf, unsigned long nSize );
+	bool					DeSerialize( void* pBuf, unsigned long nSize );
+	void					ProcessMessage();
+
+	int						GetType()							const { return net_TransferData; }
+	int						GetPriority()						const { return NET_PRIORITY_BULK; }
+	long					GetTransmissionId()					const { return m_nId; }
+	long					GetLength()							const { return m_nLength; }
+	const char*				GetData()							const { return m_pData; }
+
+	void					Init( long nId, const char* pData, long nLength )
+	{
+		m_nId = nId;
+		m_pData = pData;
+		m_nLength = nLength;
+	}
+
+private:
+	long					m_nId;
+	long					m_nLength;
+	const char*				m_pData;
+};
+
 class CNETHandlerMessage : public INetMessage
 {
 public:
 	CNETHandlerMessage( INetChannel* pNetChannel ) : INetMessage( pNetChannel )
 	{
 		m_nLength = NET_PAYLOAD_SIZE;
+		m_pView = NULL;
 
 		m_Read.Init( NULL, 0 );
 		m_Write.Init( NULL, 0 );
@@ -242,70 +488,168 @@ public:
 	bool					DeSerialize( void* pBuf, unsigned long nSize );
 	void					ProcessMessage();
 
+	/* Copies the payload into a message owned by the caller, use to keep */
+	/* data received in zero-copy mode past the handler callback */
+	CNETHandlerMessage*		Retain() const;
+
 	int						GetType() const { return net_HandlerMsg; }
+	bool					IsView() const { return ( m_pView != NULL ); }
 
 	bf_write&				GetWrite()
 	{
+		m_pView = NULL;
 		m_Write.Init( m_Data, m_nLength );
 		return m_Write;
 	}
 
 	bf_read&				GetRead()
 	{
-		m_Read.Init( m_Data, m_nLength );
+		m_Read.Init( m_pView ? m_pView : m_Data, m_nLength );
 		return m_Read;
 	}
 
 public:
 	char					m_Data[ NET_PAYLOAD_SIZE ];
 	long					m_nLength;
+
+	/* Zero-copy receive: points into the channel's receive buffer */
+	/* and is only valid for the duration of the handler callback */
+	const char*				m_pView;
 	bf_write				m_Write;
 	bf_read					m_Read;
 };
 
-
-class CCLCConnect : public INetMessage
+/* Several messages under one frame: [varint length][varint type][payload] per message */
+class CNETBundle : public INetMessage
 {
 public:
-	CCLCConnect( INetChannel* pNetChannel ) : INetMessage( pNetChannel )
+	CNETBundle( INetChannel* pNetChannel ) : INetMessage( pNetChannel )
 	{
-		m_ProtocolHeader = NET_PROTOCOL_VERSION ^ NET_PROTOCOL_MASK;
-		m_ProtocolUid = NET_PROTOCOL_UID;
+		m_nMessages = 0;
+		m_nMaxSize = NET_PAYLOAD_SIZE;
+
+		m_Write.Init( m_Data, sizeof( m_Data ) );
 	}
 
 	int						Serialize( void* pBuf, unsigned long nSize );
 	bool					DeSerialize( void* pBuf, unsigned long nSize );
 	void					ProcessMessage();
 
-	int						GetType()					const { return clc_Connect; }
-	long					GetProtocolVersion()		const { return m_ProtocolHeader; }
-	long					GetProtocolUid()			const { return m_ProtocolUid; }
+	/* Appends a serialized message, false if the bundle would grow past its max size */
+	bool					AddMessage( const void* pMessage, long nLength );
+	void					Reset()						{ m_nMessages = 0; m_Write.Reset(); }
+
+	int						GetType()					const { return net_Bundle; }
+	int						GetMessageCount()			const { return m_nMessages; }
+	void					SetMaxSize( long nMaxSize )	{ m_nMaxSize = ( nMaxSize < NET_PAYLOAD_SIZE ) ? nMaxSize : NET_PAYLOAD_SIZE; }
+
+	/* Handshake messages switch the framing and transfers stream raw data after */
+	/* their header, both have to travel in frames of their own */
+	static bool				IsBundleable( int nType )
+	{
+		return ( nType != clc_Connect && nType != svc_Connect && nType != net_Transfer && nType != net_Bundle );
+	}
+
+private:
+	char					m_Data[ NET_PAYLOAD_SIZE ];
+	int						m_nMessages;
+	long					m_nMaxSize;
+	bf_write				m_Write;
+};
+
+class CCLCConnect : public CNetSchemaMessage< CCLCConnect, clc_Connect, long, long, long, long, unsigned long long >
+{
+	enum { PROTOCOL_HEADER, PROTOCOL_UID, FEATURES, DICTIONARY, SALT, FIELD_COUNT };
+
+public:
+	CCLCConnect( INetChannel* pNetChannel ) : CNetSchemaMessage( pNetChannel )
+	{
+		Field< PROTOCOL_HEADER >() = NET_PROTOCOL_VERSION ^ NET_PROTOCOL_MASK;
+		Field< PROTOCOL_UID >() = NET_PROTOCOL_UID;
+
+		m_nFields = FIELD_COUNT;
+	}
+
+	bool					DeSerialize( void* pBuf, unsigned long nSize );
+	void					ProcessMessage();
+
+	int						GetPriority()				const { return NET_PRIORITY_CONTROL; }
+	long					GetProtocolVersion()		const { return Field< PROTOCOL_HEADER >(); }
+	long					GetProtocolUid()			const { return Field< PROTOCOL_UID >(); }
+	unsigned long			GetFeatures()				const { return Field< FEATURES >(); }
+	unsigned long			GetDictionary()				const { return Field< DICTIONARY >(); }
+	unsigned long long		GetSalt()					const { return Field< SALT >(); }
+	int						GetFieldCount()				const { return m_nFields; }
+	void					SetFeatures( unsigned long nFeatures ) { Field< FEATURES >() = nFeatures; }
+	void					SetDictionary( unsigned long nDictionaryId ) { Field< DICTIONARY >() = nDictionaryId; }
+	void					SetSalt( unsigned long long nSalt ) { Field< SALT >() = nSalt; }
 
 private:
-	long					m_ProtocolHeader;
-	long					m_ProtocolUid;
+	/* Fields received, clients predating a field leave it out */
+	int						m_nFields;
 };
 
-class CSVCConnect : public INetMessage
+class CSVCConnect : public CNetSchemaMessage< CSVCConnect, svc_Connect, long, long, long, unsigned long long >
 {
+	enum { TICKRATE, FEATURES, DICTIONARY, SALT, FIELD_COUNT };
+
 public:
-	CSVCConnect( INetChannel* pNetChannel ) : INetMessage( pNetChannel )
+	CSVCConnect( INetChannel* pNetChannel ) : CNetSchemaMessage( pNetChannel )
 	{
-		m_nTickrate = NET_TICKRATE_DEFAULT;
+		Field< TICKRATE >() = NET_TICKRATE_DEFAULT;
+
+		m_nFields = FIELD_COUNT;
 	}
 
 	int						Serialize( void* pBuf, unsigned long nSize );
 	bool					DeSerialize( void* pBuf, unsigned long nSize );
+	void					PreSerialize();
 	void					ProcessMessage();
 
-	int						GetType() const { return svc_Connect; }
+	int						GetPriority()				const { return NET_PRIORITY_CONTROL; }
+	unsigned long			GetFeatures()				const { return Field< FEATURES >(); }
+	unsigned long			GetDictionary()				const { return Field< DICTIONARY >(); }
+	unsigned long long		GetSalt()					const { return Field< SALT >(); }
+	void					SetSalt( unsigned long long nSalt ) { Field< SALT >() = nSalt; }
+	void					SetFieldCount( int nFields )	{ m_nFields = ( nFields < 1 ) ? 1 : ( nFields > FIELD_COUNT ? FIELD_COUNT : nFields ); }
 
 private:
-	long					m_nTickrate;
+	/* Fields encoded, trimmed for clients predating the trailing ones */
+	int						m_nFields;
+};
+
+/* Tickrate update for a client, sent mid-session */
+class CSVCTickRate : public CNetSchemaMessage< CSVCTickRate, svc_TickRate, long >
+{
+	enum { TICKRATE };
+
+public:
+	CSVCTickRate( INetChannel* pNetChannel ) : CNetSchemaMessage( pNetChannel ) {}
+
+	void					ProcessMessage();
+
+	int						GetPriority()				const { return NET_PRIORITY_CONTROL; }
+	long					GetTickRate()				const { return Field< TICKRATE >(); }
+	void					SetTickRate( long nTickRate )	{ Field< TICKRATE >() = nTickRate; }
 };
 
-bool					NET_StartUp();
+template< class T >
+INetMessage*			NET_CreateMessage( INetChannel* pNetChannel )
+{
+	return new T( pNetChannel );
+}
+
+/* Every allocation of the library goes through pAllocator, the heap if NULL. See Alloc.h */
+bool					NET_StartUp( INetAllocator* pAllocator = NULL );
+bool					NET_RegisterMessage( int nType, NetMessageFactoryFn pfnFactory, unsigned long nFlags = NET_MSG_DEFAULT );
 void					NET_Shutdown();
 INetChannel*			NET_CreateChannel();
+long					NET_TrainDictionary( const char* const* ppSamples, const long* pSampleLengths, int nSamples, char* pDict, long nCapacity );
+unsigned long			NET_RegisterDictionary( const void* pData, long nLength );
 void					NET_DestroyChannel( INetChannel* pNetChannel );
+
+/* Cap on what all listen channels send together, shared fairly between them. 0 for none */
+void					NET_SetEgressLimit( unsigned long nBytesPerSecond );
+
+/* Runs a server frame at nTickRate: pfnPerFrame, then every client's queued messages are sent */
 bool					NET_ProcessListenSocket( const char* pszPort, int nTickRate, ServerRunFrameFn pfnPerFrame, ServerConnectionNotifyFn pfnNotify, INetIntermediateContext* pCtx = NULL );
\ No newline at end of file
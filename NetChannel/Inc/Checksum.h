@@ -0,0 +1,14 @@
+#pragma once
+
+/*
+	CRC32C (Castagnoli) frame checksums
+
+	Computed with the SSE4.2 crc32 instruction where the CPU has it, over
+	three interleaved stripes so the instruction's latency is hidden, and
+	with slicing-by-8 tables otherwise. Both give the same result, so peers
+	on different hardware agree.
+
+	nCrc continues a previous result, pass 0 to start a new checksum.
+*/
+
+unsigned long				NET_Crc32C( const void* pData, unsigned long nLength, unsigned long nCrc = 0 );
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "Channel.h"
+
+/*
+	Streaming LZ compression
+
+	LZ4 style sequences (token, literals, 16 bit offset, match length) over
+	a history window shared by every frame of one direction, so repeated
+	text across messages compresses as well as repeats within a message.
+	Both ends append each payload to their history in order, compressed or
+	not, which keeps the windows identical.
+
+	Frames start with a flag byte: COMPRESSION_RAW followed by the payload,
+	or COMPRESSION_LZ followed by the varint raw length and the sequences.
+
+	With a dictionary every frame is compressed on its own, offsets reach
+	back through the frame into the shared dictionary as if it came right
+	before it. Short messages, which the stream window barely helps, get
+	matches from their first byte on; the channel keeps no history.
+*/
+
+struct net_dictionary_t;
+
+class CNetCompressor : public INetIntermediateContext
+{
+public:
+	/* Its buffers are accounted to pNetChannel, see INetAllocator */
+	CNetCompressor( INetChannel* pNetChannel = NULL );
+	~CNetCompressor();
+
+	bool					IsLengthChanging() const { return true; }
+	long					TransformOutgoing( char* pData, long nLength, long nCapacity );
+	long					TransformIncoming( const char* pData, long nLength, char* pOut, long nOutCapacity );
+
+	void					Reset();
+	void					SetDictionary( const net_dictionary_t* pDictionary );
+	void					GetStats( net_compression_stats_t* pStats ) const;
+
+	enum
+	{
+		COMPRESSION_RAW		= 0,
+		COMPRESSION_LZ		= 1,
+
+		WINDOW_SIZE			= 65535,	/* Largest match offset */
+		HASH_LOG			= 12,
+		MIN_MATCH			= 4,
+		MIN_INPUT			= 16,		/* Smaller payloads are sent raw */
+		LAST_LITERALS		= 5,
+		SKIP_TRIGGER		= 6,		/* Misses before the match search speeds up */
+		MAX_SKIP_FRAMES		= 64
+	};
+
+private:
+	struct history_t
+	{
+		unsigned char*		m_pData;
+		unsigned long		m_nLength;
+		unsigned long		m_nBase;	/* Stream position of m_pData[ 0 ] */
+		unsigned long		m_nCapacity;
+	};
+
+	void					AllocHistory( history_t* pHistory, unsigned long nCapacity );
+	unsigned char*			Append( history_t* pHistory, unsigned long nLength );
+	long					Compress( const unsigned char* pSrc, unsigned long nLength, unsigned char* pDst, unsigned long nCapacity );
+	long					CompressDictionary( const unsigned char* pSrc, unsigned long nLength, unsigned char* pDst, unsigned long nCapacity );
+	bool					Decompress( const unsigned char* pSrc, unsigned long nLength, unsigned char* pDst, unsigned long nRawLength );
+
+	history_t				m_Outgoing;
+	history_t				m_Incoming;
+
+	/* Stream positions, or frame tag << 16 | frame position with a dictionary */
+	unsigned long			m_HashTable[ 1 << HASH_LOG ];
+	unsigned long			m_nFrameTag;
+	unsigned char*			m_pScratch;
+
+	const net_dictionary_t*	m_pDictionary;
+
+	/* Adaptive skip for incompressible traffic */
+	int						m_nFailures;
+	int						m_nSkipFrames;
+
+	net_compression_stats_t	m_Stats;
+	double					m_flTickInterval;
+
+	INetChannel*			m_pNetChannel;
+};
+
+struct net_dictionary_t
+{
+	unsigned long			m_nId;
+	unsigned char*			m_pData;
+	unsigned long			m_nLength;
+
+	/* Match positions in the dictionary, read by every channel using it */
+	unsigned long			m_HashTable[ 1 << CNetCompressor::HASH_LOG ];
+};
+
+/* Dictionaries stay registered until the process exits */
+const net_dictionary_t*	NET_FindDictionary( unsigned long nDictionaryId );
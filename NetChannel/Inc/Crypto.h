@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Channel.h"
+
+/*
+	ChaCha20-Poly1305 authenticated encryption (RFC 8439)
+
+	Every payload is encrypted under its own nonce, made of the direction and
+	a frame counter both ends advance in step, and is followed by a 16 byte
+	tag. The channel passes the frame type and payload length as associated
+	data, so the tag doesn't verify for a frame relabelled on the wire. The session key is HChaCha20 of the pre-shared key over the salts
+	exchanged in the connect handshake, so two sessions never share a nonce.
+
+	Keystream is generated four blocks per pass. Large payloads take four
+	consecutive blocks at a time, small ones have the blocks of the following
+	frame generated alongside their own.
+*/
+
+class CNetCipher : public INetIntermediateContext
+{
+public:
+	CNetCipher();
+	~CNetCipher();
+
+	bool					IsLengthChanging() const { return true; }
+	long					TransformOutgoing( char* pData, long nLength, long nCapacity );
+	long					TransformIncoming( const char* pData, long nLength, char* pOut, long nOutCapacity );
+
+	/* The tag also covers nAADLength bytes at pAAD, which aren't sent */
+	long					TransformOutgoing( char* pData, long nLength, long nCapacity, const void* pAAD, unsigned long nAADLength );
+	long					TransformIncoming( const char* pData, long nLength, char* pOut, long nOutCapacity, const void* pAAD, unsigned long nAADLength );
+
+	void					SetKey( const unsigned char* pKey, unsigned long long nClientSalt, unsigned long long nServerSalt, bool bServer );
+
+	enum
+	{
+		KEY_SIZE			= 32,
+		TAG_SIZE			= 16,
+		BLOCK_SIZE			= 64,
+		BLOCKS_PER_PASS		= 4
+	};
+
+private:
+	struct direction_t
+	{
+		unsigned int		m_nDirection;
+		unsigned long long	m_nFrame;
+
+		/* Blocks 0 and 1 of m_nCachedFrame and the frame after it */
+		bool				m_bCached;
+		unsigned long long	m_nCachedFrame;
+		unsigned char		m_Cache[ BLOCK_SIZE * BLOCKS_PER_PASS ];
+	};
+
+	void					Crypt( direction_t* pDirection, unsigned char* pData, unsigned long nLength, unsigned char* pPolyKey );
+	void					ResetDirection( direction_t* pDirection, unsigned int nDirection );
+
+	unsigned int			m_Key[ KEY_SIZE / 4 ];
+
+	direction_t				m_Outgoing;
+	direction_t				m_Incoming;
+};
+
+/* Random salt for the connect handshake */
+unsigned long long			NET_GenerateSalt();
+
+/* Known answer test of the AEAD construction against RFC 8439, false on a mismatch */
+bool						NET_CipherSelfTest();
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "Channel.h"
+#include "atomic"
+
+/*
+	Channel metrics
+
+	Every channel counts into its own CNetMetrics. Updates happen under the
+	channel's resource lock, so each value has a single writer and is
+	advanced with a relaxed load and store, no interlocked instructions on
+	the hot path. Snapshots read without locking and may be an update behind.
+
+	Histograms have fixed power of two buckets: bucket 0 holds zero, bucket
+	n values from 2^(n-1) up to 2^n - 1, the last one everything larger.
+
+	Global figures are the live channels summed with the totals of those
+	already destroyed.
+*/
+
+enum net_counter_t
+{
+	NET_COUNTER_BYTES_OUT,				/* On the wire, headers and trailers included */
+	NET_COUNTER_BYTES_IN,
+	NET_COUNTER_FRAMES_OUT,
+	NET_COUNTER_FRAMES_IN,
+	NET_COUNTER_MESSAGES_OUT,			/* Bundled messages count one each */
+	NET_COUNTER_MESSAGES_IN,
+	NET_COUNTER_SEND_CALLS,
+	NET_COUNTER_RECV_CALLS,
+	NET_COUNTER_ALLOCATIONS,			/* Scratch, decoded messages and transfer buffers, see Alloc.h for the heap */
+	NET_COUNTER_DECODE_ERRORS,			/* Malformed frames, failed transforms or deserialization */
+	NET_COUNTER_CHECKSUM_ERRORS,
+	NET_COUNTER_DISCONNECTS_LOCAL,		/* Disconnect was called */
+	NET_COUNTER_DISCONNECTS_BY_HOST,	/* The peer sent net_Disconnect */
+	NET_COUNTER_DISCONNECTS_BY_PROTOCOL,
+	NET_COUNTER_DISCONNECTS_LOST,		/* Socket closed or timed out */
+
+	NET_COUNTER_COUNT
+};
+
+enum net_gauge_t
+{
+	NET_GAUGE_CHANNELS,					/* Live channels, 1 for a channel's own snapshot */
+	NET_GAUGE_QUEUED_MESSAGES,			/* Left in the send queues after the last flush */
+	NET_GAUGE_PEAK_QUEUED_MESSAGES,		/* Most found queued at a flush */
+
+	NET_GAUGE_COUNT
+};
+
+enum net_histogram_t
+{
+	NET_HISTOGRAM_RTT,					/* Microseconds, one sample per timestamped ping exchange */
+	NET_HISTOGRAM_SEND_TIME,			/* Microseconds in send for one frame, one in NET_SEND_TIME_SAMPLING */
+	NET_HISTOGRAM_DISPATCH_TIME,		/* Microseconds decoding and handling one receive */
+	NET_HISTOGRAM_FRAME_SIZE,			/* Bytes per frame sent */
+
+	NET_HISTOGRAM_COUNT
+};
+
+#define NET_HISTOGRAM_BUCKETS		32
+#define NET_SEND_TIME_SAMPLING		64		/* Frames per NET_HISTOGRAM_SEND_TIME sample, a power of two */
+
+struct net_metrics_t
+{
+	unsigned long long		m_nCounters[ NET_COUNTER_COUNT ];
+	long long				m_nGauges[ NET_GAUGE_COUNT ];
+	unsigned long long		m_nBuckets[ NET_HISTOGRAM_COUNT ][ NET_HISTOGRAM_BUCKETS ];
+	unsigned long long		m_nSums[ NET_HISTOGRAM_COUNT ];
+};
+
+class CNetMetrics
+{
+public:
+	CNetMetrics( const char* pszLabel );
+	~CNetMetrics();
+
+	__forceinline void		Add( net_counter_t nCounter, unsigned long long nValue = 1 )
+	{
+		Advance( m_nCounters[ nCounter ], nValue );
+	}
+
+	__forceinline void		SetGauge( net_gauge_t nGauge, long long nValue )
+	{
+		m_nGauges[ nGauge ].store( nValue, std::memory_order_relaxed );
+	}
+
+	__forceinline void		Record( net_histogram_t nHistogram, unsigned long long nValue )
+	{
+		Advance( m_nBuckets[ nHistogram ][ GetBucket( nValue ) ], 1 );
+		Advance( m_nSums[ nHistogram ], nValue );
+	}
+
+	long long				GetGauge( net_gauge_t nGauge ) const { return m_nGauges[ nGauge ].load( std::memory_order_relaxed ); }
+	const char*				GetLabel() const { return m_pszLabel; }
+	unsigned long			GetId() const { return m_nId; }
+
+	/* Adds this channel's values to pMetrics */
+	void					Accumulate( net_metrics_t* pMetrics ) const;
+
+	static __forceinline int GetBucket( unsigned long long nValue )
+	{
+		if ( !nValue )
+			return 0;
+
+		if ( nValue >> ( NET_HISTOGRAM_BUCKETS - 2 ) )
+			return NET_HISTOGRAM_BUCKETS - 1;
+
+#ifdef _MSC_VER
+		unsigned long nIndex;
+		_BitScanReverse( &nIndex, ( unsigned long ) nValue );
+		return ( int ) nIndex + 1;
+#else
+		return 32 - __builtin_clz( ( unsigned int ) nValue );
+#endif
+	}
+
+private:
+	/* Single writer, see above */
+	static __forceinline void Advance( std::atomic< unsigned long long >& nValue, unsigned long long nDelta )
+	{
+		nValue.store( nValue.load( std::memory_order_relaxed ) + nDelta, std::memory_order_relaxed );
+	}
+
+	const char*				m_pszLabel;
+	unsigned long			m_nId;
+
+	std::atomic< unsigned long long >	m_nCounters[ NET_COUNTER_COUNT ];
+	std::atomic< long long >			m_nGauges[ NET_GAUGE_COUNT ];
+	std::atomic< unsigned long long >	m_nBuckets[ NET_HISTOGRAM_COUNT ][ NET_HISTOGRAM_BUCKETS ];
+	std::atomic< unsigned long long >	m_nSums[ NET_HISTOGRAM_COUNT ];
+};
+
+/* Every channel, live and destroyed */
+void						NET_GetMetrics( net_metrics_t* pMetrics );
+
+/* Prometheus text exposition of NET_GetMetrics as net_* families. With bPerChannel each */
+/* live channel follows as net_channel_*, labeled by id and host. Returns the length */
+/* written, or -1 if nSize was too small */
+long						NET_DumpMetrics( char* pszBuffer, long nSize, bool bPerChannel = false );
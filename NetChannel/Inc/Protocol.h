@@ -1,42 +1,76 @@
 #pragma once
 
 /* Client messages */
-#define clc_Connect			( 1 << 0 )
-/* #define clc_Reserved		( 1 << 1 )	*/
-/* #define clc_Reserved		( 1 << 2 )	*/
-/* #define clc_Reserved		( 1 << 3 )	*/
-/* #define clc_Reserved		( 1 << 4 )	*/
-/* #define clc_Reserved		( 1 << 5 )	*/
-/* #define clc_Reserved		( 1 << 6 )	*/
-/* #define clc_Reserved		( 1 << 7 )	*/
+#define clc_Connect			0
 
 /* Server messages */
-#define svc_Connect			( 1 << 8 )
-/* #define svc_Reserved		( 1 << 9 )	*/
-/* #define svc_Reserved		( 1 << 10 )	*/
-/* #define svc_Reserved		( 1 << 11 )	*/
-/* #define svc_Reserved		( 1 << 12 )	*/
-/* #define svc_Reserved		( 1 << 13 )	*/
-/* #define svc_Reserved		( 1 << 14 )	*/
-/* #define svc_Reserved		( 1 << 15 )	*/
+#define svc_Connect			1
+#define svc_TickRate		7
 
 /* Protocol messages */
-#define net_Ping			( 1 << 16 )
-#define net_Disconnect		( 1 << 17 )
-#define net_HandlerMsg		( 1 << 18 )
-#define net_Transfer		( 1 << 19 )
-/* #define net_Reserved		( 1 << 20 )	*/
-/* #define net_Reserved		( 1 << 21 )	*/
-/* #define net_Reserved		( 1 << 22 )	*/
-/* #define net_Reserved		( 1 << 23 )	*/
-/* #define net_Reserved		( 1 << 24 )	*/
+#define net_Ping			2
+#define net_Disconnect		3
+#define net_HandlerMsg		4
+#define net_Transfer		5
+#define net_Bundle			6
+#define net_TransferData	8
+/* #define net_Reserved		9 - 15	*/
+
+/* Application messages registered through NET_RegisterMessage */
+#define net_UserMessage		16
+
+/* Version 22 numbered its messages with bit flags, still spoken on the fixed framing to its clients */
+#define NET_LEGACY_clc_Connect		( 1 << 0 )
+#define NET_LEGACY_svc_Connect		( 1 << 8 )
+#define NET_LEGACY_net_Ping			( 1 << 16 )
+#define NET_LEGACY_net_Disconnect	( 1 << 17 )
+#define NET_LEGACY_net_HandlerMsg	( 1 << 18 )
+#define NET_LEGACY_net_Transfer		( 1 << 19 )
+
+#define NET_MESSAGE_TYPES_MAX		256
 
 #define NET_TICKRATE_DEFAULT		32
 #define NET_TICKRATE_MAX			128
 #define NET_TICKRATE_MIN			2
 
+/* Adaptive tickrate, see NET_FEATURE_ADAPTIVE_TICKRATE */
+#define NET_ADAPTIVE_WINDOWS_PER_SEC	4	/* Evaluations per second */
+#define NET_ADAPTIVE_IDLE_WINDOWS		4	/* Idle evaluations before a client is slowed down */
+#define NET_ADAPTIVE_BURST				8	/* Messages queued in one frame that call for the fastest rate */
+#define NET_ADAPTIVE_RTT_TICKS			8	/* Ticks per round trip past which a faster rate gains little */
+
+/* Latency measurement, see NET_FEATURE_PING_TIMESTAMPS */
+#define NET_PING_INTERVAL			500000	/* Microseconds between timestamped pings */
+#define NET_PING_ECHO_TIMEOUT		60000000	/* Echoes of pings older than this are ignored */
+#define NET_CLOCK_FILTER_SAMPLES	8		/* Offset follows the lowest RTT sample of the last few */
+
+/* Send lanes, see INetMessage::GetPriority */
+#define NET_PRIORITY_WEIGHT			4		/* Interactive bytes sent for every bulk byte while both lanes wait */
+#define NET_TRANSFER_CHUNK_SIZE		4000	/* Transfer data per net_TransferData frame */
+
 #define PACKET_MANIFEST_SIZE		( ( long ) sizeof( long ) )
 #define NET_PAYLOAD_SIZE			4098
-#define NET_PROTOCOL_VERSION		22
+#define NET_BUNDLE_SIZE_DEFAULT		1400
+#define NET_TRANSFORM_HEADROOM		64		/* Room for transforms growing a payload */
+#define NET_TRANSFORM_CAPACITY		( NET_PAYLOAD_SIZE + NET_TRANSFORM_HEADROOM )
+#define NET_DICTIONARY_MAX_SIZE		32768	/* Trained compression dictionaries */
+#define NET_ENCRYPTION_KEY_SIZE		32
+#define NET_PROTOCOL_VERSION		23
+#define NET_PROTOCOL_VERSION_LEGACY	22	/* Accepted from clients, see NET_LEGACY_* */
 #define NET_PROTOCOL_MASK			0x200
-#define NET_PROTOCOL_UID			0xA5D2
\ No newline at end of file
+#define NET_PROTOCOL_UID			0xA5D2
+
+/* Optional features, negotiated in the connect handshake */
+#define NET_FEATURE_COMPACT_FRAMING	( 1 << 0 )	/* Varint length and type, implicit sequence */
+#define NET_FEATURE_BUNDLING		( 1 << 1 )	/* Small messages packed into net_Bundle frames */
+#define NET_FEATURE_COMPRESSION		( 1 << 2 )	/* Streaming LZ compression of payloads */
+#define NET_FEATURE_ENCRYPTION		( 1 << 3 )	/* ChaCha20-Poly1305 under a pre-shared key */
+#define NET_FEATURE_CHECKSUM		( 1 << 4 )	/* CRC32C trailer on every frame */
+#define NET_FEATURE_ADAPTIVE_TICKRATE	( 1 << 5 )	/* Server adjusts the client's tickrate with svc_TickRate */
+#define NET_FEATURE_CHUNKED_TRANSFER	( 1 << 6 )	/* Transfer data in net_TransferData frames instead of a raw stream */
+#define NET_FEATURE_PING_TIMESTAMPS	( 1 << 7 )	/* Pings carry timestamps for RTT and clock offset estimates */
+
+#define NET_FEATURES_SUPPORTED		( NET_FEATURE_COMPACT_FRAMING | NET_FEATURE_BUNDLING | NET_FEATURE_COMPRESSION | NET_FEATURE_ENCRYPTION | NET_FEATURE_CHECKSUM | NET_FEATURE_ADAPTIVE_TICKRATE | NET_FEATURE_CHUNKED_TRANSFER | NET_FEATURE_PING_TIMESTAMPS )
+
+/* Offered unless changed with SetFeatures, opt-in features are left out */
+#define NET_FEATURES_DEFAULT		( NET_FEATURE_COMPACT_FRAMING | NET_FEATURE_BUNDLING | NET_FEATURE_ADAPTIVE_TICKRATE | NET_FEATURE_CHUNKED_TRANSFER | NET_FEATURE_PING_TIMESTAMPS )
\ No newline at end of file
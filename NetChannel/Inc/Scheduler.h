@@ -0,0 +1,80 @@
+#pragma once
+
+#include "Channel.h"
+
+/*
+	Fixed timestep scheduler for the network threads
+
+	Ticks are due at absolute deadlines one interval apart, so the time
+	ProcessSocket takes is absorbed instead of added to the sleep, and
+	the rounding of one wait doesn't carry over into the next. A tick
+	that overruns its deadline runs the next one immediately, whole
+	intervals missed on the way are dropped rather than caught up.
+
+	Waits use a high resolution waitable timer where Windows has one,
+	otherwise a regular one with the timer period raised to 1 ms.
+*/
+
+class CNetTickScheduler
+{
+public:
+	CNetTickScheduler();
+	~CNetTickScheduler();
+
+	void					Start( int nTickRate );
+	void					Stop();
+
+	/* Waits out the rest of the current tick, picks up tickrate changes */
+	void					WaitForNextTick( int nTickRate );
+
+	void					GetStats( net_tick_stats_t* pStats ) const { *pStats = m_Stats; }
+
+private:
+	void					SetTickRate( int nTickRate );
+
+	HANDLE					m_hTimer;
+	bool					m_bTimerPeriod;		/* timeBeginPeriod is in effect */
+
+	long long				m_nFrequency;
+	long long				m_nInterval;		/* Performance counter ticks */
+	long long				m_nTickStart;
+	long long				m_nDeadline;
+	int						m_nTickRate;
+
+	net_tick_stats_t		m_Stats;
+	double					m_flTickInterval;
+};
+
+/*
+	Token bucket for egress limits
+
+	Tokens are bytes, refilled at the configured rate up to the burst size.
+	Sends are granted while tokens are left and charged what they actually
+	took, so one that overshoots is paid back before the next is granted.
+*/
+
+class CNetTokenBucket
+{
+public:
+	CNetTokenBucket();
+
+	/* Bytes per second, 0 removes the limit. The burst defaults to a quarter second */
+	void					SetRate( unsigned long nBytesPerSecond, unsigned long nBurst = 0 );
+	void					Refill();
+	void					Consume( long nBytes )		{ m_flTokens -= nBytes; }
+
+	bool					IsLimited()					const { return m_nRate != 0; }
+	long					GetTokens()					const { return ( m_flTokens > 0.0 ) ? ( long ) m_flTokens : 0; }
+
+private:
+	unsigned long			m_nRate;
+	unsigned long			m_nBurst;
+	double					m_flTokens;
+
+	long long				m_nLastRefill;
+	double					m_flTickInterval;
+};
+
+/* Microseconds on the performance counter, offset to the system time of the */
+/* first call. Monotonic, and comparable between hosts up to their clock offset */
+unsigned long long			NET_GetTime();
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "string.h"
+#include "type_traits"
+
+/*
+	Compile-time message schemas
+
+	A schema is a list of fixed size field types, declared once. The wire layout
+	is the fields packed back to back in declaration order, so the encoded size
+	is a compile-time constant and the codecs unroll into one memcpy per field
+	at a constant offset.
+*/
+
+template< class... T >
+struct net_schema_t;
+
+template<>
+struct net_schema_t<>
+{
+	enum { SIZE = 0 };
+
+	static constexpr int	FieldsIn( unsigned long nBytes )			{ return 0; }
+	static constexpr unsigned long PrefixSize( int nFields )			{ return 0; }
+
+	__forceinline void		Encode( unsigned char* pData ) const		{}
+	__forceinline void		Decode( const unsigned char* pData )		{}
+};
+
+template< class T, class... Rest >
+struct net_schema_t< T, Rest... >
+{
+	static_assert( std::is_trivially_copyable< T >::value, "Schema fields must be trivially copyable" );
+
+	enum { SIZE = sizeof( T ) + net_schema_t< Rest... >::SIZE };
+
+	/* Leading fields held by nBytes, and the bytes the first nFields take */
+	static constexpr int	FieldsIn( unsigned long nBytes )			{ return ( nBytes < sizeof( T ) ) ? 0 : 1 + net_schema_t< Rest... >::FieldsIn( nBytes - sizeof( T ) ); }
+	static constexpr unsigned long PrefixSize( int nFields )			{ return ( nFields <= 0 ) ? 0 : sizeof( T ) + net_schema_t< Rest... >::PrefixSize( nFields - 1 ); }
+
+	__forceinline void		Encode( unsigned char* pData ) const
+	{
+		memcpy( pData, &m_Value, sizeof( T ) );
+		m_Rest.Encode( pData + sizeof( T ) );
+	}
+
+	__forceinline void		Decode( const unsigned char* pData )
+	{
+		memcpy( &m_Value, pData, sizeof( T ) );
+		m_Rest.Decode( pData + sizeof( T ) );
+	}
+
+	T						m_Value;
+	net_schema_t< Rest... >	m_Rest;
+};
+
+template< int N >
+struct net_schema_field_t
+{
+	template< class S >
+	static __forceinline decltype( auto ) Get( S& schema )			{ return net_schema_field_t< N - 1 >::Get( schema.m_Rest ); }
+};
+
+template<>
+struct net_schema_field_t< 0 >
+{
+	template< class S >
+	static __forceinline decltype( auto ) Get( S& schema )			{ return ( schema.m_Value ); }
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "atomic"
+
+/*
+	Stage tracing
+
+	While tracing is on, channels timestamp every message as it is queued,
+	serialized, sent, parsed out of a receive, decoded and dispatched, as
+	well as the recv calls and tick waits of their threads. Events go to a
+	ring owned by the thread that records them, so recording takes no lock;
+	the oldest events are overwritten once a ring is full.
+
+	Message ids are per channel and direction. Outgoing ids are assigned
+	when a message is queued, incoming ones when its frame is parsed, the
+	channel id is the one the metrics are labeled with.
+
+	NET_ExportTrace writes the Chrome trace event format, loaded by
+	chrome://tracing and Perfetto: a span per stage on its thread and an
+	async slice per message from the first stage to the last.
+*/
+
+enum net_trace_stage_t
+{
+	NET_TRACE_ENQUEUE,			/* SendNetMessage */
+	NET_TRACE_SERIALIZE,		/* Serialization and outgoing transforms */
+	NET_TRACE_SEND,				/* The send call for the frame carrying the message */
+	NET_TRACE_RECV,				/* A recv call and parsing what it returned, no message */
+	NET_TRACE_PARSE,			/* Frame parsed out of a receive, incoming transforms included */
+	NET_TRACE_DECODE,			/* DeSerialize */
+	NET_TRACE_DISPATCH,			/* ProcessMessage, i.e. the handler */
+	NET_TRACE_WAIT,				/* Tick wait of a network or server thread, no message */
+
+	NET_TRACE_STAGE_COUNT
+};
+
+#define NET_TRACE_RING_SIZE			8192	/* Events per thread, a power of two */
+
+struct net_trace_event_t
+{
+	unsigned long long		m_nTime;		/* NET_GetTime at the start of the stage */
+	unsigned long			m_nDuration;	/* Microseconds, 0 for instants */
+	unsigned long			m_nChannel;
+	unsigned long			m_nMessage;		/* 0 when the stage isn't about one message */
+	unsigned long			m_dwThreadId;
+	short					m_nStage;
+	short					m_nType;		/* Message type, -1 if none */
+};
+
+extern std::atomic< bool >	g_bNetTracing;
+
+__forceinline bool			NET_IsTracing() { return g_bNetTracing.load( std::memory_order_relaxed ); }
+
+/* Tracing is off by default. Starting it again discards the events recorded so far */
+void						NET_StartTrace();
+void						NET_StopTrace();
+
+/* Records to the calling thread's ring, callers check NET_IsTracing first */
+void						NET_TraceEvent( net_trace_stage_t nStage, unsigned long nChannel, unsigned long nMessage, int nType, unsigned long long nTime, unsigned long long nDuration = 0 );
+
+/* Chrome trace JSON of every thread's ring. Returns the events written, or -1 if the file couldn't be written */
+long						NET_ExportTrace( const char* pszFileName );
@@ -0,0 +1,289 @@
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include "windows.h"
+#include "stdio.h"
+#include "stdarg.h"
+#include "vector"
+
+#include "Inc/Metrics.h"
+
+struct net_metrics_registry_t
+{
+	net_metrics_registry_t()
+	{
+		InitializeCriticalSection( &m_hLock );
+		memset( &m_Retired, 0, sizeof( m_Retired ) );
+		m_nLastId = 0;
+	}
+
+	CRITICAL_SECTION				m_hLock;
+	std::vector< CNetMetrics* >		m_Live;
+	unsigned long					m_nLastId;
+
+	/* Counters and histograms of destroyed channels */
+	net_metrics_t					m_Retired;
+};
+
+/* Channels can be created before NET_StartUp, so the registry sets itself up on first use */
+static net_metrics_registry_t& NET_GetMetricsRegistry()
+{
+	static net_metrics_registry_t registry;
+	return registry;
+}
+
+CNetMetrics::CNetMetrics( const char* pszLabel )
+{
+	m_pszLabel = pszLabel;
+
+	for ( int i = 0; i < NET_COUNTER_COUNT; ++i )
+		m_nCounters[ i ].store( 0, std::memory_order_relaxed );
+
+	for ( int i = 0; i < NET_GAUGE_COUNT; ++i )
+		m_nGauges[ i ].store( 0, std::memory_order_relaxed );
+
+	for ( int i = 0; i < NET_HISTOGRAM_COUNT; ++i )
+	{
+		m_nSums[ i ].store( 0, std::memory_order_relaxed );
+
+		for ( int j = 0; j < NET_HISTOGRAM_BUCKETS; ++j )
+			m_nBuckets[ i ][ j ].store( 0, std::memory_order_relaxed );
+	}
+
+	m_nGauges[ NET_GAUGE_CHANNELS ].store( 1, std::memory_order_relaxed );
+
+	net_metrics_registry_t& registry = NET_GetMetricsRegistry();
+
+	EnterCriticalSection( &registry.m_hLock );
+	m_nId = ++registry.m_nLastId;
+	registry.m_Live.push_back( this );
+	LeaveCriticalSection( &registry.m_hLock );
+}
+
+CNetMetrics::~CNetMetrics()
+{
+	net_metrics_registry_t& registry = NET_GetMetricsRegistry();
+
+	EnterCriticalSection( &registry.m_hLock );
+
+	/* Gauges describe live channels only */
+	net_metrics_t& retired = registry.m_Retired;
+	long long nGauges[ NET_GAUGE_COUNT ];
+	memcpy( nGauges, retired.m_nGauges, sizeof( nGauges ) );
+
+	Accumulate( &retired );
+	memcpy( retired.m_nGauges, nGauges, sizeof( nGauges ) );
+
+	int c = registry.m_Live.size();
+	for ( int i = 0; i < c; ++i )
+	{
+		if ( registry.m_Live[ i ] == this )
+		{
+			registry.m_Live.erase( registry.m_Live.begin() + i );
+			break;
+		}
+	}
+
+	LeaveCriticalSection( &registry.m_hLock );
+}
+
+void CNetMetrics::Accumulate( net_metrics_t* pMetrics ) const
+{
+	for ( int i = 0; i < NET_COUNTER_COUNT; ++i )
+		pMetrics->m_nCounters[ i ] += m_nCounters[ i ].load( std::memory_order_relaxed );
+
+	pMetrics->m_nGauges[ NET_GAUGE_CHANNELS ] += GetGauge( NET_GAUGE_CHANNELS );
+	pMetrics->m_nGauges[ NET_GAUGE_QUEUED_MESSAGES ] += GetGauge( NET_GAUGE_QUEUED_MESSAGES );
+	pMetrics->m_nGauges[ NET_GAUGE_PEAK_QUEUED_MESSAGES ] = max( pMetrics->m_nGauges[ NET_GAUGE_PEAK_QUEUED_MESSAGES ], GetGauge( NET_GAUGE_PEAK_QUEUED_MESSAGES ) );
+
+	for ( int i = 0; i < NET_HISTOGRAM_COUNT; ++i )
+	{
+		pMetrics->m_nSums[ i ] += m_nSums[ i ].load( std::memory_order_relaxed );
+
+		for ( int j = 0; j < NET_HISTOGRAM_BUCKETS; ++j )
+			pMetrics->m_nBuckets[ i ][ j ] += m_nBuckets[ i ][ j ].load( std::memory_order_relaxed );
+	}
+}
+
+void NET_GetMetrics( net_metrics_t* pMetrics )
+{
+	net_metrics_registry_t& registry = NET_GetMetricsRegistry();
+
+	EnterCriticalSection( &registry.m_hLock );
+
+	*pMetrics = registry.m_Retired;
+
+	int c = registry.m_Live.size();
+	for ( int i = 0; i < c; ++i )
+		registry.m_Live[ i ]->Accumulate( pMetrics );
+
+	LeaveCriticalSection( &registry.m_hLock );
+}
+
+/* Family names follow "net_" for the totals and "net_channel_" per channel */
+static const char* g_szCounterNames[ NET_COUNTER_COUNT ] =
+{
+	"bytes_out_total",
+	"bytes_in_total",
+	"frames_out_total",
+	"frames_in_total",
+	"messages_out_total",
+	"messages_in_total",
+	"send_calls_total",
+	"recv_calls_total",
+	"allocations_total",
+	"decode_errors_total",
+	"checksum_errors_total",
+	"disconnects_local_total",
+	"disconnects_by_host_total",
+	"disconnects_by_protocol_total",
+	"disconnects_lost_total"
+};
+
+static const char* g_szGaugeNames[ NET_GAUGE_COUNT ] =
+{
+	"channels",
+	"queued_messages",
+	"peak_queued_messages"
+};
+
+static const char* g_szHistogramNames[ NET_HISTOGRAM_COUNT ] =
+{
+	"rtt_microseconds",
+	"send_time_microseconds",
+	"dispatch_time_microseconds",
+	"frame_size_bytes"
+};
+
+struct net_dump_t
+{
+	char*					m_pszBuffer;
+	long					m_nSize;
+	long					m_nLength;
+	bool					m_bOverflow;
+};
+
+struct net_dump_source_t
+{
+	net_metrics_t			m_Metrics;
+	char					m_szLabels[ 96 ];	/* Empty for the totals */
+	char					m_szBucketLabels[ 96 ];	/* Followed by le */
+};
+
+static void NET_DumpPrint( net_dump_t* pDump, const char* pszFormat, ... )
+{
+	if ( pDump->m_bOverflow )
+		return;
+
+	va_list args;
+	va_start( args, pszFormat );
+	int nLength = vsnprintf( pDump->m_pszBuffer + pDump->m_nLength, pDump->m_nSize - pDump->m_nLength, pszFormat, args );
+	va_end( args );
+
+	if ( nLength < 0 || nLength >= pDump->m_nSize - pDump->m_nLength )
+	{
+		pDump->m_bOverflow = true;
+		return;
+	}
+
+	pDump->m_nLength += nLength;
+}
+
+/* Every family once, with one sample set per source */
+static void NET_DumpFamilies( net_dump_t* pDump, const char* pszPrefix, const net_dump_source_t* pSources, int nSources )
+{
+	for ( int i = 0; i < NET_COUNTER_COUNT; ++i )
+	{
+		NET_DumpPrint( pDump, "# TYPE %s%s counter\n", pszPrefix, g_szCounterNames[ i ] );
+
+		for ( int s = 0; s < nSources; ++s )
+			NET_DumpPrint( pDump, "%s%s%s %llu\n", pszPrefix, g_szCounterNames[ i ], pSources[ s ].m_szLabels, pSources[ s ].m_Metrics.m_nCounters[ i ] );
+	}
+
+	for ( int i = 0; i < NET_GAUGE_COUNT; ++i )
+	{
+		NET_DumpPrint( pDump, "# TYPE %s%s gauge\n", pszPrefix, g_szGaugeNames[ i ] );
+
+		for ( int s = 0; s < nSources; ++s )
+			NET_DumpPrint( pDump, "%s%s%s %lld\n", pszPrefix, g_szGaugeNames[ i ], pSources[ s ].m_szLabels, pSources[ s ].m_Metrics.m_nGauges[ i ] );
+	}
+
+	for ( int i = 0; i < NET_HISTOGRAM_COUNT; ++i )
+	{
+		NET_DumpPrint( pDump, "# TYPE %s%s histogram\n", pszPrefix, g_szHistogramNames[ i ] );
+
+		for ( int s = 0; s < nSources; ++s )
+		{
+			const net_metrics_t& metrics = pSources[ s ].m_Metrics;
+			const char* pszLabels = pSources[ s ].m_szLabels;
+			const char* pszBucketLabels = pSources[ s ].m_szBucketLabels;
+
+			/* Cumulative, le is the largest value each bucket holds */
+			unsigned long long nCount = 0;
+
+			for ( int j = 0; j < NET_HISTOGRAM_BUCKETS - 1; ++j )
+			{
+				nCount += metrics.m_nBuckets[ i ][ j ];
+				NET_DumpPrint( pDump, "%s%s_bucket{%sle=\"%llu\"} %llu\n", pszPrefix, g_szHistogramNames[ i ], pszBucketLabels, ( 1ULL << j ) - 1, nCount );
+			}
+
+			nCount += metrics.m_nBuckets[ i ][ NET_HISTOGRAM_BUCKETS - 1 ];
+
+			NET_DumpPrint( pDump, "%s%s_bucket{%sle=\"+Inf\"} %llu\n", pszPrefix, g_szHistogramNames[ i ], pszBucketLabels, nCount );
+			NET_DumpPrint( pDump, "%s%s_sum%s %llu\n", pszPrefix, g_szHistogramNames[ i ], pszLabels, metrics.m_nSums[ i ] );
+			NET_DumpPrint( pDump, "%s%s_count%s %llu\n", pszPrefix, g_szHistogramNames[ i ], pszLabels, nCount );
+		}
+	}
+}
+
+long NET_DumpMetrics( char* pszBuffer, long nSize, bool bPerChannel )
+{
+	net_dump_t dump;
+	dump.m_pszBuffer = pszBuffer;
+	dump.m_nSize = nSize;
+	dump.m_nLength = 0;
+	dump.m_bOverflow = ( nSize <= 0 );
+
+	net_dump_source_t* pTotals = NET_New< net_dump_source_t >( NET_ALLOC_GLOBAL, NULL );
+	pTotals->m_szLabels[ 0 ] = '\0';
+	pTotals->m_szBucketLabels[ 0 ] = '\0';
+	NET_GetMetrics( &pTotals->m_Metrics );
+
+	NET_DumpFamilies( &dump, "net_", pTotals, 1 );
+	NET_Delete( pTotals, NET_ALLOC_GLOBAL );
+
+	if ( bPerChannel )
+	{
+		/* Copied out so formatting doesn't hold up channels being created or destroyed */
+		net_dump_source_t* sources = NULL;
+		net_metrics_registry_t& registry = NET_GetMetricsRegistry();
+
+		EnterCriticalSection( &registry.m_hLock );
+
+		int c = registry.m_Live.size();
+		if ( c )
+			sources = ( net_dump_source_t* ) NET_Alloc( c * sizeof( net_dump_source_t ), NET_ALLOC_GLOBAL );
+
+		for ( int i = 0; i < c; ++i )
+		{
+			const CNetMetrics* pMetrics = registry.m_Live[ i ];
+
+			memset( &sources[ i ].m_Metrics, 0, sizeof( net_metrics_t ) );
+			pMetrics->Accumulate( &sources[ i ].m_Metrics );
+
+			snprintf( sources[ i ].m_szLabels, sizeof( sources[ i ].m_szLabels ), "{channel=\"%lu\",host=\"%s\"}", pMetrics->GetId(), pMetrics->GetLabel() );
+			snprintf( sources[ i ].m_szBucketLabels, sizeof( sources[ i ].m_szBucketLabels ), "channel=\"%lu\",host=\"%s\",", pMetrics->GetId(), pMetrics->GetLabel() );
+		}
+
+		LeaveCriticalSection( &registry.m_hLock );
+
+		if ( c )
+		{
+			NET_DumpFamilies( &dump, "net_channel_", sources, c );
+			NET_Free( sources, c * sizeof( net_dump_source_t ), NET_ALLOC_GLOBAL );
+		}
+	}
+
+	return dump.m_bOverflow ? -1 : dump.m_nLength;
+}
@@ -14,39 +14,47 @@
 INetMessage::INetMessage( INetChannel* pNetChannel )
 {
 	m_pNetChannel = pNetChannel;
+	m_nTraceId = 0;
 }
 
-int CNETPing::Serialize( void* pBuf, unsigned long nSize )
+void INetMessage::ProcessMessage()
 {
-	long* pData = ( long* ) CreateManifest( pBuf, nSize );
-
-	if ( !pData )
-		return -1;
-
-	m_nSequenceNr = 0;
-
 	INetChannel* pNetChannel = GetChannel();
 
 	if ( pNetChannel )
-		m_nSequenceNr = pNetChannel->GetIncomingSequenceNr();
+		pNetChannel->ProcessHandlerMessage( this );
+}
+
+int CNETPing::Serialize( void* pBuf, unsigned long nSize )
+{
+	int nLength = CNetSchemaMessage::Serialize( pBuf, nSize );
 
-	pData[ 0 ] = m_nSequenceNr;
-	return PACKET_MANIFEST_SIZE + sizeof( long );
+	if ( nLength > 0 )
+		nLength = PACKET_MANIFEST_SIZE + schema_t::PrefixSize( m_nFields );
+
+	return nLength;
 }
 
 bool CNETPing::DeSerialize( void* pBuf, unsigned long nSize )
 {
-	if ( nSize != PACKET_MANIFEST_SIZE + sizeof( long ) )
+	if ( !DeSerializePrefix( pBuf, nSize, PACKET_MANIFEST_SIZE + sizeof( long ) ) )
 		return false;
 
-	m_nSequenceNr = *( long* ) pBuf;
+	m_nFields = schema_t::FieldsIn( nSize - PACKET_MANIFEST_SIZE );
 	return true;
 }
 
+void CNETPing::PreSerialize()
+{
+	INetChannel* pNetChannel = GetChannel();
+
+	Field< SEQUENCE_NR >() = pNetChannel ? pNetChannel->GetIncomingSequenceNr() : 0;
+}
+
 void CNETPing::ProcessMessage()
 {
 #ifdef _DEBUG
-	//printf( "CNETPing::ProcessMessage: nSequenceNr: %i\n", m_nSequenceNr );
+	//printf( "CNETPing::ProcessMessage: nSequenceNr: %i\n", GetSequenceNr() );
 #endif
 }
 
@@ -144,6 +152,38 @@ void CNETDataTransmission::ProcessMessage()
 
 }
 
+int CNETTransferData::Serialize( void* pBuf, unsigned long nSize )
+{
+	char* pData = ( char* ) CreateManifest( pBuf, nSize );
+
+	if ( !pData )
+		return -1;
+
+	if ( nSize < PACKET_MANIFEST_SIZE + sizeof( long ) + m_nLength )
+		return -1;
+
+	( ( long* ) pData )[ 0 ] = m_nId;
+	memcpy( pData + sizeof( long ), m_pData, m_nLength );
+
+	return PACKET_MANIFEST_SIZE + sizeof( long ) + m_nLength;
+}
+
+bool CNETTransferData::DeSerialize( void* pBuf, unsigned long nSize )
+{
+	if ( nSize < PACKET_MANIFEST_SIZE + sizeof( long ) )
+		return false;
+
+	m_nId		= ( ( long* ) pBuf )[ 0 ];
+	m_pData		= ( const char* ) pBuf + sizeof( long );
+	m_nLength	= nSize - PACKET_MANIFEST_SIZE - sizeof( long );
+	return true;
+}
+
+void CNETTransferData::ProcessMessage()
+{
+	/* Reassembled by the channel as it is received */
+}
+
 int CNETHandlerMessage::Serialize( void* pBuf, unsigned long nSize )
 {
 	void* pData = CreateManifest( pBuf, nSize );
@@ -164,10 +204,30 @@ bool CNETHandlerMessage::DeSerialize( void* pBuf, unsigned long nSize )
 		return false;
 
 	m_nLength = nSize - PACKET_MANIFEST_SIZE;
+
+	INetChannel* pNetChannel = GetChannel();
+
+	if ( pNetChannel && pNetChannel->IsZeroCopyReceive() )
+	{
+		m_pView = ( const char* ) pBuf;
+		return true;
+	}
+
+	m_pView = NULL;
 	memcpy( m_Data, pBuf, m_nLength );
 	return true;
 }
 
+CNETHandlerMessage* CNETHandlerMessage::Retain() const
+{
+	CNETHandlerMessage* pRetained = new CNETHandlerMessage( GetChannel() );
+
+	pRetained->m_nLength = m_nLength;
+	memcpy( pRetained->m_Data, m_pView ? m_pView : m_Data, m_nLength );
+
+	return pRetained;
+}
+
 void CNETHandlerMessage::ProcessMessage()
 {
 	INetChannel* pNetChannel = GetChannel();
@@ -176,61 +236,114 @@ void CNETHandlerMessage::ProcessMessage()
 		pNetChannel->ProcessHandlerMessage( this );
 }
 
-int CCLCConnect::Serialize( void* pBuf, unsigned long nSize )
+int CNETBundle::Serialize( void* pBuf, unsigned long nSize )
 {
-	long* pData = ( long* ) CreateManifest( pBuf, nSize );
+	/* A lone message goes out as itself, the bundle would only add to its header */
+	if ( m_nMessages == 1 )
+	{
+		bf_read entry;
+		entry.Init( m_Data, m_Write.GetNumBytesWritten() );
+
+		unsigned long nPayloadSize = entry.ReadVarInt32();
+		long nType = entry.ReadVarInt32();
+
+		if ( nSize < PACKET_MANIFEST_SIZE + nPayloadSize )
+			return -1;
+
+		( ( long* ) pBuf )[ 0 ] = nType;
+		memcpy( ( char* ) pBuf + PACKET_MANIFEST_SIZE, m_Data + entry.GetNumBytesRead(), nPayloadSize );
+
+		return PACKET_MANIFEST_SIZE + nPayloadSize;
+	}
+
+	void* pData = CreateManifest( pBuf, nSize );
 
 	if ( !pData )
 		return -1;
 
-	if ( nSize < PACKET_MANIFEST_SIZE + ( sizeof( long ) * 2 ) )
+	if ( nSize < m_Write.GetNumBytesWritten() + PACKET_MANIFEST_SIZE )
 		return -1;
 
-	pData[ 0 ] = m_ProtocolHeader;
-	pData[ 1 ] = m_ProtocolUid;
+	memcpy( pData, m_Data, m_Write.GetNumBytesWritten() );
+	return PACKET_MANIFEST_SIZE + m_Write.GetNumBytesWritten();
+}
+
+bool CNETBundle::DeSerialize( void* pBuf, unsigned long nSize )
+{
+	if ( nSize < PACKET_MANIFEST_SIZE || nSize > PACKET_MANIFEST_SIZE + NET_PAYLOAD_SIZE )
+		return false;
+
+	Reset();
+	m_Write.WriteBytes( pBuf, nSize - PACKET_MANIFEST_SIZE );
 
-	return PACKET_MANIFEST_SIZE + ( sizeof( long ) * 2 );
+	return true;
 }
 
-bool CCLCConnect::DeSerialize( void* pBuf, unsigned long nSize )
+void CNETBundle::ProcessMessage()
+{
+	/* Unpacked by the channel as it's received */
+}
+
+bool CNETBundle::AddMessage( const void* pMessage, long nLength )
 {
-	if ( nSize > PACKET_MANIFEST_SIZE + ( sizeof( long ) * 2 ) )
+	if ( nLength < PACKET_MANIFEST_SIZE )
 		return false;
 
-	m_ProtocolHeader		= ( ( long* ) pBuf )[ 0 ];
-	m_ProtocolUid			= ( ( long* ) pBuf )[ 1 ];
+	unsigned long nPayloadSize = nLength - PACKET_MANIFEST_SIZE;
+	unsigned long nType = ( ( const long* ) pMessage )[ 0 ];
 
+	unsigned long nEntrySize = BitBuf_VarInt32Size( nPayloadSize ) + BitBuf_VarInt32Size( nType ) + nPayloadSize;
+
+	if ( PACKET_MANIFEST_SIZE + m_Write.GetNumBytesWritten() + nEntrySize > ( unsigned long ) m_nMaxSize )
+		return false;
+
+	m_Write.WriteVarInt32( nPayloadSize );
+	m_Write.WriteVarInt32( nType );
+	m_Write.WriteBytes( ( const char* ) pMessage + PACKET_MANIFEST_SIZE, nPayloadSize );
+
+	++m_nMessages;
 	return true;
 }
 
-void CCLCConnect::ProcessMessage()
+bool CCLCConnect::DeSerialize( void* pBuf, unsigned long nSize )
 {
+	if ( !DeSerializePrefix( pBuf, nSize, PACKET_MANIFEST_SIZE + sizeof( long ) * 2 ) )
+		return false;
 
+	m_nFields = schema_t::FieldsIn( nSize - PACKET_MANIFEST_SIZE );
+	return true;
 }
 
-int CSVCConnect::Serialize( void* pBuf, unsigned long nSize )
+void CCLCConnect::ProcessMessage()
 {
-	long* pData = ( long* ) CreateManifest( pBuf, nSize );
 
-	if ( !pData )
-		return -1;
+}
 
-	INetChannel* pNetChannel = GetChannel();
+int CSVCConnect::Serialize( void* pBuf, unsigned long nSize )
+{
+	int nLength = CNetSchemaMessage::Serialize( pBuf, nSize );
 
-	if ( pNetChannel )
-		m_nTickrate = pNetChannel->GetTickRate();
+	if ( nLength > 0 )
+		nLength = PACKET_MANIFEST_SIZE + schema_t::PrefixSize( m_nFields );
 
-	pData[ 0 ] = m_nTickrate;
-	return PACKET_MANIFEST_SIZE + sizeof( long );
+	return nLength;
 }
 
 bool CSVCConnect::DeSerialize( void* pBuf, unsigned long nSize )
 {
-	if ( nSize != PACKET_MANIFEST_SIZE + sizeof( long ) )
-		return false;
+	return DeSerializePrefix( pBuf, nSize, PACKET_MANIFEST_SIZE + sizeof( long ) );
+}
 
-	m_nTickrate = *( long* ) pBuf;
-	return true;
+void CSVCConnect::PreSerialize()
+{
+	INetChannel* pNetChannel = GetChannel();
+
+	if ( pNetChannel )
+	{
+		Field< TICKRATE >() = pNetChannel->GetTickRate();
+		Field< FEATURES >() = pNetChannel->GetFeatures();
+		Field< DICTIONARY >() = pNetChannel->GetDictionary();
+	}
 }
 
 void CSVCConnect::ProcessMessage()
@@ -238,5 +351,14 @@ void CSVCConnect::ProcessMessage()
 	INetChannel* pNetChannel = GetChannel();
 
 	if ( pNetChannel )
-		pNetChannel->SetTickRate( m_nTickrate );
+		pNetChannel->SetTickRate( Field< TICKRATE >() );
+}
+
+void CSVCTickRate::ProcessMessage()
+{
+	INetChannel* pNetChannel = GetChannel();
+	long nTickRate = GetTickRate();
+
+	if ( pNetChannel && nTickRate >= NET_TICKRATE_MIN && nTickRate <= NET_TICKRATE_MAX )
+		pNetChannel->SetTickRate( nTickRate );
 }
\ No newline at end of file
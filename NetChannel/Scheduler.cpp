@@ -0,0 +1,213 @@
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include "windows.h"
+#include "mmsystem.h"
+#include "Inc/Scheduler.h"
+
+#pragma comment( lib, "winmm.lib" )
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION	0x00000002
+#endif
+
+CNetTickScheduler::CNetTickScheduler()
+{
+	m_hTimer = NULL;
+	m_bTimerPeriod = false;
+
+	LARGE_INTEGER nFrequency;
+	QueryPerformanceFrequency( &nFrequency );
+	m_nFrequency = nFrequency.QuadPart;
+	m_flTickInterval = 1.0 / ( double ) m_nFrequency;
+
+	m_nInterval = 0;
+	m_nTickStart = 0;
+	m_nDeadline = 0;
+	m_nTickRate = 0;
+
+	memset( &m_Stats, 0, sizeof( m_Stats ) );
+}
+
+CNetTickScheduler::~CNetTickScheduler()
+{
+	Stop();
+}
+
+void CNetTickScheduler::Start( int nTickRate )
+{
+	Stop();
+
+	/* Windows 10 1803 and later, older versions fail the flag */
+	m_hTimer = CreateWaitableTimerExW( NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS );
+
+	memset( &m_Stats, 0, sizeof( m_Stats ) );
+	m_Stats.m_bHighResolution = ( m_hTimer != NULL );
+
+	if ( !m_hTimer )
+	{
+		m_hTimer = CreateWaitableTimerExW( NULL, NULL, 0, TIMER_ALL_ACCESS );
+		m_bTimerPeriod = ( timeBeginPeriod( 1 ) == 0 );
+	}
+
+	LARGE_INTEGER nNow;
+	QueryPerformanceCounter( &nNow );
+
+	m_nTickRate = 0;
+	SetTickRate( nTickRate );
+
+	m_nTickStart = nNow.QuadPart;
+	m_nDeadline = nNow.QuadPart + m_nInterval;
+}
+
+void CNetTickScheduler::Stop()
+{
+	if ( m_hTimer )
+		CloseHandle( m_hTimer );
+
+	if ( m_bTimerPeriod )
+		timeEndPeriod( 1 );
+
+	m_hTimer = NULL;
+	m_bTimerPeriod = false;
+}
+
+void CNetTickScheduler::SetTickRate( int nTickRate )
+{
+	if ( nTickRate < 1 )
+		nTickRate = 1;
+
+	m_nTickRate = nTickRate;
+	m_nInterval = m_nFrequency / nTickRate;
+}
+
+void CNetTickScheduler::WaitForNextTick( int nTickRate )
+{
+	LARGE_INTEGER nNow;
+	QueryPerformanceCounter( &nNow );
+
+	double flWorkTime = ( double ) ( nNow.QuadPart - m_nTickStart ) * m_flTickInterval;
+	m_Stats.m_flWorkTime += flWorkTime;
+
+	if ( flWorkTime > m_Stats.m_flMaxWorkTime )
+		m_Stats.m_flMaxWorkTime = flWorkTime;
+
+	/* A new rate starts counting from the tick that just ran */
+	if ( nTickRate != m_nTickRate )
+	{
+		SetTickRate( nTickRate );
+		m_nDeadline = m_nTickStart + m_nInterval;
+	}
+
+	if ( nNow.QuadPart >= m_nDeadline )
+	{
+		long long nMissed = ( nNow.QuadPart - m_nDeadline ) / m_nInterval;
+
+		++m_Stats.m_nOverruns;
+		m_Stats.m_nSkippedTicks += nMissed;
+		m_nDeadline += nMissed * m_nInterval;
+	}
+	else
+	{
+		/* Relative due time, in 100 ns units */
+		LARGE_INTEGER nDueTime;
+		nDueTime.QuadPart = -( ( m_nDeadline - nNow.QuadPart ) * 10000000 / m_nFrequency );
+
+		if ( m_hTimer && SetWaitableTimer( m_hTimer, &nDueTime, 0, NULL, NULL, FALSE ) )
+			WaitForSingleObject( m_hTimer, INFINITE );
+		else
+			Sleep( ( DWORD ) ( -nDueTime.QuadPart / 10000 ) );
+
+		QueryPerformanceCounter( &nNow );
+
+		double flJitter = ( double ) ( nNow.QuadPart - m_nDeadline ) * m_flTickInterval;
+		if ( flJitter < 0.0 )
+			flJitter = -flJitter;
+
+		m_Stats.m_flJitter += flJitter;
+
+		if ( flJitter > m_Stats.m_flMaxJitter )
+			m_Stats.m_flMaxJitter = flJitter;
+	}
+
+	++m_Stats.m_nTicks;
+	m_nTickStart = nNow.QuadPart;
+	m_nDeadline += m_nInterval;
+}
+
+CNetTokenBucket::CNetTokenBucket()
+{
+	LARGE_INTEGER nFrequency;
+	QueryPerformanceFrequency( &nFrequency );
+	m_flTickInterval = 1.0 / ( double ) nFrequency.QuadPart;
+
+	m_nRate = 0;
+	m_nBurst = 0;
+	m_flTokens = 0.0;
+	m_nLastRefill = 0;
+}
+
+void CNetTokenBucket::SetRate( unsigned long nBytesPerSecond, unsigned long nBurst )
+{
+	m_nRate = nBytesPerSecond;
+	m_nBurst = nBurst ? nBurst : nBytesPerSecond / 4;
+
+	/* Room for at least one full frame, or nothing large would ever be granted */
+	if ( m_nBurst < NET_TRANSFORM_CAPACITY )
+		m_nBurst = NET_TRANSFORM_CAPACITY;
+
+	LARGE_INTEGER nNow;
+	QueryPerformanceCounter( &nNow );
+
+	m_flTokens = m_nBurst;
+	m_nLastRefill = nNow.QuadPart;
+}
+
+void CNetTokenBucket::Refill()
+{
+	LARGE_INTEGER nNow;
+	QueryPerformanceCounter( &nNow );
+
+	if ( m_nRate )
+	{
+		m_flTokens += ( double ) ( nNow.QuadPart - m_nLastRefill ) * m_flTickInterval * m_nRate;
+
+		if ( m_flTokens > m_nBurst )
+			m_flTokens = m_nBurst;
+	}
+
+	m_nLastRefill = nNow.QuadPart;
+}
+
+struct net_clock_t
+{
+	net_clock_t()
+	{
+		LARGE_INTEGER nFrequency, nNow;
+		QueryPerformanceFrequency( &nFrequency );
+		QueryPerformanceCounter( &nNow );
+
+		FILETIME ft;
+		GetSystemTimeAsFileTime( &ft );
+
+		m_nFrequency = nFrequency.QuadPart;
+		m_nStart = nNow.QuadPart;
+		m_nEpoch = ( ( ( unsigned long long ) ft.dwHighDateTime << 32 ) | ft.dwLowDateTime ) / 10;
+	}
+
+	long long				m_nFrequency;
+	long long				m_nStart;
+	unsigned long long		m_nEpoch;
+};
+
+unsigned long long NET_GetTime()
+{
+	static net_clock_t clock;
+
+	LARGE_INTEGER nNow;
+	QueryPerformanceCounter( &nNow );
+
+	long long nElapsed = nNow.QuadPart - clock.m_nStart;
+	return clock.m_nEpoch + ( nElapsed / clock.m_nFrequency ) * 1000000 + ( nElapsed % clock.m_nFrequency ) * 1000000 / clock.m_nFrequency;
+}
@@ -0,0 +1,261 @@
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include "windows.h"
+#include "stdio.h"
+#include "vector"
+
+#include "Inc/Trace.h"
+#include "Inc/Scheduler.h"
+#include "Inc/Alloc.h"
+
+struct net_trace_ring_t
+{
+	net_trace_event_t					m_Events[ NET_TRACE_RING_SIZE ];
+	std::atomic< unsigned long long >	m_nHead;		/* Events ever written */
+
+	/* Rings of exited threads are handed to new ones, their events are kept until overwritten */
+	bool								m_bInUse;
+};
+
+struct net_trace_registry_t
+{
+	net_trace_registry_t()
+	{
+		InitializeCriticalSection( &m_hLock );
+		m_nStartTime = 0;
+	}
+
+	CRITICAL_SECTION					m_hLock;
+	std::vector< net_trace_ring_t* >	m_Rings;
+	unsigned long long					m_nStartTime;	/* Events before the last NET_StartTrace are skipped */
+};
+
+static net_trace_registry_t& NET_GetTraceRegistry()
+{
+	static net_trace_registry_t registry;
+	return registry;
+}
+
+/* Gives the ring back when its thread exits */
+struct net_trace_thread_t
+{
+	net_trace_thread_t() { m_pRing = NULL; }
+
+	~net_trace_thread_t()
+	{
+		if ( !m_pRing )
+			return;
+
+		net_trace_registry_t& registry = NET_GetTraceRegistry();
+
+		EnterCriticalSection( &registry.m_hLock );
+		m_pRing->m_bInUse = false;
+		LeaveCriticalSection( &registry.m_hLock );
+	}
+
+	net_trace_ring_t*					m_pRing;
+	DWORD								m_dwThreadId;
+};
+
+std::atomic< bool > g_bNetTracing( false );
+static thread_local net_trace_thread_t g_TraceThread;
+
+static net_trace_ring_t* NET_AcquireTraceRing()
+{
+	net_trace_registry_t& registry = NET_GetTraceRegistry();
+	net_trace_ring_t* pRing = NULL;
+
+	EnterCriticalSection( &registry.m_hLock );
+
+	int c = registry.m_Rings.size();
+	for ( int i = 0; i < c; ++i )
+	{
+		if ( !registry.m_Rings[ i ]->m_bInUse )
+		{
+			pRing = registry.m_Rings[ i ];
+			break;
+		}
+	}
+
+	if ( !pRing )
+	{
+		pRing = NET_New< net_trace_ring_t >( NET_ALLOC_GLOBAL, NULL );
+		pRing->m_nHead.store( 0, std::memory_order_relaxed );
+		registry.m_Rings.push_back( pRing );
+	}
+
+	pRing->m_bInUse = true;
+
+	LeaveCriticalSection( &registry.m_hLock );
+	return pRing;
+}
+
+void NET_StartTrace()
+{
+	net_trace_registry_t& registry = NET_GetTraceRegistry();
+
+	EnterCriticalSection( &registry.m_hLock );
+	registry.m_nStartTime = NET_GetTime();
+	LeaveCriticalSection( &registry.m_hLock );
+
+	g_bNetTracing.store( true, std::memory_order_relaxed );
+}
+
+void NET_StopTrace()
+{
+	g_bNetTracing.store( false, std::memory_order_relaxed );
+}
+
+void NET_TraceEvent( net_trace_stage_t nStage, unsigned long nChannel, unsigned long nMessage, int nType, unsigned long long nTime, unsigned long long nDuration )
+{
+	net_trace_ring_t* pRing = g_TraceThread.m_pRing;
+
+	if ( !pRing )
+	{
+		pRing = g_TraceThread.m_pRing = NET_AcquireTraceRing();
+		g_TraceThread.m_dwThreadId = GetCurrentThreadId();
+	}
+
+	/* Only this thread writes the ring, the head is published after the event */
+	unsigned long long nHead = pRing->m_nHead.load( std::memory_order_relaxed );
+
+	net_trace_event_t& event = pRing->m_Events[ nHead & ( NET_TRACE_RING_SIZE - 1 ) ];
+	event.m_nTime		= nTime;
+	event.m_nDuration	= ( unsigned long ) nDuration;
+	event.m_nChannel	= nChannel;
+	event.m_nMessage	= nMessage;
+	event.m_dwThreadId	= g_TraceThread.m_dwThreadId;
+	event.m_nStage		= ( short ) nStage;
+	event.m_nType		= ( short ) nType;
+
+	pRing->m_nHead.store( nHead + 1, std::memory_order_release );
+}
+
+static const char* g_szStageNames[ NET_TRACE_STAGE_COUNT ] =
+{
+	"enqueue",
+	"serialize",
+	"send",
+	"recv",
+	"parse",
+	"decode",
+	"dispatch",
+	"wait"
+};
+
+static const char* g_szTypeNames[] =
+{
+	"clc_Connect",
+	"svc_Connect",
+	"net_Ping",
+	"net_Disconnect",
+	"net_HandlerMsg",
+	"net_Transfer",
+	"net_Bundle",
+	"svc_TickRate",
+	"net_TransferData"
+};
+
+static void NET_WriteTraceEvent( FILE* pFile, const net_trace_event_t& event )
+{
+	DWORD dwThreadId = event.m_dwThreadId;
+	char szType[ 32 ];
+
+	if ( event.m_nType >= 0 && event.m_nType < sizeof( g_szTypeNames ) / sizeof( g_szTypeNames[ 0 ] ) )
+		snprintf( szType, sizeof( szType ), "%s", g_szTypeNames[ event.m_nType ] );
+	else
+		snprintf( szType, sizeof( szType ), "type_%d", event.m_nType );
+
+	const char* pszStage = g_szStageNames[ event.m_nStage ];
+
+	/* The stage on its thread */
+	fprintf( pFile, ",\n{\"name\":\"%s\",\"cat\":\"net\",\"pid\":1,\"tid\":%lu,\"ts\":%llu,", pszStage, dwThreadId, event.m_nTime );
+
+	if ( event.m_nStage == NET_TRACE_ENQUEUE || event.m_nStage == NET_TRACE_PARSE )
+		fprintf( pFile, "\"ph\":\"i\",\"s\":\"t\"," );
+	else
+		fprintf( pFile, "\"ph\":\"X\",\"dur\":%lu,", event.m_nDuration );
+
+	fprintf( pFile, "\"args\":{\"channel\":%lu,\"message\":%lu,\"type\":\"%s\"}}", event.m_nChannel, event.m_nMessage, event.m_nType >= 0 ? szType : "" );
+
+	if ( !event.m_nMessage )
+		return;
+
+	/* The message's own timeline, an async slice per direction and id with the stages nested */
+	bool bOutgoing = ( event.m_nStage <= NET_TRACE_SEND );
+	const char* pszCategory = bOutgoing ? "outgoing" : "incoming";
+	unsigned long long nId = ( ( unsigned long long ) event.m_nChannel << 32 ) | event.m_nMessage;
+	unsigned long long nEnd = event.m_nTime + event.m_nDuration;
+
+	if ( event.m_nStage == NET_TRACE_ENQUEUE || event.m_nStage == NET_TRACE_PARSE )
+	{
+		fprintf( pFile, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"b\",\"id\":\"0x%llx\",\"pid\":1,\"tid\":%lu,\"ts\":%llu}", szType, pszCategory, nId, dwThreadId, event.m_nTime );
+		return;
+	}
+
+	fprintf( pFile, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"b\",\"id\":\"0x%llx\",\"pid\":1,\"tid\":%lu,\"ts\":%llu}", pszStage, pszCategory, nId, dwThreadId, event.m_nTime );
+	fprintf( pFile, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"e\",\"id\":\"0x%llx\",\"pid\":1,\"tid\":%lu,\"ts\":%llu}", pszStage, pszCategory, nId, dwThreadId, nEnd );
+
+	if ( event.m_nStage == NET_TRACE_SEND || event.m_nStage == NET_TRACE_DISPATCH )
+		fprintf( pFile, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"e\",\"id\":\"0x%llx\",\"pid\":1,\"tid\":%lu,\"ts\":%llu}", szType, pszCategory, nId, dwThreadId, nEnd );
+}
+
+long NET_ExportTrace( const char* pszFileName )
+{
+	FILE* pFile = fopen( pszFileName, "w" );
+
+	if ( !pFile )
+		return -1;
+
+	net_trace_registry_t& registry = NET_GetTraceRegistry();
+	net_trace_event_t* pEvents = ( net_trace_event_t* ) NET_Alloc( sizeof( net_trace_event_t ) * NET_TRACE_RING_SIZE, NET_ALLOC_GLOBAL );
+	long nWritten = 0;
+
+	fprintf( pFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"NetChannel\"}}" );
+
+	/* Held so no ring is added meanwhile, their owners keep recording */
+	EnterCriticalSection( &registry.m_hLock );
+
+	int c = registry.m_Rings.size();
+	for ( int i = 0; i < c; ++i )
+	{
+		net_trace_ring_t* pRing = registry.m_Rings[ i ];
+
+		unsigned long long nHead = pRing->m_nHead.load( std::memory_order_acquire );
+		unsigned long long nCopied = ( nHead > NET_TRACE_RING_SIZE ) ? nHead - NET_TRACE_RING_SIZE : 0;
+
+		for ( unsigned long long n = nCopied; n < nHead; ++n )
+			pEvents[ n - nCopied ] = pRing->m_Events[ n & ( NET_TRACE_RING_SIZE - 1 ) ];
+
+		/* Whatever the owner wrapped around to while copying is torn, skip it */
+		unsigned long long nFirst = nCopied;
+		unsigned long long nLatest = pRing->m_nHead.load( std::memory_order_acquire );
+
+		if ( nLatest >= NET_TRACE_RING_SIZE && nLatest - NET_TRACE_RING_SIZE + 1 > nFirst )
+			nFirst = min( nLatest - NET_TRACE_RING_SIZE + 1, nHead );
+
+		for ( unsigned long long n = nFirst; n < nHead; ++n )
+		{
+			const net_trace_event_t& event = pEvents[ n - nCopied ];
+
+			if ( event.m_nTime < registry.m_nStartTime )
+				continue;
+
+			NET_WriteTraceEvent( pFile, event );
+			++nWritten;
+		}
+	}
+
+	LeaveCriticalSection( &registry.m_hLock );
+
+	fprintf( pFile, "\n]}\n" );
+
+	NET_Free( pEvents, sizeof( net_trace_event_t ) * NET_TRACE_RING_SIZE, NET_ALLOC_GLOBAL );
+
+	bool bOK = !ferror( pFile );
+	fclose( pFile );
+
+	return bOK ? nWritten : -1;
+}